@@ -18,6 +18,15 @@ HWND mfb_open(const char* name, int width, int height, int scale);
 // Will return -1 when ESC key is pressed (later on will return keycode and -1 on other close signal) 
 int mfb_update(void* buffer, int fps_limit);
 
+// A band of whole rows of the buffer, y to y + height - 1
+typedef struct {
+    int y;
+    int height;
+} MFB_RECT;
+
+// Update the display like mfb_update, copying only the given bands of the buffer to the window
+int mfb_update_rects(void* buffer, const MFB_RECT* rects, int count, int fps_limit);
+
 // Close the window
 void mfb_close();
 char * mfb_keystatus();
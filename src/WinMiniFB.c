@@ -3,6 +3,7 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -119,15 +120,11 @@ HWND mfb_open(const char* title, int width, int height, int scale) {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-int mfb_update(void* buffer, int fps_limit) {
+// Handles the window's messages and waits out the rest of the frame
+static int mfb_wait(int fps_limit) {
     static DWORD previousFrameTime = 0;
     MSG msg;
 
-    s_buffer = buffer;
-
-    InvalidateRect(s_wnd, NULL, TRUE);
-    SendMessage(s_wnd, WM_PAINT, 0, 0);
-
     while (PeekMessage(&msg, s_wnd, 0, 0, PM_REMOVE)) {
         TranslateMessage(&msg);
         DispatchMessage(&msg);
@@ -150,6 +147,30 @@ int mfb_update(void* buffer, int fps_limit) {
     return 0;
 }
 
+int mfb_update(void* buffer, int fps_limit) {
+    s_buffer = buffer;
+
+    InvalidateRect(s_wnd, NULL, TRUE);
+    SendMessage(s_wnd, WM_PAINT, 0, 0);
+
+    return mfb_wait(fps_limit);
+}
+
+int mfb_update_rects(void* buffer, const MFB_RECT* rects, int count, int fps_limit) {
+    s_buffer = buffer;
+
+    // Each band goes as a top-down DIB of its own, starting at its first row, WM_PAINT still repaints everything
+    for (int i = 0; i < count; i++) {
+        s_bitmapInfo->bmiHeader.biHeight = -rects[i].height;
+        StretchDIBits(s_hdc, 0, rects[i].y * s_scale, s_width * s_scale, rects[i].height * s_scale, 0, 0, s_width,
+                      rects[i].height, (const uint16_t*) buffer + rects[i].y * s_width, s_bitmapInfo, DIB_RGB_COLORS,
+                      SRCCOPY);
+    }
+    s_bitmapInfo->bmiHeader.biHeight = -s_height;
+
+    return mfb_wait(fps_limit);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void mfb_close() {
@@ -0,0 +1,100 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "cheat.h"
+
+CHEATS *cheats_new(const ROM_IMAGE *rom) {
+    CHEATS *cheats = new CHEATS();
+    cheats->rom_hash = rom->hash;
+    return cheats;
+}
+
+void cheats_free(CHEATS *cheats) {
+    for (uint8_t *page : cheats->banked)
+        free(page);
+    for (uint8_t *page : cheats->fixed)
+        free(page);
+    delete cheats;
+}
+
+// Copy on write: the first patch to a page copies it out of the image at offset
+static void patch_byte(CHEATS *cheats, uint8_t *&page, const ROM_IMAGE *rom, size_t offset, uint8_t value) {
+    if (!page) {
+        page = (uint8_t *) malloc(256);
+        memcpy(page, rom->data + (offset & ~(size_t) 0xFF), 256);
+        cheats->patched_pages++;
+    }
+
+    page[offset & 0xFF] = value;
+}
+
+bool cheats_patch(CHEATS *cheats, const ROM_IMAGE *rom, uint16_t address, uint8_t value, int compare) {
+    if (address < 0x8000)
+        return false;
+
+    // C000-FFFF is always the last bank, 8000-BFFF any of them, and each window has copies of its own
+    const size_t banks = rom->size / ROM_BANK_SIZE;
+    const bool fixed = address >= 0xC000;
+    const size_t first = fixed ? banks - 1 : 0;
+    bool patched = false;
+
+    for (size_t bank = first; bank < banks; bank++) {
+        const size_t offset = bank * ROM_BANK_SIZE + (address & (ROM_BANK_SIZE - 1));
+        if (compare < 0 || rom->data[offset] == compare) {
+            uint8_t *&page = fixed ? cheats->fixed[(address >> 8) - 0xC0] : cheats->banked[offset >> 8];
+            patch_byte(cheats, page, rom, offset, value);
+            patched = true;
+        }
+    }
+
+    if (patched)
+        cheats->patches++;
+    return patched;
+}
+
+bool cheats_freeze(CHEATS *cheats, uint16_t address, uint8_t value) {
+    const bool ram = address < 0x2000 || (address >= 0x4000 && address < 0x8000);
+    if (!ram || cheats->freeze_count == CHEAT_MAX_FREEZES)
+        return false;
+
+    cheats->freezes[cheats->freeze_count++] = {address, value};
+    return true;
+}
+
+bool cheats_parse(CHEATS *cheats, const ROM_IMAGE *rom, const char *code) {
+    unsigned address, value, compare;
+    char end;
+
+    const int fields = sscanf(code, " %x:%x:%x %c", &address, &value, &compare, &end);
+    bool applied = false;
+    if (fields >= 2 && address <= 0xFFFF && value <= 0xFF && (fields == 2 || compare <= 0xFF) && fields < 4) {
+        if (address >= 0x8000)
+            applied = cheats_patch(cheats, rom, (uint16_t) address, (uint8_t) value, fields == 3 ? (int) compare : -1);
+        else if (fields == 2)
+            applied = cheats_freeze(cheats, (uint16_t) address, (uint8_t) value);
+    }
+
+    if (!applied)
+        printf("Cannot apply cheat %s\n", code);
+    return applied;
+}
+
+bool cheats_load(CHEATS *cheats, const ROM_IMAGE *rom, const char *pathname) {
+    char line[256];
+
+    FILE *file = fopen(pathname, "r");
+    if (!file)
+        return false;
+
+    bool loaded = true;
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "#\r\n")] = 0;
+        if (line[strspn(line, " \t")] && !cheats_parse(cheats, rom, line))
+            loaded = false;
+    }
+
+    fclose(file);
+    return loaded;
+}
@@ -0,0 +1,65 @@
+#ifndef CHEAT_H
+#define CHEAT_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "rom.h"
+
+#define CHEAT_MAX_FREEZES 64
+
+// A RAM or VRAM byte written back every frame
+typedef struct {
+    uint16_t address;
+    uint8_t value;
+} CHEAT_FREEZE;
+
+/*
+ * Cheats for one ROM: patches to the ROM and freezes of RAM.
+ *
+ * The ROM image is shared and mapped read-only, so a patch copies the 256-byte page it falls in once and changes the
+ * copy. Machines running with the cheats map their patched ROM pages to those copies instead of the image, whichever
+ * bank is selected; every other page still reads the image directly, through the same cpu.Page lookup as without
+ * cheats. Code on a patched page is interpreted, the predecoded blocks only cover the image.
+ *
+ * 8000-BFFF and C000-FFFF keep copies of their own: the last bank shows in both windows, and a patch made for one of
+ * them must not change what the other reads.
+ *
+ * Freezes are written back by the machine once per frame, when the NMI is due.
+ *
+ * Any number of machines running the ROM can share one CHEATS, it is only read while they run.
+ */
+typedef struct {
+    uint32_t rom_hash;
+    // Patched copy of each ROM page, NULL where the image shows through
+    uint8_t *banked[ROM_MAX_SIZE / 256];  // 8000-BFFF, by offset in the image
+    uint8_t *fixed[ROM_BANK_SIZE / 256];  // C000-FFFF, by offset in the last bank
+    int patched_pages;
+    int patches;
+    CHEAT_FREEZE freezes[CHEAT_MAX_FREEZES];
+    int freeze_count;
+} CHEATS;
+
+CHEATS *cheats_new(const ROM_IMAGE *rom);
+void cheats_free(CHEATS *cheats);
+
+/*
+ * Game Genie style patch: value replaces the byte the CPU reads at address, 8000-FFFF. With a compare value (0-FF,
+ * -1 for none) only the banks holding compare there are patched, which is how a code picks one bank of 8000-BFFF.
+ * A patch to 8000-BFFF never shows at C000-FFFF, nor the other way round. Returns false if address is not ROM or no
+ * bank holds compare.
+ */
+bool cheats_patch(CHEATS *cheats, const ROM_IMAGE *rom, uint16_t address, uint8_t value, int compare);
+
+// Holds the RAM or VRAM byte at address (0000-1FFF, 4000-7FFF) at value, returns false for other addresses or too many
+bool cheats_freeze(CHEATS *cheats, uint16_t address, uint8_t value);
+
+/*
+ * One code in text: AAAA:VV freezes RAM or patches ROM depending on the address, AAAA:VV:CC patches ROM where it holds
+ * CC. Hex digits. cheats_load reads a file of them, one per line, with # starting a comment. Both return false after
+ * printing the offending code.
+ */
+bool cheats_parse(CHEATS *cheats, const ROM_IMAGE *rom, const char *code);
+bool cheats_load(CHEATS *cheats, const ROM_IMAGE *rom, const char *pathname);
+
+#endif //CHEAT_H
@@ -0,0 +1,242 @@
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define LCD_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#define LCD_AVX2
+#else
+#define LCD_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#include "lcd.h"
+
+#define RGB565(r, g, b) ((((r) >> 3) << 11) | (((g) >> 2) << 5) | ((b) >> 3))
+static const uint16_t watara_palette[] = {
+        RGB565(0x7b, 0xc7, 0x7b),
+        RGB565(0x52, 0xa6, 0x8c),
+        RGB565(0x2e, 0x62, 0x60),
+        RGB565(0x0d, 0x32, 0x2e),
+};
+
+// The 4 pixels of each VRAM byte, the first in the low 16 bits
+static uint64_t pixel_table[256];
+
+// Low and high byte of the first and the second pixel of each nibble, twice over for both halves of a YMM register
+alignas(32) static uint8_t nibble_tables[4][32];
+
+static bool build_tables() {
+    for (int byte = 0; byte < 256; byte++) {
+        for (int i = 0; i < 4; i++)
+            pixel_table[byte] |= (uint64_t) watara_palette[(byte >> (i * 2)) & 3] << (i * 16);
+    }
+
+    for (int i = 0; i < 32; i++) {
+        const int nibble = i & 15;
+        nibble_tables[0][i] = (uint8_t) watara_palette[nibble & 3];
+        nibble_tables[1][i] = (uint8_t) (watara_palette[nibble & 3] >> 8);
+        nibble_tables[2][i] = (uint8_t) watara_palette[nibble >> 2];
+        nibble_tables[3][i] = (uint8_t) (watara_palette[nibble >> 2] >> 8);
+    }
+    return true;
+}
+
+[[maybe_unused]] static const bool tables_built = build_tables();
+
+static void decode_pixel(uint16_t *out, const uint8_t *vram, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        uint8_t pixel = vram[i];
+        for (int x = 0; x < 4; x++, pixel >>= 2)
+            *out++ = watara_palette[pixel & 3];
+    }
+}
+
+static void decode_scalar(uint16_t *out, const uint8_t *vram, int bytes) {
+    for (int i = 0; i < bytes; i++)
+        memcpy(out + i * 4, &pixel_table[vram[i]], sizeof(uint64_t));
+}
+
+// Division rounds towards zero, so the ghost of a channel never overshoots or stops short of screen
+static inline int ghost_channel(int previous, int current, int level) {
+    return current + (previous - current) * level / LCD_GHOST_LEVELS;
+}
+
+static void ghost_scalar(uint16_t *out, const uint16_t *screen, int pixels, int level) {
+    for (int i = 0; i < pixels; i++) {
+        const int previous = out[i], current = screen[i];
+        out[i] = (uint16_t) (ghost_channel(previous >> 11, current >> 11, level) << 11 |
+                             ghost_channel(previous >> 5 & 0x3F, current >> 5 & 0x3F, level) << 5 |
+                             ghost_channel(previous & 0x1F, current & 0x1F, level));
+    }
+}
+
+#ifdef LCD_X86
+static_assert(LCD_GHOST_LEVELS == 16, "The vector blends divide by shifting");
+
+static void decode_sse2(uint16_t *out, const uint8_t *vram, int bytes) {
+    int i = 0;
+    for (; i + 2 <= bytes; i += 2) {
+        const __m128i first = _mm_loadl_epi64((const __m128i *) &pixel_table[vram[i]]);
+        const __m128i second = _mm_loadl_epi64((const __m128i *) &pixel_table[vram[i + 1]]);
+        _mm_storeu_si128((__m128i *) (out + i * 4), _mm_unpacklo_epi64(first, second));
+    }
+    decode_scalar(out + i * 4, vram + i, bytes - i);
+}
+
+// The same division by 16 as a shift, adding 15 to negative deltas first to round them towards zero
+static inline __m128i ghost_channel_sse2(__m128i previous, __m128i current, __m128i level) {
+    const __m128i delta = _mm_mullo_epi16(_mm_sub_epi16(previous, current), level);
+    const __m128i rounding = _mm_and_si128(_mm_srai_epi16(delta, 15), _mm_set1_epi16(15));
+    return _mm_add_epi16(current, _mm_srai_epi16(_mm_add_epi16(delta, rounding), 4));
+}
+
+// Red, green and blue split into 16-bit lanes, 8 pixels at a time
+static void ghost_sse2(uint16_t *out, const uint16_t *screen, int pixels, int level) {
+    const __m128i weight = _mm_set1_epi16((short) level);
+    const __m128i green = _mm_set1_epi16(0x3F);
+    const __m128i blue = _mm_set1_epi16(0x1F);
+
+    int i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        const __m128i previous = _mm_loadu_si128((const __m128i *) (out + i));
+        const __m128i current = _mm_loadu_si128((const __m128i *) (screen + i));
+
+        const __m128i r = ghost_channel_sse2(_mm_srli_epi16(previous, 11), _mm_srli_epi16(current, 11), weight);
+        const __m128i g = ghost_channel_sse2(_mm_and_si128(_mm_srli_epi16(previous, 5), green),
+                                             _mm_and_si128(_mm_srli_epi16(current, 5), green), weight);
+        const __m128i b = ghost_channel_sse2(_mm_and_si128(previous, blue), _mm_and_si128(current, blue), weight);
+        _mm_storeu_si128((__m128i *) (out + i),
+                         _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, 11), _mm_slli_epi16(g, 5)), b));
+    }
+    ghost_scalar(out + i, screen + i, pixels - i, level);
+}
+
+/*
+ * A nibble holds 2 pixels, so PSHUFB on nibble_tables gives the low and high byte of either of them. Each of 8 VRAM
+ * bytes is spread over 4 lanes, 2 holding its low nibble and 2 its high one, and looked up in the first or second
+ * pixel tables by lane.
+ */
+LCD_AVX2 static void decode_avx2(uint16_t *out, const uint8_t *vram, int bytes) {
+    const __m256i even_low = _mm256_load_si256((const __m256i *) nibble_tables[0]);
+    const __m256i even_high = _mm256_load_si256((const __m256i *) nibble_tables[1]);
+    const __m256i odd_low = _mm256_load_si256((const __m256i *) nibble_tables[2]);
+    const __m256i odd_high = _mm256_load_si256((const __m256i *) nibble_tables[3]);
+
+    // Pixel 4n+k comes from byte n, its low nibble for k < 2 and its high one, 8 lanes further, otherwise
+    const __m256i spread = _mm256_setr_epi8(0, 0, 8, 8, 1, 1, 9, 9, 2, 2, 10, 10, 3, 3, 11, 11,
+                                            4, 4, 12, 12, 5, 5, 13, 13, 6, 6, 14, 14, 7, 7, 15, 15);
+    const __m256i odd = _mm256_set1_epi16((short) 0xFF00);
+    const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+
+    int i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        const __m128i packed = _mm_loadl_epi64((const __m128i *) (vram + i));
+        const __m128i nibbles = _mm_and_si128(_mm_unpacklo_epi64(packed, _mm_srli_epi16(packed, 4)), nibble_mask);
+        const __m256i lanes = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(nibbles), spread);
+
+        const __m256i low = _mm256_blendv_epi8(_mm256_shuffle_epi8(even_low, lanes), _mm256_shuffle_epi8(odd_low, lanes), odd);
+        const __m256i high = _mm256_blendv_epi8(_mm256_shuffle_epi8(even_high, lanes), _mm256_shuffle_epi8(odd_high, lanes), odd);
+
+        // Pixels 0-7 and 16-23, then 8-15 and 24-31
+        const __m256i first = _mm256_unpacklo_epi8(low, high);
+        const __m256i second = _mm256_unpackhi_epi8(low, high);
+        _mm256_storeu_si256((__m256i *) (out + i * 4), _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i *) (out + i * 4 + 16), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    decode_scalar(out + i * 4, vram + i, bytes - i);
+}
+
+LCD_AVX2 static inline __m256i ghost_channel_avx2(__m256i previous, __m256i current, __m256i level) {
+    const __m256i delta = _mm256_mullo_epi16(_mm256_sub_epi16(previous, current), level);
+    const __m256i rounding = _mm256_and_si256(_mm256_srai_epi16(delta, 15), _mm256_set1_epi16(15));
+    return _mm256_add_epi16(current, _mm256_srai_epi16(_mm256_add_epi16(delta, rounding), 4));
+}
+
+LCD_AVX2 static void ghost_avx2(uint16_t *out, const uint16_t *screen, int pixels, int level) {
+    const __m256i weight = _mm256_set1_epi16((short) level);
+    const __m256i green = _mm256_set1_epi16(0x3F);
+    const __m256i blue = _mm256_set1_epi16(0x1F);
+
+    int i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        const __m256i previous = _mm256_loadu_si256((const __m256i *) (out + i));
+        const __m256i current = _mm256_loadu_si256((const __m256i *) (screen + i));
+
+        const __m256i r = ghost_channel_avx2(_mm256_srli_epi16(previous, 11), _mm256_srli_epi16(current, 11), weight);
+        const __m256i g = ghost_channel_avx2(_mm256_and_si256(_mm256_srli_epi16(previous, 5), green),
+                                             _mm256_and_si256(_mm256_srli_epi16(current, 5), green), weight);
+        const __m256i b = ghost_channel_avx2(_mm256_and_si256(previous, blue), _mm256_and_si256(current, blue), weight);
+        _mm256_storeu_si256((__m256i *) (out + i),
+                            _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi16(r, 11), _mm256_slli_epi16(g, 5)), b));
+    }
+    ghost_scalar(out + i, screen + i, pixels - i, level);
+}
+
+static bool cpu_has_avx2() {
+#ifdef _MSC_VER
+    int registers[4];
+    __cpuid(registers, 0);
+    if (registers[0] < 7)
+        return false;
+
+    // AVX2 needs the OS to save the YMM registers
+    __cpuid(registers, 1);
+    if (!(registers[2] & (1 << 27)) || !(registers[2] & (1 << 28)) || (_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(registers, 7, 0);
+    return registers[1] & (1 << 5);
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+LCD_KERNEL lcd_kernels[] = {
+        {"pixel", decode_pixel, ghost_scalar, true},
+        {"scalar", decode_scalar, ghost_scalar, true},
+#ifdef LCD_X86
+        {"sse2", decode_sse2, ghost_sse2, true},
+        {"avx2", decode_avx2, ghost_avx2, cpu_has_avx2()},
+#endif
+};
+
+const int lcd_kernel_count = sizeof(lcd_kernels) / sizeof(lcd_kernels[0]);
+
+static int best_kernel() {
+    int best = 0;
+    for (int i = 0; i < lcd_kernel_count; i++) {
+        if (lcd_kernels[i].supported) best = i;
+    }
+    return best;
+}
+
+int lcd_kernel_index = best_kernel();
+
+void lcd_decode(uint16_t *out, const uint8_t *vram, int skip, int count) {
+    uint64_t pixels;
+
+    // The rest of a byte the scroll starts in
+    if (skip) {
+        const int head = count < 4 - skip ? count : 4 - skip;
+        pixels = pixel_table[*vram++] >> (skip * 16);
+        memcpy(out, &pixels, head * sizeof(uint16_t));
+        out += head;
+        count -= head;
+    }
+
+    lcd_kernels[lcd_kernel_index].decode(out, vram, count / 4);
+
+    // Pixels left over from the last byte
+    if (count & 3) {
+        pixels = pixel_table[vram[count / 4]];
+        memcpy(out + (count & ~3), &pixels, (count & 3) * sizeof(uint16_t));
+    }
+}
+
+void lcd_ghost(uint16_t *out, const uint16_t *screen, int pixels, int level) {
+    lcd_kernels[lcd_kernel_index].ghost(out, screen, pixels, level);
+}
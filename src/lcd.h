@@ -0,0 +1,46 @@
+#ifndef LCD_H
+#define LCD_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Decodes bytes of 2bpp VRAM, 4 pixels each with the first in the low bits, into 4 * bytes RGB565 pixels
+typedef void (*lcd_kernel)(uint16_t *out, const uint8_t *vram, int bytes);
+
+/*
+ * LCD ghosting: moves each RGB565 channel of out, the previous output, level / LCD_GHOST_LEVELS of the way from the
+ * pixel in screen back to where it was, rounding towards screen so that a still image always settles on its pixels
+ */
+typedef void (*lcd_ghost_kernel)(uint16_t *out, const uint16_t *screen, int pixels, int level);
+
+#define LCD_GHOST_LEVELS 16
+
+typedef struct {
+    const char *name;
+    lcd_kernel decode;
+    lcd_ghost_kernel ghost;
+    bool supported;                // The host CPU can run it
+} LCD_KERNEL;
+
+/*
+ * 2bpp to RGB565 decoders and ghosting blends, all giving the same pixels:
+ *   pixel   one palette lookup per pixel, as the LCD used to draw
+ *   scalar  one 8-byte store per VRAM byte, from a 256-entry table of 4 decoded pixels
+ *   sse2    the same table, two entries packed per 16-byte store
+ *   avx2    no table: the palette in 16-entry PSHUFB tables indexed by each nibble, 8 VRAM bytes per pass
+ * Ghosting is plain C for the first two, then 8 and 16 pixels at a time, their channels in 16-bit lanes.
+ * The best one the CPU supports is picked when the program starts.
+ */
+extern LCD_KERNEL lcd_kernels[];
+extern const int lcd_kernel_count;
+
+// Index in lcd_kernels of the one lcd_decode uses
+extern int lcd_kernel_index;
+
+// Writes count pixels to out, starting skip pixels (0-3) into the first VRAM byte, as for a fine X scroll
+void lcd_decode(uint16_t *out, const uint8_t *vram, int skip, int count);
+
+// Blends a frame into the previous output with the same kernel, level 1 to LCD_GHOST_LEVELS - 1
+void lcd_ghost(uint16_t *out, const uint16_t *screen, int pixels, int level);
+
+#endif //LCD_H
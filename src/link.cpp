@@ -0,0 +1,181 @@
+#include <cstdio>
+#include <cstdint>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "link.h"
+
+// Maps the block called name, creating it zeroed if this is the first side to open it
+static LINK_SHARED *map_shared(LINK *link, const char *name) {
+#ifdef _WIN32
+    snprintf(link->name, sizeof(link->name), "Local\\watara-link-%s", name);
+
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(LINK_SHARED), link->name);
+    void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(LINK_SHARED)) : nullptr;
+    if (!view) {
+        if (mapping) CloseHandle(mapping);
+        return nullptr;
+    }
+
+    link->mapping = mapping;
+    return (LINK_SHARED *) view;
+#else
+    snprintf(link->name, sizeof(link->name), "/watara-link-%s", name);
+
+    const int file = shm_open(link->name, O_RDWR | O_CREAT, 0600);
+    if (file < 0)
+        return nullptr;
+
+    // Growing a new block zeroes it, an existing one already has this size
+    void *view = ftruncate(file, sizeof(LINK_SHARED)) ? MAP_FAILED :
+                 mmap(nullptr, sizeof(LINK_SHARED), PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    close(file);
+    return view == MAP_FAILED ? nullptr : (LINK_SHARED *) view;
+#endif
+}
+
+static void unmap_shared(LINK *link, bool last) {
+#ifdef _WIN32
+    UnmapViewOfFile(link->shared);
+    CloseHandle((HANDLE) link->mapping);
+#else
+    munmap(link->shared, sizeof(LINK_SHARED));
+    if (last)
+        shm_unlink(link->name);
+#endif
+}
+
+// Busy-waits for a while, then gives the core away, the other side may be sleeping off its frame. With a single core
+// the other side cannot get anywhere while this one spins, so it yields at once.
+static void relax(uint32_t spins) {
+    static const uint32_t spin_limit = std::thread::hardware_concurrency() > 1 ? 256 : 0;
+
+#if defined(__x86_64__) || defined(_M_X64)
+    if (spins < spin_limit) {
+        _mm_pause();
+        return;
+    }
+#endif
+    std::this_thread::yield();
+}
+
+LINK *link_open(const char *name) {
+    LINK *link = new LINK();
+
+    link->shared = map_shared(link, name);
+    if (!link->shared) {
+        printf("Cannot map the link cable %s\n", name);
+        delete link;
+        return nullptr;
+    }
+
+    link->side = -1;
+    for (int side = 0; side < 2 && link->side < 0; side++) {
+        uint32_t unplugged = 0;
+        if (link->shared->sides[side].plugged.compare_exchange_strong(unplugged, 1))
+            link->side = side;
+    }
+    if (link->side < 0) {
+        printf("Both ends of the link cable %s are taken\n", name);
+        unmap_shared(link, false);
+        delete link;
+        return nullptr;
+    }
+
+    LINK_SIDE *own = &link->shared->sides[link->side];
+    own->head.store(0, std::memory_order_relaxed);
+    own->tail.store(0, std::memory_order_relaxed);
+    own->clock.store(0, std::memory_order_relaxed);
+    own->plugged.store(2, std::memory_order_release);
+
+    link->partner_data = 0xFF;
+    link->partner_direction = 0x00;
+    return link;
+}
+
+void link_close(LINK *link) {
+    LINK_SIDE *own = &link->shared->sides[link->side];
+
+    own->clock.store(LINK_UNPLUGGED, std::memory_order_release);
+    own->plugged.store(0, std::memory_order_release);
+
+    unmap_shared(link, !link->shared->sides[1 - link->side].plugged.load(std::memory_order_acquire));
+    delete link;
+}
+
+bool link_connected(const LINK *link) {
+    return link->shared->sides[1 - link->side].plugged.load(std::memory_order_acquire) == 2;
+}
+
+static void push(LINK *link, const LINK_MESSAGE &message) {
+    LINK_SIDE *own = &link->shared->sides[link->side];
+    const uint32_t head = own->head.load(std::memory_order_relaxed);
+
+    // Only if the other side stopped draining, see LINK_RING_SIZE
+    for (uint32_t spins = 0; head - own->tail.load(std::memory_order_acquire) == LINK_RING_SIZE; spins++)
+        relax(spins);
+
+    own->ring[head & (LINK_RING_SIZE - 1)] = message;
+    own->head.store(head + 1, std::memory_order_release);
+}
+
+void link_send(LINK *link, uint64_t cycle, uint8_t data, uint8_t direction) {
+    // The other side cannot tell writes made on the same cycle apart, only the last one goes out
+    if (link->has_pending && link->pending.cycle != cycle)
+        push(link, link->pending);
+
+    link->pending = {cycle, data, direction};
+    link->has_pending = true;
+}
+
+void link_receive(LINK *link, uint64_t cycle) {
+    // An instruction can end a few cycles past the next sync, the other side is only known to have got to the last one
+    if (cycle > link->synced + LINK_QUANTUM_CYCLES - 1)
+        cycle = link->synced + LINK_QUANTUM_CYCLES - 1;
+
+    LINK_SIDE *other = &link->shared->sides[1 - link->side];
+    uint32_t tail = other->tail.load(std::memory_order_relaxed);
+    const uint32_t head = other->head.load(std::memory_order_acquire);
+
+    for (; tail != head; tail++) {
+        const LINK_MESSAGE &message = other->ring[tail & (LINK_RING_SIZE - 1)];
+        if (message.cycle + LINK_QUANTUM_CYCLES > cycle)
+            break;
+
+        link->partner_data = message.data;
+        link->partner_direction = message.direction;
+    }
+
+    other->tail.store(tail, std::memory_order_release);
+}
+
+void link_sync(LINK *link, uint64_t cycle) {
+    if (link->has_pending) {
+        push(link, link->pending);
+        link->has_pending = false;
+    }
+    link->shared->sides[link->side].clock.store(cycle, std::memory_order_release);
+    link->synced = cycle;
+    link->syncs++;
+
+    const std::atomic<uint64_t> &other = link->shared->sides[1 - link->side].clock;
+    if (other.load(std::memory_order_acquire) < cycle) {
+        link->waits++;
+        for (uint32_t spins = 0; other.load(std::memory_order_acquire) < cycle; spins++)
+            relax(spins);
+    }
+
+    // Keeps the ring drained when the game does not read the port
+    link_receive(link, cycle);
+}
@@ -0,0 +1,87 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Cycles each console may run ahead of the other, and the delay before it sees what the other put on the cable
+#define LINK_QUANTUM_CYCLES 1024
+
+// Writes in flight from one console: one message per cycle written on, stores take at least 4 cycles, and the
+// other console drains the ring every quantum, at the latest 3 quanta after the oldest message was written
+#define LINK_RING_SIZE 1024
+static_assert(LINK_RING_SIZE >= 3 * LINK_QUANTUM_CYCLES / 4 && !(LINK_RING_SIZE & (LINK_RING_SIZE - 1)));
+
+// Clock of a side nobody holds any more, the other side never waits for it
+#define LINK_UNPLUGGED UINT64_MAX
+
+// One write to the link port registers, on the cycle it was made
+typedef struct {
+    uint64_t cycle;
+    uint8_t data;
+    uint8_t direction;
+} LINK_MESSAGE;
+
+/*
+ * One end of the cable in shared memory. Its console is the only producer of the ring and of clock, the other
+ * console the only consumer, so neither needs a lock: head and tail each have one writer, and every store that
+ * makes something visible to the other side is a release matched by an acquire there.
+ */
+typedef struct {
+    alignas(64) std::atomic<uint32_t> plugged;  // 0 when free, 1 while a console sets it up, 2 once it is held
+    alignas(64) std::atomic<uint64_t> clock;    // Cycle this side has run to, every message before it is in the ring
+    alignas(64) std::atomic<uint32_t> head;     // Next message to write, moved by this side
+    alignas(64) std::atomic<uint32_t> tail;     // Next message to read, moved by the other side
+    LINK_MESSAGE ring[LINK_RING_SIZE];
+} LINK_SIDE;
+
+typedef struct {
+    LINK_SIDE sides[2];
+} LINK_SHARED;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free);
+
+/*
+ * Link cable between two consoles, in two processes or two threads of one, through a named block of shared memory.
+ *
+ * The consoles run in lockstep: every LINK_QUANTUM_CYCLES each one publishes its clock and waits for the other to
+ * get as far. A write to the port made on cycle t reaches the other console on its cycle t + LINK_QUANTUM_CYCLES,
+ * which it has then always received, so what each console reads depends on the cycles the writes were made on and
+ * never on how the host scheduled the two.
+ *
+ * Both consoles have to start from reset together and may not jump back in time while linked.
+ */
+typedef struct {
+    LINK_SHARED *shared;
+    int side;                      // 0 or 1, the other console is on 1 - side
+    uint8_t partner_data;          // Port of the other console as of the last message received
+    uint8_t partner_direction;
+    LINK_MESSAGE pending;          // Last write, held back until a write on a later cycle or the next sync
+    bool has_pending;
+    uint64_t synced;               // Cycle of the last sync, the other side has sent everything up to it
+    uint64_t syncs;                // Quanta synchronised, and of those the ones that had to wait for the other side
+    uint64_t waits;
+
+    // Platform mapping handles
+    void *mapping;
+    char name[64];
+} LINK;
+
+// Plugs into the cable called name, the first to open it takes side 0, returns NULL if both sides are taken
+LINK *link_open(const char *name);
+void link_close(LINK *link);
+
+// Whether the other side is plugged in yet
+bool link_connected(const LINK *link);
+
+// Puts the port registers on the cable from the given cycle on
+void link_send(LINK *link, uint64_t cycle, uint8_t data, uint8_t direction);
+
+// Brings partner_data and partner_direction up to the given cycle
+void link_receive(LINK *link, uint64_t cycle);
+
+// Called every LINK_QUANTUM_CYCLES: lets the other side run to cycle and waits until it has got there itself
+void link_sync(LINK *link, uint64_t cycle);
+
+#endif //LINK_H
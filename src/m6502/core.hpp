@@ -0,0 +1,1102 @@
+/** M65C02: threaded-code 65C02 emulator *********************/
+/**                                                         **/
+/**                         Core.hpp                        **/
+/**                                                         **/
+/** This file contains a C++20 implementation of the 65C02  **/
+/** core in M6502.c. Each opcode handler is generated at    **/
+/** compile time from an addressing mode and an operation,  **/
+/** with its cycle count folded in as a constant. Memory is **/
+/** accessed through a Bus policy, so the same handlers can **/
+/** be instantiated for other memory systems.               **/
+/**                                                         **/
+/** Handlers take their operand as an argument, so they run **/
+/** both from the fetch loop and from predecoded blocks of  **/
+/** ROM code kept in a BlockCache.                          **/
+/**                                                         **/
+/** Instruction semantics follow M6502.c exactly, including **/
+/** its quirks, so both cores can be swapped freely.        **/
+/*************************************************************/
+#ifndef M6502_CORE_HPP
+#define M6502_CORE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "m6502.h"
+#include "tables.h"
+
+#if defined(__GNUC__)
+#define M6502_FLATTEN __attribute__((flatten))
+#else
+#define M6502_FLATTEN
+#endif
+
+#if defined(__has_cpp_attribute)
+#if __has_cpp_attribute(clang::musttail)
+#define M6502_MUSTTAIL [[clang::musttail]]
+#elif __has_cpp_attribute(gnu::musttail)
+#define M6502_MUSTTAIL [[gnu::musttail]]
+#endif
+#endif
+
+namespace m6502 {
+
+/** Operands[] ***********************************************/
+/** Number of operand bytes each handler consumes.          **/
+/*************************************************************/
+static constexpr byte Operands[256] = {
+    0,1,0,0,1,1,1,0,0,1,0,0,2,2,2,0,
+    1,1,1,0,1,1,1,0,0,2,0,0,2,2,2,0,
+    2,1,0,0,1,1,1,0,0,1,0,0,2,2,2,0,
+    1,1,1,0,1,1,1,0,0,2,0,0,2,2,2,0,
+    0,1,0,0,0,1,1,0,0,1,0,0,2,2,2,0,
+    1,1,1,0,0,1,1,0,0,2,0,0,0,2,2,0,
+    0,1,0,0,1,1,1,0,0,1,0,0,2,2,2,0,
+    1,1,1,0,1,1,1,0,0,2,0,0,2,2,2,0,
+    1,1,0,0,1,1,1,0,0,1,0,0,2,2,2,0,
+    1,1,1,0,1,1,1,0,0,2,0,0,2,2,2,0,
+    1,1,1,0,1,1,1,0,0,1,0,0,2,2,2,0,
+    1,1,1,0,1,1,1,0,0,2,0,0,2,2,2,0,
+    1,1,0,0,1,1,1,0,0,1,0,0,2,2,2,0,
+    1,1,1,0,0,1,1,0,0,2,0,0,0,2,2,0,
+    1,1,0,0,1,1,1,0,0,1,0,0,2,2,2,0,
+    1,1,1,0,0,1,1,0,0,2,0,0,0,2,2,0,
+};
+
+/** Kinds[] **************************************************/
+/** How an opcode affects a predecoded block: END_BLOCK for **/
+/** jumps, branches, returns and anything that may unmask   **/
+/** interrupts; BUS_WRITE for stores that can reach I/O;    **/
+/** MEM_WRITE for anything that writes memory or the stack. **/
+/*************************************************************/
+enum { END_BLOCK = 1, BUS_WRITE = 2, MEM_WRITE = 4 };
+
+static constexpr byte Kinds[256] = {
+    5,0,0,0,4,0,4,0,4,0,0,0,6,0,6,0,
+    1,0,0,0,4,0,4,0,0,0,0,0,6,0,6,0,
+    5,0,0,0,0,0,4,0,1,0,0,0,0,0,6,0,
+    1,0,0,0,0,0,4,0,0,0,0,0,0,0,6,0,
+    1,0,0,0,0,0,4,0,4,0,0,0,1,0,6,0,
+    1,0,0,0,0,0,4,0,1,0,4,0,0,0,6,0,
+    1,0,0,0,4,0,4,0,0,0,0,0,1,0,6,0,
+    1,0,0,0,4,0,4,0,0,0,0,0,1,0,6,0,
+    1,6,0,0,4,4,4,0,0,0,0,0,6,6,6,0,
+    1,6,6,0,4,4,4,0,0,6,0,0,6,6,6,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,4,0,0,0,0,0,0,0,6,0,
+    1,0,0,0,0,0,4,0,0,0,4,0,0,0,6,0,
+    0,0,0,0,0,0,4,0,0,0,0,0,0,0,6,0,
+    1,0,0,0,0,0,4,0,0,0,0,0,0,0,6,0,
+};
+
+/** ReachesBus() *********************************************/
+/** Tells if Opcode may access memory outside zero page and **/
+/** stack, through Rd6502() and Wr6502(), either at its     **/
+/** operand or through a pointer.                           **/
+/*************************************************************/
+static constexpr bool ReachesBus(byte Opcode) {
+    if (Operands[Opcode] == 1) return (Opcode & 0x0F) == 0x01 || (Opcode & 0x1F) == 0x12; /* (zp,X) (zp),Y (zp) */
+    return Operands[Opcode] == 2 && Opcode != 0x20 && Opcode != 0x4C;
+}
+
+/** ReadsVolatile() ******************************************/
+/** Tells if Opcode may read outside zero page and stack    **/
+/** from a page R->Volatile marks, or through a pointer,    **/
+/** so that what it reads may change from one run to the   **/
+/** next without the code writing anything.                **/
+/*************************************************************/
+static inline bool ReadsVolatile(const M6502 *R, byte Opcode, word Operand) {
+    auto Marked = [R](word A) { return (R->Volatile[A >> 11] >> ((A >> 8) & 7)) & 1; };
+
+    if (!ReachesBus(Opcode)) return false;
+    if (Operands[Opcode] == 1) return true;
+    return Marked(Operand) || ((Opcode & 0x10) && Marked(Operand + 0xFF));  /* abs,X and abs,Y */
+}
+
+/** PageBus **************************************************/
+/** Reads opcodes, operands, zero page and stack straight   **/
+/** from R->Page[] and everything else through Rd6502() and **/
+/** Wr6502(). This is the FAST_RDOP memory model.           **/
+/*************************************************************/
+struct PageBus {
+    static constexpr bool PureOp = true; /* Op() has no side effects */
+    static byte Op(M6502 *R, word A) { return R->Page[A >> 8][A & 0xFF]; }
+    static byte Rd(M6502 *, word A) { return Rd6502(A); }
+    static void Wr(M6502 *, word A, byte V) { Wr6502(A, V); }
+    static byte RdZP(M6502 *R, word A) { return R->Page[0][(byte) A]; }
+    static void WrZP(M6502 *R, word A, byte V) { R->Page[0][(byte) A] = V; }
+    static void WrStack(M6502 *R, byte S, byte V) { R->Page[1][S] = V; }
+};
+
+/** CallBus **************************************************/
+/** Sends every access through Rd6502() and Wr6502().       **/
+/*************************************************************/
+struct CallBus {
+    static constexpr bool PureOp = false;
+    static byte Op(M6502 *, word A) { return Rd6502(A); }
+    static byte Rd(M6502 *, word A) { return Rd6502(A); }
+    static void Wr(M6502 *, word A, byte V) { Wr6502(A, V); }
+    static byte RdZP(M6502 *, word A) { return Rd6502(A); }
+    static void WrZP(M6502 *, word A, byte V) { Wr6502(A, V); }
+    static void WrStack(M6502 *, byte S, byte V) { Wr6502(0x0100 | S, V); }
+};
+
+#ifdef FAST_RDOP
+using DefaultBus = PageBus;
+#else
+using DefaultBus = CallBus;
+#endif
+
+/** EagerFlags ***********************************************/
+/** Keeps N and Z up to date in R->P after every result, as **/
+/** M6502.c does.                                           **/
+/*************************************************************/
+struct EagerFlags {
+    static constexpr bool Lazy = false;
+
+    /* Sets P, except for N and Z which come from result V */
+    static void Set(M6502 *R, byte P, byte V) { R->P = (P & ~(Z_FLAG | N_FLAG)) | ZNTable[V]; }
+    /* Sets P, except for N which is N_FLAG or 0, and Z */
+    static void Set(M6502 *R, byte P, byte N, bool Z) { R->P = (P & ~(Z_FLAG | N_FLAG)) | N | (Z ? Z_FLAG : 0); }
+    static byte Get(const M6502 *R) { return R->P; }
+    static void Put(M6502 *R, byte P) { R->P = P; }
+    template<byte Flag> static bool Test(const M6502 *R) { return R->P & Flag; }
+    static void Load(M6502 *) {}
+    static void Store(M6502 *) {}
+};
+
+/** LazyFlags ************************************************/
+/** Only records the last result in R->NZ and works N and Z **/
+/** out when they are tested or P is read as a whole. Z is  **/
+/** set when the low byte of NZ is 0, N is bit 7 of either  **/
+/** byte, so PLP, RTI and BIT can still set both at once.   **/
+/** R->P is valid whenever Loop6502() or Int6502() run.     **/
+/*************************************************************/
+struct LazyFlags {
+    static constexpr bool Lazy = true;
+
+    static void Set(M6502 *R, byte P, byte V) { R->P = P; R->NZ = V; }
+    static void Set(M6502 *R, byte P, byte N, bool Z) { R->P = P; R->NZ = Z ? N << 8 : N | 1; }
+
+    static byte Get(const M6502 *R) {
+        return (R->P & ~(N_FLAG | Z_FLAG)) | ((byte) R->NZ ? 0 : Z_FLAG) | ((R->NZ | R->NZ >> 8) & N_FLAG);
+    }
+
+    static void Put(M6502 *R, byte P) { Set(R, P, P & N_FLAG, P & Z_FLAG); }
+
+    template<byte Flag>
+    static bool Test(const M6502 *R) {
+        if constexpr (Flag == Z_FLAG) return !(byte) R->NZ;
+        else if constexpr (Flag == N_FLAG) return (R->NZ | R->NZ >> 8) & N_FLAG;
+        else return R->P & Flag;
+    }
+
+    static void Load(M6502 *R) { Put(R, R->P); }
+    static void Store(M6502 *R) { R->P = Get(R); }
+};
+
+#ifdef LAZY_FLAGS
+using DefaultFlags = LazyFlags;
+#else
+using DefaultFlags = EagerFlags;
+#endif
+
+/** BlockCache ***********************************************/
+/** Predecoded basic blocks of code that never changes, eg. **/
+/** ROM. A block is keyed by the offset of its first byte   **/
+/** in Code, which already tells ROM banks apart, and never **/
+/** leaves its 256-byte page. Each Instr holds its operand, **/
+/** and the block its pre-summed cycle cost. A conditional **/
+/** forward branch only ends a block when taken. When all   **/
+/** blocks are used up, the whole cache is flushed.         **/
+/*************************************************************/
+struct Instr;
+using Exec = void (*)(M6502 *R, const Instr &I);
+
+struct Instr {
+    Exec Run;
+    word Operand;   /* Operand fetched at decode time       */
+    word Operand2;  /* Operand of the second fused opcode   */
+    word Next;      /* PC after this instruction            */
+    byte Cycles;    /* Cycles from block start through here */
+    byte Opcode;
+    byte Opcode2;   /* Second opcode when Fused             */
+    bool Fused;     /* Run executes two opcodes             */
+    bool Check;     /* Store or Branch, may leave the block */
+    bool Branch;    /* Forward branch, leaves when taken    */
+};
+
+struct Block {
+    static constexpr int MaxLength = 32;
+
+    word PC;
+    word End;           /* PC after the last instruction     */
+    word Cycles;        /* Cost without taken-branch penalty */
+    const byte *Page;   /* R->Page[PC >> 8] when decoded     */
+    int Count;
+    bool Jumps;         /* Last instruction sets PC itself   */
+    bool Idle;          /* Jumps to itself, writes nothing,  */
+                        /* reads nothing volatile            */
+    unsigned Runs;      /* Times run from Code[]             */
+    void (*Native)(M6502 *R); /* Compiled block, if any      */
+    Instr *Code;        /* Count entries in BlockCache::Instrs */
+};
+
+/** Precompiled **********************************************/
+/** A block compiled ahead of time by tools/recompile.cpp.  **/
+/** It replaces the block the cache decodes at Offset only  **/
+/** if that one has the same PC, End and Cycles, so a table **/
+/** left over from another ROM or core just goes unused.    **/
+/*************************************************************/
+struct Precompiled {
+    std::uint32_t Offset;
+    word PC, End, Cycles;
+    void (*Run)(M6502 *R);
+};
+
+struct BlockCache {
+    static constexpr unsigned MaxBlocks = 16384;
+    static constexpr unsigned MaxInstrs = 65536;
+    static constexpr unsigned HotRuns = 16; /* Runs before Compile() */
+
+    const byte *Code;
+    std::size_t Size;
+    std::vector<std::uint32_t> Index; /* Block number + 1 per code byte */
+    std::vector<Block> Blocks;
+    std::vector<Instr> Instrs;
+    unsigned Used = 0;
+    unsigned UsedInstrs = 0;
+    bool Entry = false; /* PC is where control flow has landed */
+
+    /* Optional compiler for hot blocks, such as Jit<Bus> */
+    void (*Compile)(M6502 *R, BlockCache &C, Block &B) = nullptr;
+    void *Jit = nullptr;
+
+    /* Optional precompiled blocks, sorted by Offset */
+    const Precompiled *Static = nullptr;
+    std::size_t StaticCount = 0;
+
+    BlockCache(const byte *Code, std::size_t Size) : Code(Code), Size(Size), Index(Size), Blocks(MaxBlocks), Instrs(MaxInstrs) {}
+
+    void Flush() {
+        std::fill(Index.begin(), Index.end(), 0);
+        Used = 0;
+        UsedInstrs = 0;
+    }
+
+    /* Precompiled version of B, decoded at offset O, if any */
+    const Precompiled *Find(const Block &B, std::size_t O) const {
+        const Precompiled *P = std::lower_bound(Static, Static + StaticCount, O, [](const Precompiled &P, std::size_t O) { return P.Offset < O; });
+        if (P == Static + StaticCount || P->Offset != O || P->PC != B.PC || P->End != B.End || P->Cycles != B.Cycles) return nullptr;
+        return P;
+    }
+
+    /* FNV-1a, tells the image precompiled blocks were made for */
+    static std::uint32_t Hash(const byte *Code, std::size_t Size) {
+        std::uint32_t H = 2166136261u;
+        for (std::size_t N = 0; N < Size; N++) H = (H ^ Code[N]) * 16777619u;
+        return H;
+    }
+
+    /* Offset of PC's current mapping in Code, or Size when outside */
+    std::size_t Offset(const M6502 *R, word PC) const {
+        std::size_t O = (std::uintptr_t) (R->Page[PC >> 8] + (PC & 0xFF)) - (std::uintptr_t) Code;
+        return O < Size ? O : Size;
+    }
+};
+
+/** Core<Bus> ************************************************/
+/** All handlers, the dispatch tables and the Run/Int/Reset **/
+/** entry points for a given memory system and flag model.  **/
+/*************************************************************/
+template<class Bus, class Flags = DefaultFlags>
+struct Core {
+    using Handler = void (*)(M6502 *R, word O);
+    using Reg = byte M6502::*;
+
+    /** Helpers **********************************************/
+    static void FL(M6502 *R, byte V) { Flags::Set(R, R->P, V); }
+
+    static word LdWord(M6502 *R) {
+        pair J;
+        J.B.l = Bus::Op(R, R->PC.W++);
+        J.B.h = Bus::Op(R, R->PC.W++);
+        return J.W;
+    }
+
+    template<int Bytes>
+    static word Fetch(M6502 *R) {
+        if constexpr (Bytes == 2) return LdWord(R);
+        else if constexpr (Bytes == 1) return Bus::Op(R, R->PC.W++);
+        else return 0;
+    }
+
+    static void Push(M6502 *R, byte V) {
+        Bus::WrStack(R, R->S, V);
+        R->S--;
+    }
+
+    static byte Pop(M6502 *R) {
+        R->S++;
+        return Bus::Op(R, 0x0100 | R->S);
+    }
+
+    /* PC already points past the offset byte */
+    static void JR(M6502 *R, word O) {
+        R->PC.W += (offset) O;
+        R->ICount--;
+    }
+
+    /** Addressing Modes *************************************/
+    /** EA() turns the fetched operand into an effective     **/
+    /** address, Rd()/Wr() access it. Zero page modes stay   **/
+    /** in RAM. Imm passes the operand through as its value. **/
+    /*********************************************************/
+    struct Mem {
+        static byte Rd(M6502 *R, word A) { return Bus::Rd(R, A); }
+        static void Wr(M6502 *R, word A, byte V) { Bus::Wr(R, A, V); }
+    };
+
+    struct ZeroPage {
+        static byte Rd(M6502 *R, word A) { return Bus::RdZP(R, A); }
+        static void Wr(M6502 *R, word A, byte V) { Bus::WrZP(R, A, V); }
+    };
+
+    struct Acc {
+        static word EA(M6502 *, word) { return 0; }
+        static byte Rd(M6502 *R, word) { return R->A; }
+        static void Wr(M6502 *R, word, byte V) { R->A = V; }
+    };
+
+    struct Imm {
+        static word EA(M6502 *, word O) { return O; }
+        static byte Rd(M6502 *, word A) { return (byte) A; }
+    };
+
+    struct Zp : ZeroPage {
+        static word EA(M6502 *, word O) { return O; }
+    };
+
+    struct Zx : ZeroPage {
+        static word EA(M6502 *R, word O) { return (byte) (O + R->X); }
+    };
+
+    struct Zy : ZeroPage {
+        static word EA(M6502 *R, word O) { return (byte) (O + R->Y); }
+    };
+
+    struct Ab : Mem {
+        static word EA(M6502 *, word O) { return O; }
+    };
+
+    struct Ax : Mem {
+        static word EA(M6502 *R, word O) { return O + R->X; }
+    };
+
+    struct Ay : Mem {
+        static word EA(M6502 *R, word O) { return O + R->Y; }
+    };
+
+    struct Ix : Mem {
+        static word EA(M6502 *R, word O) {
+            pair J;
+            word K = (byte) (O + R->X);
+            J.B.l = Bus::Op(R, K++);
+            J.B.h = Bus::Op(R, K);
+            return J.W;
+        }
+    };
+
+    struct Izp : Mem {
+        static word EA(M6502 *R, word O) {
+            pair J;
+            word K = O;
+            J.B.l = Bus::Op(R, K++);
+            J.B.h = Bus::Op(R, K);
+            return J.W;
+        }
+    };
+
+    struct Iy : Mem {
+        static word EA(M6502 *R, word O) { return Izp::EA(R, O) + R->Y; }
+    };
+
+    template<class M>
+    static byte Read(M6502 *R, word O) { return M::Rd(R, M::EA(R, O)); }
+
+    /** Read-Modify-Write Operations *************************/
+    struct ASL {
+        static void Do(M6502 *R, byte &V) {
+            byte C = V >> 7;
+            V <<= 1;
+            Flags::Set(R, (R->P & ~C_FLAG) | C, V);
+        }
+    };
+
+    struct LSR {
+        static void Do(M6502 *R, byte &V) {
+            byte C = V & C_FLAG;
+            V >>= 1;
+            Flags::Set(R, (R->P & ~C_FLAG) | C, V);
+        }
+    };
+
+    struct ROL {
+        static void Do(M6502 *R, byte &V) {
+            byte T = (V << 1) | (R->P & C_FLAG);
+            Flags::Set(R, (R->P & ~C_FLAG) | (V >> 7), T);
+            V = T;
+        }
+    };
+
+    struct ROR {
+        static void Do(M6502 *R, byte &V) {
+            byte T = (V >> 1) | (R->P << 7);
+            Flags::Set(R, (R->P & ~C_FLAG) | (V & C_FLAG), T);
+            V = T;
+        }
+    };
+
+    struct INC {
+        static void Do(M6502 *R, byte &V) { V++; FL(R, V); }
+    };
+
+    struct DEC {
+        static void Do(M6502 *R, byte &V) { V--; FL(R, V); }
+    };
+
+    struct TSB {
+        static void Do(M6502 *R, byte &V) { Flags::Set(R, R->P, Flags::template Test<N_FLAG>(R) ? N_FLAG : 0, !(V & R->A)); V |= R->A; }
+    };
+
+    struct TRB {
+        static void Do(M6502 *R, byte &V) { Flags::Set(R, R->P, Flags::template Test<N_FLAG>(R) ? N_FLAG : 0, !(V & R->A)); V &= ~R->A; }
+    };
+
+    template<class Op, class M>
+    static void RMW(M6502 *R, word O) {
+        word A = M::EA(R, O);
+        byte V = M::Rd(R, A);
+        Op::Do(R, V);
+        M::Wr(R, A, V);
+    }
+
+    /** Operations *******************************************/
+    template<Reg Rg, class M>
+    static void LD(M6502 *R, word O) {
+        R->*Rg = Read<M>(R, O);
+        FL(R, R->*Rg);
+    }
+
+    template<Reg Rg, class M>
+    static void ST(M6502 *R, word O) { M::Wr(R, M::EA(R, O), R->*Rg); }
+
+    template<class M>
+    static void STZ(M6502 *R, word O) { M::Wr(R, M::EA(R, O), 0); }
+
+    template<class M>
+    static void ORA(M6502 *R, word O) { R->A |= Read<M>(R, O); FL(R, R->A); }
+
+    template<class M>
+    static void AND(M6502 *R, word O) { R->A &= Read<M>(R, O); FL(R, R->A); }
+
+    template<class M>
+    static void EOR(M6502 *R, word O) { R->A ^= Read<M>(R, O); FL(R, R->A); }
+
+    template<class M>
+    static void BIT(M6502 *R, word O) {
+        byte V = Read<M>(R, O);
+        Flags::Set(R, (R->P & ~V_FLAG) | (V & V_FLAG), V & N_FLAG, !(V & R->A));
+    }
+
+    template<Reg Rg, class M>
+    static void CMP(M6502 *R, word O) {
+        word K = R->*Rg - Read<M>(R, O);
+        Flags::Set(R, (R->P & ~C_FLAG) | (K >> 8 ? 0 : C_FLAG), (byte) K);
+    }
+
+    /* The following code was provided by Mr. Scott Hemphill. Thanks a lot! */
+    /* Flags are kept in a local so that byte stores to R->P do not force   */
+    /* the compiler to reload every other register between steps.          */
+    template<class M>
+    static void ADC(M6502 *R, word O) {
+        byte V = Read<M>(R, O);
+        byte P = R->P;
+        unsigned int w;
+
+        if ((R->A ^ V) & 0x80) P &= ~V_FLAG; else P |= V_FLAG;
+
+        if (P & D_FLAG) {
+            w = (R->A & 0xf) + (V & 0xf) + (P & C_FLAG);
+            if (w >= 10) w = 0x10 | ((w + 6) & 0xf);
+            w += (R->A & 0xf0) + (V & 0xf0);
+            if (w >= 160) {
+                P |= C_FLAG;
+                if ((P & V_FLAG) && w >= 0x180) P &= ~V_FLAG;
+                w += 0x60;
+            } else {
+                P &= ~C_FLAG;
+                if ((P & V_FLAG) && w < 0x80) P &= ~V_FLAG;
+            }
+        } else {
+            w = R->A + V + (P & C_FLAG);
+            if (w >= 0x100) {
+                P |= C_FLAG;
+                if ((P & V_FLAG) && w >= 0x180) P &= ~V_FLAG;
+            } else {
+                P &= ~C_FLAG;
+                if ((P & V_FLAG) && w < 0x80) P &= ~V_FLAG;
+            }
+        }
+        R->A = (byte) w;
+        Flags::Set(R, P, R->A);
+    }
+
+    template<class M>
+    static void SBC(M6502 *R, word O) {
+        byte V = Read<M>(R, O);
+        byte P = R->P;
+        unsigned int w, temp;
+
+        if ((R->A ^ V) & 0x80) P |= V_FLAG; else P &= ~V_FLAG;
+
+        if (P & D_FLAG) {
+            temp = 0xf + (R->A & 0xf) - (V & 0xf) + (P & C_FLAG);
+            if (temp < 0x10) {
+                w = 0;
+                temp -= 6;
+            } else {
+                w = 0x10;
+                temp -= 0x10;
+            }
+            w += 0xf0 + (R->A & 0xf0) - (V & 0xf0);
+            if (w < 0x100) {
+                P &= ~C_FLAG;
+                if ((P & V_FLAG) && w < 0x80) P &= ~V_FLAG;
+                w -= 0x60;
+            } else {
+                P |= C_FLAG;
+                if ((P & V_FLAG) && w >= 0x180) P &= ~V_FLAG;
+            }
+            w += temp;
+        } else {
+            w = 0xff + R->A - V + (P & C_FLAG);
+            if (w < 0x100) {
+                P &= ~C_FLAG;
+                if ((P & V_FLAG) && w < 0x80) P &= ~V_FLAG;
+            } else {
+                P |= C_FLAG;
+                if ((P & V_FLAG) && w >= 0x180) P &= ~V_FLAG;
+            }
+        }
+        R->A = (byte) w;
+        Flags::Set(R, P, R->A);
+    }
+
+
+    template<Reg From, Reg To>
+    static void T(M6502 *R, word) {
+        R->*To = R->*From;
+        FL(R, R->*To);
+    }
+
+    static void TXS(M6502 *R, word) { R->S = R->X; }
+
+    template<Reg Rg, int Delta>
+    static void IN(M6502 *R, word) {
+        R->*Rg += Delta;
+        FL(R, R->*Rg);
+    }
+
+    template<byte Flag>
+    static void SE(M6502 *R, word) { R->P |= Flag; }
+
+    template<byte Flag>
+    static void CL(M6502 *R, word) { R->P &= ~Flag; }
+
+    template<byte Flag, bool Set>
+    static void BR(M6502 *R, word O) {
+        if (Flags::template Test<Flag>(R) == Set) JR(R, O);
+    }
+
+    static void BRA(M6502 *R, word O) { JR(R, O); }
+
+    template<Reg Rg>
+    static void PH(M6502 *R, word) { Push(R, R->*Rg); }
+
+    template<Reg Rg>
+    static void PL(M6502 *R, word) {
+        R->*Rg = Pop(R);
+        FL(R, R->*Rg);
+    }
+
+    static void PHP(M6502 *R, word) { Push(R, Flags::Get(R)); }
+
+    static void PLP(M6502 *R, word) {
+        byte I = Pop(R);
+        if ((R->IRequest != INT_NONE) && ((I ^ R->P) & ~I & I_FLAG)) {
+            R->AfterCLI = 1;
+            R->IBackup = R->ICount;
+            R->ICount = 1;
+        }
+        Flags::Put(R, I | R_FLAG | B_FLAG);
+    }
+
+    static void CLI(M6502 *R, word) {
+        if ((R->IRequest != INT_NONE) && (R->P & I_FLAG)) {
+            R->AfterCLI = 1;
+            R->IBackup = R->ICount;
+            R->ICount = 1;
+        }
+        R->P &= ~I_FLAG;
+    }
+
+    static void BRK(M6502 *R, word) {
+        R->PC.W++;
+        Push(R, R->PC.B.h);
+        Push(R, R->PC.B.l);
+        Push(R, Flags::Get(R) | B_FLAG);
+        R->P = (R->P | I_FLAG) & ~D_FLAG;
+        R->PC.B.l = Bus::Rd(R, 0xFFFE);
+        R->PC.B.h = Bus::Rd(R, 0xFFFF);
+    }
+
+    /* Pushes the address of the last operand byte */
+    static void JSR(M6502 *R, word O) {
+        pair K;
+        K.W = R->PC.W - 1;
+        Push(R, K.B.h);
+        Push(R, K.B.l);
+        R->PC.W = O;
+    }
+
+    static void RTS(M6502 *R, word) {
+        R->PC.B.l = Pop(R);
+        R->PC.B.h = Pop(R);
+        R->PC.W++;
+    }
+
+    static void RTI(M6502 *R, word) {
+        Flags::Put(R, Pop(R) | R_FLAG);
+        R->PC.B.l = Pop(R);
+        R->PC.B.h = Pop(R);
+    }
+
+    static void JMP(M6502 *R, word O) { R->PC.W = O; }
+
+    /* from newer M6502 */
+    static void JMPI(M6502 *R, word O) {
+        pair K;
+        K.W = O;
+        R->PC.B.l = Bus::Rd(R, K.W);
+        K.B.l++;
+        R->PC.B.h = Bus::Rd(R, K.W);
+    }
+
+    /* uso */
+    static void JMPX(M6502 *R, word O) {
+        word K = O;
+        R->PC.B.l = Bus::Rd(R, K++);
+        R->PC.B.h = Bus::Rd(R, K);
+        R->PC.W += R->X;
+    }
+
+    static void NOP(M6502 *, word) {}
+
+    /** Opcode Table *****************************************/
+    static constexpr Reg A = &M6502::A, X = &M6502::X, Y = &M6502::Y, S = &M6502::S;
+
+    static constexpr Handler Ops[256] = {
+        /* 0x00 */ BRK, ORA<Ix>, NOP, NOP, RMW<TSB, Zp>, ORA<Zp>, RMW<ASL, Zp>, NOP,
+        /* 0x08 */ PHP, ORA<Imm>, RMW<ASL, Acc>, NOP, RMW<TSB, Ab>, ORA<Ab>, RMW<ASL, Ab>, NOP,
+        /* 0x10 */ BR<N_FLAG, false>, ORA<Iy>, ORA<Izp>, NOP, RMW<TRB, Zp>, ORA<Zx>, RMW<ASL, Zx>, NOP,
+        /* 0x18 */ CL<C_FLAG>, ORA<Ay>, IN<A, 1>, NOP, RMW<TRB, Ab>, ORA<Ax>, RMW<ASL, Ax>, NOP,
+        /* 0x20 */ JSR, AND<Ix>, NOP, NOP, BIT<Zp>, AND<Zp>, RMW<ROL, Zp>, NOP,
+        /* 0x28 */ PLP, AND<Imm>, RMW<ROL, Acc>, NOP, BIT<Ab>, AND<Ab>, RMW<ROL, Ab>, NOP,
+        /* 0x30 */ BR<N_FLAG, true>, AND<Iy>, AND<Izp>, NOP, BIT<Zx>, AND<Zx>, RMW<ROL, Zx>, NOP,
+        /* 0x38 */ SE<C_FLAG>, AND<Ay>, IN<A, -1>, NOP, BIT<Ax>, AND<Ax>, RMW<ROL, Ax>, NOP,
+        /* 0x40 */ RTI, EOR<Ix>, NOP, NOP, NOP, EOR<Zp>, RMW<LSR, Zp>, NOP,
+        /* 0x48 */ PH<A>, EOR<Imm>, RMW<LSR, Acc>, NOP, JMP, EOR<Ab>, RMW<LSR, Ab>, NOP,
+        /* 0x50 */ BR<V_FLAG, false>, EOR<Iy>, EOR<Izp>, NOP, NOP, EOR<Zx>, RMW<LSR, Zx>, NOP,
+        /* 0x58 */ CLI, EOR<Ay>, PH<Y>, NOP, NOP, EOR<Ax>, RMW<LSR, Ax>, NOP,
+        /* 0x60 */ RTS, ADC<Ix>, NOP, NOP, STZ<Zp>, ADC<Zp>, RMW<ROR, Zp>, NOP,
+        /* 0x68 */ PL<A>, ADC<Imm>, RMW<ROR, Acc>, NOP, JMPI, ADC<Ab>, RMW<ROR, Ab>, NOP,
+        /* 0x70 */ BR<V_FLAG, true>, ADC<Iy>, ADC<Izp>, NOP, STZ<Zx>, ADC<Zx>, RMW<ROR, Zx>, NOP,
+        /* 0x78 */ SE<I_FLAG>, ADC<Ay>, PL<Y>, NOP, JMPX, ADC<Ax>, RMW<ROR, Ax>, NOP,
+        /* 0x80 */ BRA, ST<A, Ix>, NOP, NOP, ST<Y, Zp>, ST<A, Zp>, ST<X, Zp>, NOP,
+        /* 0x88 */ IN<Y, -1>, BIT<Imm>, T<X, A>, NOP, ST<Y, Ab>, ST<A, Ab>, ST<X, Ab>, NOP,
+        /* 0x90 */ BR<C_FLAG, false>, ST<A, Iy>, ST<A, Izp>, NOP, ST<Y, Zx>, ST<A, Zx>, ST<X, Zy>, NOP,
+        /* 0x98 */ T<Y, A>, ST<A, Ay>, TXS, NOP, STZ<Ab>, ST<A, Ax>, STZ<Ax>, NOP,
+        /* 0xA0 */ LD<Y, Imm>, LD<A, Ix>, LD<X, Imm>, NOP, LD<Y, Zp>, LD<A, Zp>, LD<X, Zp>, NOP,
+        /* 0xA8 */ T<A, Y>, LD<A, Imm>, T<A, X>, NOP, LD<Y, Ab>, LD<A, Ab>, LD<X, Ab>, NOP,
+        /* 0xB0 */ BR<C_FLAG, true>, LD<A, Iy>, LD<A, Izp>, NOP, LD<Y, Zx>, LD<A, Zx>, LD<X, Zy>, NOP,
+        /* 0xB8 */ CL<V_FLAG>, LD<A, Ay>, T<S, X>, NOP, LD<Y, Ax>, LD<A, Ax>, LD<X, Ay>, NOP,
+        /* 0xC0 */ CMP<Y, Imm>, CMP<A, Ix>, NOP, NOP, CMP<Y, Zp>, CMP<A, Zp>, RMW<DEC, Zp>, NOP,
+        /* 0xC8 */ IN<Y, 1>, CMP<A, Imm>, IN<X, -1>, NOP, CMP<Y, Ab>, CMP<A, Ab>, RMW<DEC, Ab>, NOP,
+        /* 0xD0 */ BR<Z_FLAG, false>, CMP<A, Iy>, CMP<A, Izp>, NOP, NOP, CMP<A, Zx>, RMW<DEC, Zx>, NOP,
+        /* 0xD8 */ CL<D_FLAG>, CMP<A, Ay>, PH<X>, NOP, NOP, CMP<A, Ax>, RMW<DEC, Ax>, NOP,
+        /* 0xE0 */ CMP<X, Imm>, SBC<Ix>, NOP, NOP, CMP<X, Zp>, SBC<Zp>, RMW<INC, Zp>, NOP,
+        /* 0xE8 */ IN<X, 1>, SBC<Imm>, NOP, NOP, CMP<X, Ab>, SBC<Ab>, RMW<INC, Ab>, NOP,
+        /* 0xF0 */ BR<Z_FLAG, true>, SBC<Iy>, SBC<Izp>, NOP, NOP, SBC<Zx>, RMW<INC, Zx>, NOP,
+        /* 0xF8 */ SE<D_FLAG>, SBC<Ay>, PL<X>, NOP, NOP, SBC<Ax>, RMW<INC, Ax>, NOP,
+    };
+
+    /** Dispatch *********************************************/
+    /** Step<Op> skips the opcode byte, fetches the operand, **/
+    /** charges the constant cycle count, runs the operation **/
+    /** and fetches the next opcode, so PC stays in a        **/
+    /** register for the whole step. With musttail support   **/
+    /** each step tail-calls the next one until ICount runs  **/
+    /** out; otherwise Run() loops on the opcode each step   **/
+    /** returns. Single<Op> executes one instruction only.   **/
+    /*********************************************************/
+#ifdef M6502_MUSTTAIL
+    using Step_t = void;
+#else
+    using Step_t = byte;
+#endif
+
+    template<int Opcode>
+    M6502_FLATTEN static void Single(M6502 *R) {
+        constexpr Handler Op = Ops[Opcode];
+        R->PC.W++;
+        R->ICount -= Cycles[Opcode];
+        if constexpr (!Bus::PureOp && (Opcode & 0x1F) == 0x10) {
+            /* Untaken branches skip their offset without reading it */
+            constexpr byte Flag = Opcode < 0x40 ? N_FLAG : Opcode < 0x80 ? V_FLAG : Opcode < 0xC0 ? C_FLAG : Z_FLAG;
+            if (Flags::template Test<Flag>(R) != ((Opcode & 0x20) != 0)) {
+                R->PC.W++;
+                return;
+            }
+        }
+        Op(R, Fetch<Operands[Opcode]>(R));
+    }
+
+    template<int Opcode>
+    M6502_FLATTEN static Step_t Step(M6502 *R) {
+        Single<Opcode>(R);
+#ifdef M6502_MUSTTAIL
+        if (R->ICount > 0) M6502_MUSTTAIL return Table[Bus::Op(R, R->PC.W)](R);
+#else
+        /* Prefetching past the end of a slice is only safe when */
+        /* opcode reads cannot hit I/O registers                 */
+        if constexpr (!Bus::PureOp) if (R->ICount <= 0) return 0;
+        return Bus::Op(R, R->PC.W);
+#endif
+    }
+
+    /** Predecoded Blocks ************************************/
+    /** Execute<Op> runs an instruction whose operand and    **/
+    /** cycles are already known, Fused<A,B> runs a pair of  **/
+    /** them. PC is only updated where it is used. Fixed<Op> **/
+    /** does the same for precompiled blocks, which pass the **/
+    /** operand and next PC as constants.                    **/
+    /*********************************************************/
+    template<int Opcode>
+    M6502_FLATTEN static void Fixed(M6502 *R, word O, word Next) {
+        constexpr Handler Op = Ops[Opcode];
+        if constexpr (Kinds[Opcode] & END_BLOCK) R->PC.W = Next;
+        Op(R, O);
+    }
+
+    template<int Opcode>
+    M6502_FLATTEN static void Execute(M6502 *R, const Instr &I) { Fixed<Opcode>(R, I.Operand, I.Next); }
+
+    template<int First, int Second>
+    M6502_FLATTEN static void Fused(M6502 *R, const Instr &I) {
+        constexpr Handler Op1 = Ops[First], Op2 = Ops[Second];
+        if constexpr (ReachesBus(First)) {
+            R->IPending += Cycles[Second];    /* Not due during Op1 */
+            Op1(R, I.Operand);
+            R->IPending -= Cycles[Second];
+        } else {
+            Op1(R, I.Operand);
+        }
+        if constexpr (Kinds[Second] & END_BLOCK) R->PC.W = I.Next;
+        Op2(R, I.Operand2);
+    }
+
+    struct Pair {
+        byte First, Second;
+        Exec Run;
+    };
+
+    static constexpr Pair Pairs[] = {
+        { 0xA9, 0x85, Fused<0xA9, 0x85> }, /* LDA #n,  STA zp  */
+        { 0xA9, 0x8D, Fused<0xA9, 0x8D> }, /* LDA #n,  STA abs */
+        { 0xA5, 0x85, Fused<0xA5, 0x85> }, /* LDA zp,  STA zp  */
+        { 0xA5, 0x8D, Fused<0xA5, 0x8D> }, /* LDA zp,  STA abs */
+        { 0xAD, 0x85, Fused<0xAD, 0x85> }, /* LDA abs, STA zp  */
+        { 0xAD, 0x8D, Fused<0xAD, 0x8D> }, /* LDA abs, STA abs */
+        { 0xCA, 0xD0, Fused<0xCA, 0xD0> }, /* DEX, BNE         */
+        { 0x88, 0xD0, Fused<0x88, 0xD0> }, /* DEY, BNE         */
+        { 0xE8, 0xD0, Fused<0xE8, 0xD0> }, /* INX, BNE         */
+        { 0xC8, 0xD0, Fused<0xC8, 0xD0> }, /* INY, BNE         */
+        { 0xC9, 0xD0, Fused<0xC9, 0xD0> }, /* CMP #n, BNE      */
+        { 0xC9, 0xF0, Fused<0xC9, 0xF0> }, /* CMP #n, BEQ      */
+    };
+
+    template<class T, template<int> class F, std::size_t... Opcode>
+    static constexpr std::array<T, 256> MakeTable(std::index_sequence<Opcode...>) {
+        return {{F<Opcode>::Value...}};
+    }
+
+    template<int Opcode> struct StepOf { static constexpr Step_t (*Value)(M6502 *) = Step<Opcode>; };
+    template<int Opcode> struct SingleOf { static constexpr void (*Value)(M6502 *) = Single<Opcode>; };
+    template<int Opcode> struct ExecuteOf { static constexpr Exec Value = Execute<Opcode>; };
+
+    static constexpr auto Table = MakeTable<Step_t (*)(M6502 *), StepOf>(std::make_index_sequence<256>());
+    static constexpr auto Singles = MakeTable<void (*)(M6502 *), SingleOf>(std::make_index_sequence<256>());
+    static constexpr auto Executes = MakeTable<Exec, ExecuteOf>(std::make_index_sequence<256>());
+
+    /* Decodes the block starting at R->PC into C.Blocks, O being */
+    /* its offset in C.Code. Returns 0 if nothing fits in it.     */
+    static Block *Decode(M6502 *R, BlockCache &C, std::size_t O) {
+        if (C.Used == BlockCache::MaxBlocks || C.UsedInstrs + Block::MaxLength > BlockCache::MaxInstrs) C.Flush();
+
+        Block &B = C.Blocks[C.Used];
+        word PC = R->PC.W;
+        B.Code = &C.Instrs[C.UsedInstrs];
+        B.PC = PC;
+        B.Page = R->Page[PC >> 8];
+        B.Cycles = 0;
+        B.Count = 0;
+        B.Jumps = false;
+        B.Idle = true;
+        B.Runs = 0;
+        B.Native = nullptr;
+
+        while (B.Count < Block::MaxLength) {
+            byte Opcode = B.Page[PC & 0xFF];
+            word Last = PC + Operands[Opcode];
+
+            /* Stay inside the page, so that one R->Page[] check */
+            /* tells if the block is still mapped in             */
+            if (((Last ^ B.PC) & 0xFF00) || C.Offset(R, Last) == C.Size) break;
+
+            const byte *Code = B.Page + (PC & 0xFF);
+            word Operand = Operands[Opcode] == 2 ? Code[1] | (Code[2] << 8) : Operands[Opcode] == 1 ? Code[1] : 0;
+
+            B.Cycles += Cycles[Opcode];
+            PC = Last + 1;
+
+            Instr *Prev = B.Count ? &B.Code[B.Count - 1] : nullptr;
+            const Pair *P = nullptr;
+            if (Prev && !Prev->Fused)
+                for (const Pair &K : Pairs)
+                    if (K.First == Prev->Opcode && K.Second == Opcode) P = &K;
+
+            Instr &I = P ? *Prev : B.Code[B.Count++];
+            if (P) {
+                I.Run = P->Run;
+                I.Operand2 = Operand;
+                I.Opcode2 = Opcode;
+                I.Fused = true;
+            } else {
+                I.Run = Executes[Opcode];
+                I.Operand = Operand;
+                I.Opcode = Opcode;
+                I.Fused = false;
+            }
+            I.Next = PC;
+            I.Cycles = B.Cycles;
+            I.Branch = (Opcode & 0x1F) == 0x10 && Operand < 0x80; /* Loops still end blocks */
+            I.Check = (Kinds[Opcode] & BUS_WRITE) || I.Branch;
+            B.Idle = B.Idle && !(Kinds[Opcode] & MEM_WRITE) && !ReadsVolatile(R, Opcode, Operand);
+
+            if ((Kinds[Opcode] & END_BLOCK) && !I.Branch) {
+                B.Jumps = true;
+                break;
+            }
+        }
+
+        if (!B.Count) return nullptr;
+
+        /* A branch at the end goes wherever it goes */
+        Instr &L = B.Code[B.Count - 1];
+        if (L.Branch) {
+            L.Branch = L.Check = false;
+            B.Jumps = true;
+        }
+
+        /* A loop onto itself that writes nothing and reads */
+        /* nothing volatile may be idling                   */
+        byte Opcode = L.Fused ? L.Opcode2 : L.Opcode;
+        word Operand = L.Fused ? L.Operand2 : L.Operand;
+        if (Opcode == 0x4C) B.Idle = B.Idle && Operand == B.PC;
+        else if ((Opcode & 0x1F) == 0x10 || Opcode == 0x80) B.Idle = B.Idle && (word) (L.Next + (offset) Operand) == B.PC;
+        else B.Idle = false;
+        B.End = PC;
+        if (const Precompiled *P = C.Find(B, O)) B.Native = P->Run;
+        C.UsedInstrs += B.Count;
+        C.Index[O] = ++C.Used;
+        return &B;
+    }
+
+    /* Finds the block at R->PC, decoding it if Entry is set */
+    static Block *Lookup(M6502 *R, BlockCache &C, bool Entry) {
+        std::size_t O = C.Offset(R, R->PC.W);
+        if (O == C.Size) return nullptr;
+        std::uint32_t N = C.Index[O];
+        if (N && C.Blocks[N - 1].PC == R->PC.W) return &C.Blocks[N - 1];
+        return Entry ? Decode(R, C, O) : nullptr;
+    }
+
+    /* The whole block cost is charged up front, with the part */
+    /* not yet due in R->IPending for the bus to add back. A   */
+    /* store that may have switched banks or cost extra        */
+    /* cycles, or a taken forward branch, leaves the block     */
+    /* early with the rest refunded, and RunOnce() returns     */
+    /* false.                                                  */
+    static bool RunOnce(M6502 *R, const Block &B) {
+        R->ICount -= B.Cycles;
+        for (int J = 0; J < B.Count; J++) {
+            const Instr &I = B.Code[J];
+            R->IPending = B.Cycles - I.Cycles;
+            I.Run(R, I);
+            if (I.Check && (I.Branch ? R->PC.W != I.Next : (R->Page[B.PC >> 8] != B.Page || R->ICount + B.Cycles - I.Cycles <= 0))) {
+                R->ICount += B.Cycles - I.Cycles;
+                R->IPending = 0;
+                if (!I.Branch) R->PC.W = I.Next;
+                return false;
+            }
+        }
+        if (!B.Jumps) R->PC.W = B.End;
+        return true;
+    }
+
+    static void RunBlock(M6502 *R, const Block &B) {
+        while (RunOnce(R, B) && R->PC.W == B.PC && R->ICount >= B.Cycles);
+    }
+
+    /* Runs a block that may be an idle loop once. It reads    */
+    /* only memory it cannot change, so if the pass left the   */
+    /* registers as they were, nothing can change before       */
+    /* Loop6502() or an interrupt, and every pass left         */
+    /* in the slice is skipped at once and counted in          */
+    /* R->ISkipped. Otherwise the block just goes on looping.  */
+    static void RunIdle(M6502 *R, const Block &B) {
+        byte A = R->A, X = R->X, Y = R->Y, S = R->S, P = Flags::Get(R);
+        int Start = R->ICount;
+
+        if (!RunOnce(R, B) || R->PC.W != B.PC || R->ICount < B.Cycles) return;
+        if (R->A == A && R->X == X && R->Y == Y && R->S == S && Flags::Get(R) == P) {
+            int Pass = Start - R->ICount;
+            int Skip = ((R->ICount - B.Cycles) / Pass + 1) * Pass;
+            R->ICount -= Skip;
+            R->ISkipped += Skip;
+        } else {
+            RunBlock(R, B);
+        }
+    }
+
+    /* Runs the rest of the current slice in the interpreter */
+    static void Interpret(M6502 *R) {
+#ifdef M6502_MUSTTAIL
+        Table[Bus::Op(R, R->PC.W)](R);
+#else
+        byte Next = Bus::Op(R, R->PC.W);
+        do {
+            Next = Table[Next](R);
+        } while (R->ICount > 0);
+#endif
+    }
+
+    /* Runs the current slice, using blocks wherever the whole */
+    /* block fits into the cycles left. Precompiled blocks and */
+    /* hot blocks handed to C.Compile() run as native code.    */
+    /* New blocks are only decoded where control flow lands,   */
+    /* so a slice ending mid-block does not leave an           */
+    /* overlapping one.                                        */
+    static void RunCached(M6502 *R, BlockCache &C) {
+        bool Entry = C.Entry;
+
+        while (R->ICount > 0) {
+            Block *B = Lookup(R, C, Entry);
+            if (!B) {
+                byte Opcode = Bus::Op(R, R->PC.W);
+                Singles[Opcode](R);
+                Entry = Kinds[Opcode] & END_BLOCK;
+            } else if (R->ICount < B->Cycles) {
+                Interpret(R);                /* Slice ends inside B */
+                Entry = false;
+            } else {
+                if (B->Idle) RunIdle(R, *B);
+                else if (B->Native) B->Native(R);
+                else {
+                    if (C.Compile && ++B->Runs == BlockCache::HotRuns) C.Compile(R, C, *B);
+                    RunBlock(R, *B);
+                }
+                Entry = true;
+            }
+        }
+        C.Entry = Entry;
+    }
+
+    /** Reset/Int/Run ****************************************/
+    static void Reset(M6502 *R) {
+        R->A = R->X = R->Y = 0x00;
+        R->P = Z_FLAG | R_FLAG;
+        R->S = 0xFF;
+        R->PC.B.l = Bus::Rd(R, 0xFFFC);
+        R->PC.B.h = Bus::Rd(R, 0xFFFD);
+        R->ICount = R->IPeriod;
+        R->IPending = 0;
+        R->IRequest = INT_NONE;
+        R->AfterCLI = 0;
+        if (R->Cache) static_cast<BlockCache *>(R->Cache)->Entry = true;
+    }
+
+    static void Int(M6502 *R, byte Type) {
+        if ((Type == INT_NMI) || ((Type == INT_IRQ) && !(R->P & I_FLAG))) {
+            word J;
+            R->ICount -= 7;
+            Push(R, R->PC.B.h);
+            Push(R, R->PC.B.l);
+            Push(R, R->P & ~B_FLAG);
+            R->P &= ~D_FLAG;
+            if (Type == INT_NMI) J = 0xFFFA; else { R->P |= I_FLAG; J = 0xFFFE; }
+            R->PC.B.l = Bus::Rd(R, J++);
+            R->PC.B.h = Bus::Rd(R, J);
+            if (R->Cache) static_cast<BlockCache *>(R->Cache)->Entry = true;
+        }
+    }
+
+    /* Ends a slice, returns false if Loop6502() said INT_QUIT */
+    static bool Expire(M6502 *R) {
+        /* If we have come after CLI, get INT_? from IRequest */
+        /* Otherwise, get it from the loop handler            */
+        byte I;
+        if (R->AfterCLI) {
+            I = R->IRequest;             /* Get pending interrupt     */
+            R->ICount += R->IBackup - 1; /* Restore the ICount        */
+            R->AfterCLI = 0;             /* Done with AfterCLI state  */
+        } else {
+            I = Loop6502(R);             /* Call the periodic handler */
+            R->ICount = R->IPeriod;      /* Reset the cycle counter   */
+        }
+
+        if (I == INT_QUIT) return false; /* Exit if INT_QUIT     */
+        if (I) Int(R, I);                /* Interrupt if needed  */
+        return true;
+    }
+
+    static word Run(M6502 *R) {
+        do {
+            Flags::Load(R);
+            if (R->Cache) RunCached(R, *static_cast<BlockCache *>(R->Cache));
+            else Interpret(R);
+            Flags::Store(R);
+        } while (Expire(R));
+        return R->PC.W;
+    }
+};
+
+} // namespace m6502
+
+#endif /* M6502_CORE_HPP */
@@ -0,0 +1,102 @@
+/** M6502: portable 6502 emulator ****************************/
+/**                                                         **/
+/**                          Debug.c                        **/
+/**                                                         **/
+/** This file contains the 65C02 disassembler. It reads     **/
+/** memory through R->Page[] only, so disassembling never   **/
+/** touches I/O registers. Both CPU cores use it.           **/
+/*************************************************************/
+#include "m6502.h"
+
+#include <stdio.h>
+
+enum Addressing { No, Ac, Im, Zp, Zx, Zy, Ix, Iy, Iz, Rl, Ab, Ax, Ay, In, Ia };
+
+/** Mnemonics[] **********************************************/
+/** Undefined opcodes run as NOPs, and are shown as such.   **/
+/*************************************************************/
+static const char *Mnemonics[256] = {
+    /* 0x00 */ "BRK", "ORA", "NOP", "NOP", "TSB", "ORA", "ASL", "NOP",
+    /* 0x08 */ "PHP", "ORA", "ASL", "NOP", "TSB", "ORA", "ASL", "NOP",
+    /* 0x10 */ "BPL", "ORA", "ORA", "NOP", "TRB", "ORA", "ASL", "NOP",
+    /* 0x18 */ "CLC", "ORA", "INA", "NOP", "TRB", "ORA", "ASL", "NOP",
+    /* 0x20 */ "JSR", "AND", "NOP", "NOP", "BIT", "AND", "ROL", "NOP",
+    /* 0x28 */ "PLP", "AND", "ROL", "NOP", "BIT", "AND", "ROL", "NOP",
+    /* 0x30 */ "BMI", "AND", "AND", "NOP", "BIT", "AND", "ROL", "NOP",
+    /* 0x38 */ "SEC", "AND", "DEA", "NOP", "BIT", "AND", "ROL", "NOP",
+    /* 0x40 */ "RTI", "EOR", "NOP", "NOP", "NOP", "EOR", "LSR", "NOP",
+    /* 0x48 */ "PHA", "EOR", "LSR", "NOP", "JMP", "EOR", "LSR", "NOP",
+    /* 0x50 */ "BVC", "EOR", "EOR", "NOP", "NOP", "EOR", "LSR", "NOP",
+    /* 0x58 */ "CLI", "EOR", "PHY", "NOP", "NOP", "EOR", "LSR", "NOP",
+    /* 0x60 */ "RTS", "ADC", "NOP", "NOP", "STZ", "ADC", "ROR", "NOP",
+    /* 0x68 */ "PLA", "ADC", "ROR", "NOP", "JMP", "ADC", "ROR", "NOP",
+    /* 0x70 */ "BVS", "ADC", "ADC", "NOP", "STZ", "ADC", "ROR", "NOP",
+    /* 0x78 */ "SEI", "ADC", "PLY", "NOP", "JMP", "ADC", "ROR", "NOP",
+    /* 0x80 */ "BRA", "STA", "NOP", "NOP", "STY", "STA", "STX", "NOP",
+    /* 0x88 */ "DEY", "BIT", "TXA", "NOP", "STY", "STA", "STX", "NOP",
+    /* 0x90 */ "BCC", "STA", "STA", "NOP", "STY", "STA", "STX", "NOP",
+    /* 0x98 */ "TYA", "STA", "TXS", "NOP", "STZ", "STA", "STZ", "NOP",
+    /* 0xA0 */ "LDY", "LDA", "LDX", "NOP", "LDY", "LDA", "LDX", "NOP",
+    /* 0xA8 */ "TAY", "LDA", "TAX", "NOP", "LDY", "LDA", "LDX", "NOP",
+    /* 0xB0 */ "BCS", "LDA", "LDA", "NOP", "LDY", "LDA", "LDX", "NOP",
+    /* 0xB8 */ "CLV", "LDA", "TSX", "NOP", "LDY", "LDA", "LDX", "NOP",
+    /* 0xC0 */ "CPY", "CMP", "NOP", "NOP", "CPY", "CMP", "DEC", "NOP",
+    /* 0xC8 */ "INY", "CMP", "DEX", "NOP", "CPY", "CMP", "DEC", "NOP",
+    /* 0xD0 */ "BNE", "CMP", "CMP", "NOP", "NOP", "CMP", "DEC", "NOP",
+    /* 0xD8 */ "CLD", "CMP", "PHX", "NOP", "NOP", "CMP", "DEC", "NOP",
+    /* 0xE0 */ "CPX", "SBC", "NOP", "NOP", "CPX", "SBC", "INC", "NOP",
+    /* 0xE8 */ "INX", "SBC", "NOP", "NOP", "CPX", "SBC", "INC", "NOP",
+    /* 0xF0 */ "BEQ", "SBC", "SBC", "NOP", "NOP", "SBC", "INC", "NOP",
+    /* 0xF8 */ "SED", "SBC", "PLX", "NOP", "NOP", "SBC", "INC", "NOP",
+};
+
+static const byte Modes[256] = {
+    No,Ix,No,No,Zp,Zp,Zp,No,No,Im,Ac,No,Ab,Ab,Ab,No,
+    Rl,Iy,Iz,No,Zp,Zx,Zx,No,No,Ay,No,No,Ab,Ax,Ax,No,
+    Ab,Ix,No,No,Zp,Zp,Zp,No,No,Im,Ac,No,Ab,Ab,Ab,No,
+    Rl,Iy,Iz,No,Zx,Zx,Zx,No,No,Ay,No,No,Ax,Ax,Ax,No,
+    No,Ix,No,No,No,Zp,Zp,No,No,Im,Ac,No,Ab,Ab,Ab,No,
+    Rl,Iy,Iz,No,No,Zx,Zx,No,No,Ay,No,No,No,Ax,Ax,No,
+    No,Ix,No,No,Zp,Zp,Zp,No,No,Im,Ac,No,In,Ab,Ab,No,
+    Rl,Iy,Iz,No,Zx,Zx,Zx,No,No,Ay,No,No,Ia,Ax,Ax,No,
+    Rl,Ix,No,No,Zp,Zp,Zp,No,No,Im,No,No,Ab,Ab,Ab,No,
+    Rl,Iy,Iz,No,Zx,Zx,Zy,No,No,Ay,No,No,Ab,Ax,Ax,No,
+    Im,Ix,Im,No,Zp,Zp,Zp,No,No,Im,No,No,Ab,Ab,Ab,No,
+    Rl,Iy,Iz,No,Zx,Zx,Zy,No,No,Ay,No,No,Ax,Ax,Ay,No,
+    Im,Ix,No,No,Zp,Zp,Zp,No,No,Im,No,No,Ab,Ab,Ab,No,
+    Rl,Iy,Iz,No,No,Zx,Zx,No,No,Ay,No,No,No,Ax,Ax,No,
+    Im,Ix,No,No,Zp,Zp,Zp,No,No,Im,No,No,Ab,Ab,Ab,No,
+    Rl,Iy,Iz,No,No,Zx,Zx,No,No,Ay,No,No,No,Ax,Ax,No,
+};
+
+/** DAsm6502() ***********************************************/
+/** This function writes the instruction at address A into  **/
+/** S in assembler syntax, and returns its length in bytes. **/
+/*************************************************************/
+int DAsm6502(const M6502 *R, char *S, word A)
+{
+    byte Op = R->Page[A >> 8][A & 0xFF];
+    word B = (word) (A + 1), C = (word) (A + 2);
+    byte L = R->Page[B >> 8][B & 0xFF];
+    word W = L | (R->Page[C >> 8][C & 0xFF] << 8);
+    const char *M = Mnemonics[Op];
+
+    switch (Modes[Op])
+    {
+        case Ac: sprintf(S, "%s A", M);                          return(1);
+        case Im: sprintf(S, "%s #$%02X", M, L);                 return(2);
+        case Zp: sprintf(S, "%s $%02X", M, L);                  return(2);
+        case Zx: sprintf(S, "%s $%02X,X", M, L);                return(2);
+        case Zy: sprintf(S, "%s $%02X,Y", M, L);                return(2);
+        case Ix: sprintf(S, "%s ($%02X,X)", M, L);              return(2);
+        case Iy: sprintf(S, "%s ($%02X),Y", M, L);              return(2);
+        case Iz: sprintf(S, "%s ($%02X)", M, L);                return(2);
+        case Rl: sprintf(S, "%s $%04X", M, (word) (A + 2 + (offset) L)); return(2);
+        case Ab: sprintf(S, "%s $%04X", M, W);                  return(3);
+        case Ax: sprintf(S, "%s $%04X,X", M, W);                return(3);
+        case Ay: sprintf(S, "%s $%04X,Y", M, W);                return(3);
+        case In: sprintf(S, "%s ($%04X)", M, W);                return(3);
+        case Ia: sprintf(S, "%s ($%04X,X)", M, W);              return(3);
+        default: sprintf(S, "%s", M);                            return(1);
+    }
+}
@@ -0,0 +1,103 @@
+/** M65C02: threaded-code 65C02 emulator *********************/
+/**                                                         **/
+/**                         Debug.hpp                       **/
+/**                                                         **/
+/** This file contains the debugger behind Debug6502(). It  **/
+/** is a second instance of Core.hpp over a WatchBus, which **/
+/** checks every data access against the watch table, and  **/
+/** runs one instruction at a time so PC can be checked     **/
+/** before each of them. Run6502() never sees any of this,  **/
+/** so it runs exactly as fast with or without watches.     **/
+/*************************************************************/
+#ifndef M6502_DEBUG_HPP
+#define M6502_DEBUG_HPP
+
+#include "core.hpp"
+
+namespace m6502 {
+
+/** Watches **************************************************/
+/** WATCH_* kinds for every address, and the last access    **/
+/** that matched one. Kept in R->Debug.                     **/
+/*************************************************************/
+struct Watches {
+    byte Kinds[0x10000];
+    byte Hit;     /* WATCH_READ/WRITE that matched, or 0 */
+    word HitAddr; /* Address it matched at               */
+};
+
+/** WatchBus *************************************************/
+/** Passes every access on to Bus, noting in Watches those  **/
+/** that match a WATCH_READ or WATCH_WRITE. Opcode, operand **/
+/** and pointer fetches and stack pulls go through Op(),    **/
+/** which is not watched.                                   **/
+/*************************************************************/
+template<class Bus>
+struct WatchBus {
+    static constexpr bool PureOp = Bus::PureOp;
+
+    template<int Kind>
+    static void Check(M6502 *R, word A) {
+        Watches &W = *static_cast<Watches *>(R->Debug);
+        if (W.Kinds[A] & Kind) { W.Hit = Kind; W.HitAddr = A; }
+    }
+
+    static byte Op(M6502 *R, word A) { return Bus::Op(R, A); }
+    static byte Rd(M6502 *R, word A) { Check<WATCH_READ>(R, A); return Bus::Rd(R, A); }
+    static void Wr(M6502 *R, word A, byte V) { Check<WATCH_WRITE>(R, A); Bus::Wr(R, A, V); }
+    static byte RdZP(M6502 *R, word A) { Check<WATCH_READ>(R, (byte) A); return Bus::RdZP(R, A); }
+    static void WrZP(M6502 *R, word A, byte V) { Check<WATCH_WRITE>(R, (byte) A); Bus::WrZP(R, A, V); }
+    static void WrStack(M6502 *R, byte S, byte V) { Check<WATCH_WRITE>(R, 0x0100 | S); Bus::WrStack(R, S, V); }
+};
+
+/** Debugger *************************************************/
+/** Run() is Core::Run() stepping through Singles[] of the  **/
+/** watched core instead of running blocks. A stop keeps    **/
+/** ICount, so the next call finishes the same slice.       **/
+/*************************************************************/
+template<class Bus, class Flags = DefaultFlags>
+struct Debugger {
+    using Cpu = Core<WatchBus<Bus>, Flags>;
+
+    static int Run(M6502 *R, int Mode, word *Hit) {
+        Watches &W = *static_cast<Watches *>(R->Debug);
+        const word Start = R->PC.W;
+        bool Ran = false, Over = false;
+        word Return = 0;
+        byte S = 0;
+
+        for (;;) {
+            int Stop = STOP_QUIT;
+
+            Flags::Load(R);
+            while (R->ICount > 0) {
+                const word PC = R->PC.W;
+
+                /* Leaving a breakpoint has to run its instruction */
+                if ((W.Kinds[PC] & WATCH_EXEC) && (Ran || PC != Start)) { Stop = STOP_BREAK; break; }
+                if (Ran && (Over ? PC == Return && R->S >= S : Mode != DEBUG_RUN)) { Stop = STOP_STEP; break; }
+
+                /* Stepping over a JSR runs until it returns to the */
+                /* next instruction at the same stack depth         */
+                const byte Opcode = Bus::Op(R, PC);
+                if (!Ran && Mode == DEBUG_OVER && Opcode == 0x20) { Over = true; Return = PC + 3; S = R->S; }
+
+                W.Hit = 0;
+                Cpu::Singles[Opcode](R);
+                Ran = true;
+                if (W.Hit) { Stop = STOP_WATCH; break; }
+            }
+            Flags::Store(R);
+
+            if (Stop != STOP_QUIT) {
+                if (Hit) *Hit = Stop == STOP_WATCH ? W.HitAddr : R->PC.W;
+                return Stop;
+            }
+            if (!Cpu::Expire(R)) return STOP_QUIT;
+        }
+    }
+};
+
+} // namespace m6502
+
+#endif /* M6502_DEBUG_HPP */
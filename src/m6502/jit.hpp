@@ -0,0 +1,544 @@
+/** M65C02: threaded-code 65C02 emulator *********************/
+/**                                                         **/
+/**                          Jit.hpp                        **/
+/**                                                         **/
+/** This file contains an x86-64 translator for hot blocks  **/
+/** in a BlockCache. Register-only instructions, flags and  **/
+/** branches are emitted inline; everything that touches    **/
+/** memory calls the Core<Bus> handler for the opcode, so   **/
+/** I/O still goes through Rd6502()/Wr6502(). Registers    **/
+/** stay in M6502, so they are always in sync at block      **/
+/** exits, and ICount and IPending are kept exactly the way **/
+/** RunBlock() keeps them.                                  **/
+/**                                                         **/
+/** In JIT_VERIFY mode every translated instruction is      **/
+/** followed by a call to Check(), which replays it through **/
+/** the interpreter on a shadow copy of the registers, with **/
+/** memory reads and writes taken from a log of what the    **/
+/** native code did. Blocks that disagree are printed and   **/
+/** dropped back to the interpreter.                        **/
+/*************************************************************/
+#ifndef M6502_JIT_HPP
+#define M6502_JIT_HPP
+
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "core.hpp"
+
+namespace m6502 {
+
+/** Emitter **************************************************/
+/** Writes x86-64 machine code. Mem() encodes a [rbx+disp32]**/
+/** operand, rbx always holding the M6502 pointer.          **/
+/*************************************************************/
+struct Emitter {
+    byte *P;
+
+    void Put(std::initializer_list<byte> Bytes) { for (byte V : Bytes) *P++ = V; }
+    void Put16(word V) { std::memcpy(P, &V, 2); P += 2; }
+    void Put32(std::uint32_t V) { std::memcpy(P, &V, 4); P += 4; }
+    void Put64(std::uint64_t V) { std::memcpy(P, &V, 8); P += 8; }
+
+    void Mem(std::initializer_list<byte> Opcode, int Reg, std::size_t Disp) {
+        Put(Opcode);
+        Put({(byte) (0x83 | Reg << 3)});
+        Put32((std::uint32_t) Disp);
+    }
+
+    /* Emits a rel32 jump and returns its end, for Patch() */
+    byte *Jump(std::initializer_list<byte> Opcode) {
+        Put(Opcode);
+        Put32(0);
+        return P;
+    }
+
+    static void Patch(byte *At, byte *Target) {
+        std::int32_t Rel = (std::int32_t) (Target - At);
+        std::memcpy(At - 4, &Rel, 4);
+    }
+};
+
+/** Jit<Bus> *************************************************/
+/** Owns the executable arena and the verifier state for    **/
+/** one BlockCache. Attach() installs it as C.Compile().    **/
+/*************************************************************/
+template<class Bus, class Flags = DefaultFlags>
+struct Jit {
+    static constexpr std::size_t ArenaSize = 4 << 20;
+    static constexpr std::size_t MaxBlockCode = 2 * Block::MaxLength * 192 + 512;
+
+    using Cpu = Core<Bus, Flags>;
+    using Handler = typename Cpu::Handler;
+
+    byte *Arena;
+    byte *Free;
+    bool Verify;
+    int Mismatches = 0;
+    M6502 Shadow;
+    Block *Current = nullptr;
+
+    /** Verifier Buses ***************************************/
+    /** RecordBus logs every access made by handlers called  **/
+    /** from native code. ReplayBus feeds the same reads to  **/
+    /** the interpreter and checks its writes against them.  **/
+    /** Both reach the log of their own Jit through R.       **/
+    /*********************************************************/
+    struct Access {
+        word Addr;
+        byte Value;
+        bool Write;
+    };
+
+    std::vector<Access> Log;
+    std::size_t Position = 0;
+    bool Diverged = false;
+
+    struct RecordBus {
+        static constexpr bool PureOp = Bus::PureOp;
+        static byte Op(M6502 *R, word A) { return Read(R, A, Bus::Op(R, A)); }
+        static byte Rd(M6502 *R, word A) { return Read(R, A, Bus::Rd(R, A)); }
+        static byte RdZP(M6502 *R, word A) { return Read(R, A, Bus::RdZP(R, A)); }
+        static void Wr(M6502 *R, word A, byte V) { Of(R).Log.push_back({A, V, true}); Bus::Wr(R, A, V); }
+        static void WrZP(M6502 *R, word A, byte V) { Of(R).Log.push_back({A, V, true}); Bus::WrZP(R, A, V); }
+        static void WrStack(M6502 *R, byte S, byte V) { Of(R).Log.push_back({(word) (0x0100 | S), V, true}); Bus::WrStack(R, S, V); }
+
+        static byte Read(M6502 *R, word A, byte V) {
+            Of(R).Log.push_back({A, V, false});
+            return V;
+        }
+    };
+
+    struct ReplayBus {
+        static constexpr bool PureOp = Bus::PureOp;
+        static byte Op(M6502 *R, word A) { return Read(Of(R), A); }
+        static byte Rd(M6502 *R, word A) { return Read(Of(R), A); }
+        static byte RdZP(M6502 *R, word A) { return Read(Of(R), A); }
+        static void Wr(M6502 *R, word A, byte V) { Write(Of(R), A, V); }
+        static void WrZP(M6502 *R, word A, byte V) { Write(Of(R), A, V); }
+        static void WrStack(M6502 *R, byte S, byte V) { Write(Of(R), 0x0100 | S, V); }
+
+        /* Next entry of the log, if any */
+        static const Access *Next(Jit &J) { return J.Position < J.Log.size() ? &J.Log[J.Position] : nullptr; }
+
+        static byte Read(Jit &J, word A) {
+            const Access *E = Next(J);
+            if (E && !E->Write && E->Addr == A) return J.Log[J.Position++].Value;
+            J.Diverged = true;
+            return 0xFF;
+        }
+
+        static void Write(Jit &J, word A, byte V) {
+            const Access *E = Next(J);
+            if (E && E->Write && E->Addr == A && E->Value == V) J.Position++;
+            else J.Diverged = true;
+        }
+    };
+
+    using Recorded = Core<RecordBus, Flags>;
+    using Replay = Core<ReplayBus, Flags>;
+
+    static Jit &Of(M6502 *R) { return *static_cast<Jit *>(static_cast<BlockCache *>(R->Cache)->Jit); }
+
+    /* Called at the top of every pass through a verified block */
+    static void Begin(M6502 *R, Block *B) {
+        Jit &J = Of(R);
+        J.Shadow = *R;
+        J.Current = B;
+        J.Log.clear();
+    }
+
+    /* Called after every verified instruction. Pending is the */
+    /* part of the precharged block cost not yet due.          */
+    static void Check(M6502 *R, int Pending) {
+        Jit &J = Of(R);
+        M6502 &S = J.Shadow;
+        word At = S.PC.W;
+        byte Opcode = Bus::Op(&S, At);
+        word O = 0;
+
+        S.PC.W++;
+        if (Operands[Opcode] >= 1) O = Bus::Op(&S, S.PC.W++);
+        if (Operands[Opcode] == 2) O |= Bus::Op(&S, S.PC.W++) << 8;
+        S.ICount -= Cycles[Opcode];
+
+        J.Position = 0;
+        J.Diverged = false;
+        Replay::Ops[Opcode](&S, O);
+
+        bool Ok = !J.Diverged && J.Position == J.Log.size() && S.A == R->A && S.X == R->X && S.Y == R->Y &&
+                  Flags::Get(&S) == Flags::Get(R) && S.S == R->S && S.PC.W == R->PC.W && S.ICount - Pending == R->ICount &&
+                  S.AfterCLI == R->AfterCLI;
+        J.Log.clear();
+        if (Ok) return;
+
+        fprintf(stderr, "Jit6502: mismatch at %04X (%02X): A=%02X/%02X X=%02X/%02X Y=%02X/%02X P=%02X/%02X S=%02X/%02X PC=%04X/%04X\n",
+                At, Opcode, R->A, S.A, R->X, S.X, R->Y, S.Y, Flags::Get(R), Flags::Get(&S), R->S, S.S, R->PC.W, S.PC.W);
+        J.Mismatches++;
+
+        /* Go on with the interpreter's registers, and never */
+        /* run this block natively again                     */
+        R->A = S.A;
+        R->X = S.X;
+        R->Y = S.Y;
+        R->P = S.P;
+        R->NZ = S.NZ;
+        R->S = S.S;
+        J.Current->Native = nullptr;
+    }
+
+    /** Translation ******************************************/
+#ifdef _WIN32
+    static constexpr byte Arg0 = 0xD9, Arg1 = 0xBA; /* rcx, edx */
+#else
+    static constexpr byte Arg0 = 0xDF, Arg1 = 0xBE; /* rdi, esi */
+#endif
+
+    static constexpr std::size_t RegA = offsetof(M6502, A), RegX = offsetof(M6502, X), RegY = offsetof(M6502, Y);
+    static constexpr std::size_t RegS = offsetof(M6502, S), RegP = offsetof(M6502, P), RegPC = offsetof(M6502, PC);
+    static constexpr std::size_t RegICount = offsetof(M6502, ICount), RegPage = offsetof(M6502, Page);
+    static constexpr std::size_t RegNZ = offsetof(M6502, NZ), RegIPending = offsetof(M6502, IPending);
+
+    /* Call F(R, Arg), Arg being a 32-bit value */
+    static void Call(Emitter &E, const void *F, std::uint32_t Arg) {
+        E.Put({0x48, 0x89, Arg0});            /* mov arg0,rbx      */
+        E.Put({Arg1});                        /* mov arg1d,imm32   */
+        E.Put32(Arg);
+        E.Put({0x48, 0xB8});                  /* mov rax,imm64     */
+        E.Put64((std::uintptr_t) F);
+        E.Put({0xFF, 0xD0});                  /* call rax          */
+    }
+
+    /* Call F(R, Arg), Arg being a pointer */
+    static void CallPtr(Emitter &E, const void *F, const void *Arg) {
+        E.Put({0x48, 0x89, Arg0});            /* mov arg0,rbx      */
+        E.Put({0x48, Arg1});                 /* mov arg1,imm64    */
+        E.Put64((std::uintptr_t) Arg);
+        E.Put({0x48, 0xB8});                  /* mov rax,imm64     */
+        E.Put64((std::uintptr_t) F);
+        E.Put({0xFF, 0xD0});                  /* call rax          */
+    }
+
+    static void SetPending(Emitter &E, int V) {
+        E.Mem({0xC7}, 0, RegIPending);       /* mov [IPending],imm */
+        E.Put32(V);
+    }
+
+    static void SetPC(Emitter &E, word V) {
+        E.Put({0x66});
+        E.Mem({0xC7}, 0, RegPC);              /* mov word [PC],imm */
+        E.Put16(V);
+    }
+
+    /* N and Z from the byte zero-extended in eax */
+    static void SetZN(Emitter &E) {
+        if constexpr (Flags::Lazy) {
+            E.Put({0x66});
+            E.Mem({0x89}, 0, RegNZ);          /* mov [NZ],ax       */
+            return;
+        }
+        E.Put({0x41, 0x0F, 0xB6, 0x0C, 0x04}); /* movzx ecx,[r12+rax] */
+        E.Mem({0x80}, 4, RegP);               /* and byte [P],~(N|Z) */
+        E.Put({(byte) ~(N_FLAG | Z_FLAG)});
+        E.Mem({0x08}, 1, RegP);               /* or [P],cl         */
+    }
+
+    static void Flag(Emitter &E, byte F, bool Set) {
+        E.Mem({0x80}, Set ? 1 : 4, RegP);     /* or/and byte [P]   */
+        E.Put({Set ? F : (byte) ~F});
+    }
+
+    static void LoadImm(Emitter &E, std::size_t Reg, byte V) {
+        E.Mem({0xC6}, 0, Reg);                /* mov byte [Reg],imm */
+        E.Put({V});
+        if constexpr (Flags::Lazy) {
+            E.Put({0x66});
+            E.Mem({0xC7}, 0, RegNZ);          /* mov word [NZ],imm */
+            E.Put16(V);
+            return;
+        }
+        Flag(E, N_FLAG | Z_FLAG, false);
+        if (ZNTable[V]) Flag(E, ZNTable[V], true);
+    }
+
+    static void Transfer(Emitter &E, std::size_t From, std::size_t To, bool ZN) {
+        E.Mem({0x0F, 0xB6}, 0, From);         /* movzx eax,[From]  */
+        E.Mem({0x88}, 0, To);                 /* mov [To],al       */
+        if (ZN) SetZN(E);
+    }
+
+    static void IncDec(Emitter &E, std::size_t Reg, bool Inc) {
+        E.Mem({0xFE}, Inc ? 0 : 1, Reg);      /* inc/dec byte [Reg] */
+        E.Mem({0x0F, 0xB6}, 0, Reg);          /* movzx eax,[Reg]   */
+        SetZN(E);
+    }
+
+    static void Compare(Emitter &E, std::size_t Reg, byte V) {
+        E.Mem({0x0F, 0xB6}, 0, Reg);          /* movzx eax,[Reg]   */
+        E.Put({0x2C, V});                     /* sub al,imm8       */
+        E.Put({0x0F, 0x93, 0xC2});            /* setae dl          */
+        E.Put({0x0F, 0xB6, 0xC0});            /* movzx eax,al      */
+        if constexpr (Flags::Lazy) {
+            E.Put({0x66});
+            E.Mem({0x89}, 0, RegNZ);          /* mov [NZ],ax       */
+            Flag(E, C_FLAG, false);
+            E.Mem({0x08}, 2, RegP);           /* or [P],dl         */
+            return;
+        }
+        E.Put({0x41, 0x0F, 0xB6, 0x0C, 0x04}); /* movzx ecx,[r12+rax] */
+        E.Put({0x08, 0xD1});                  /* or cl,dl          */
+        Flag(E, N_FLAG | Z_FLAG | C_FLAG, false);
+        E.Mem({0x08}, 1, RegP);               /* or [P],cl         */
+    }
+
+    static void Branch(Emitter &E, byte Opcode, word O, word Next) {
+        byte *NotTaken = nullptr;
+        if (Opcode != 0x80) {
+            byte F = Opcode < 0x40 ? N_FLAG : Opcode < 0x80 ? V_FLAG : Opcode < 0xC0 ? C_FLAG : Z_FLAG;
+            bool Set = Opcode & 0x20;
+            if (Flags::Lazy && F == Z_FLAG) {
+                E.Mem({0xF6}, 0, RegNZ);      /* test byte [NZ],FFh */
+                E.Put({0xFF});
+                Set = !Set;                   /* ZF=1 means Z set  */
+            } else if (Flags::Lazy && F == N_FLAG) {
+                E.Mem({0x0F, 0xB7}, 0, RegNZ); /* movzx eax,word [NZ] */
+                E.Put({0x08, 0xE0});          /* or al,ah          */
+                E.Put({0xA8, N_FLAG});        /* test al,80h       */
+            } else {
+                E.Mem({0xF6}, 0, RegP);       /* test byte [P],F   */
+                E.Put({F});
+            }
+            NotTaken = E.Jump({0x0F, (byte) (Set ? 0x84 : 0x85)});
+        }
+        E.Mem({0xFF}, 1, RegICount);          /* dec dword [ICount] */
+        SetPC(E, Next + (offset) O);
+        if (NotTaken) {
+            byte *Done = E.Jump({0xE9});
+            Emitter::Patch(NotTaken, E.P);
+            SetPC(E, Next);
+            Emitter::Patch(Done, E.P);
+        }
+    }
+
+    /* Emits register-only opcodes inline, returns false for */
+    /* anything that needs its handler                       */
+    static bool Inline(Emitter &E, byte Opcode, word O) {
+        switch (Opcode) {
+            case 0xA9: LoadImm(E, RegA, O); return true;               /* LDA #n */
+            case 0xA2: LoadImm(E, RegX, O); return true;               /* LDX #n */
+            case 0xA0: LoadImm(E, RegY, O); return true;               /* LDY #n */
+            case 0xAA: Transfer(E, RegA, RegX, true); return true;     /* TAX */
+            case 0xA8: Transfer(E, RegA, RegY, true); return true;     /* TAY */
+            case 0x8A: Transfer(E, RegX, RegA, true); return true;     /* TXA */
+            case 0x98: Transfer(E, RegY, RegA, true); return true;     /* TYA */
+            case 0xBA: Transfer(E, RegS, RegX, true); return true;     /* TSX */
+            case 0x9A: Transfer(E, RegX, RegS, false); return true;    /* TXS */
+            case 0xE8: IncDec(E, RegX, true); return true;             /* INX */
+            case 0xC8: IncDec(E, RegY, true); return true;             /* INY */
+            case 0x1A: IncDec(E, RegA, true); return true;             /* INA */
+            case 0xCA: IncDec(E, RegX, false); return true;            /* DEX */
+            case 0x88: IncDec(E, RegY, false); return true;            /* DEY */
+            case 0x3A: IncDec(E, RegA, false); return true;            /* DEA */
+            case 0x18: Flag(E, C_FLAG, false); return true;            /* CLC */
+            case 0x38: Flag(E, C_FLAG, true); return true;             /* SEC */
+            case 0xD8: Flag(E, D_FLAG, false); return true;            /* CLD */
+            case 0xF8: Flag(E, D_FLAG, true); return true;             /* SED */
+            case 0xB8: Flag(E, V_FLAG, false); return true;            /* CLV */
+            case 0x78: Flag(E, I_FLAG, true); return true;             /* SEI */
+            case 0xC9: Compare(E, RegA, O); return true;               /* CMP #n */
+            case 0xE0: Compare(E, RegX, O); return true;               /* CPX #n */
+            case 0xC0: Compare(E, RegY, O); return true;               /* CPY #n */
+            default: return Cpu::Ops[Opcode] == Cpu::NOP;
+        }
+    }
+
+    /* One opcode; Done is the block cost through it */
+    void Translate(Emitter &E, const Block &B, byte Opcode, word O, int Done, word Next, std::vector<byte *> &Exits) {
+        Handler H = Verify ? Recorded::Ops[Opcode] : Cpu::Ops[Opcode];
+
+        if (!(Kinds[Opcode] & END_BLOCK)) {
+            if (!Inline(E, Opcode, O)) {
+                if (ReachesBus(Opcode)) SetPending(E, B.Cycles - Done);
+                Call(E, (const void *) H, O);
+            }
+            if (Verify) SetPC(E, Next);
+        } else if ((Opcode & 0x1F) == 0x10 || Opcode == 0x80) {
+            Branch(E, Opcode, O, Next);
+        } else if (Opcode == 0x4C) {
+            SetPC(E, O);                      /* JMP abs */
+        } else {
+            SetPC(E, Next);
+            if (ReachesBus(Opcode)) SetPending(E, B.Cycles - Done);
+            Call(E, (const void *) H, O);
+        }
+
+        if (Verify) Call(E, (const void *) Check, B.Cycles - Done);
+
+        /* Leave with a refund on a taken branch inside the block */
+        if (Done < B.Cycles && (Opcode & 0x1F) == 0x10) {
+            E.Put({0x66});
+            E.Mem({0x81}, 7, RegPC);          /* cmp word [PC],Next */
+            E.Put16(Next);
+            byte *Stay = E.Jump({0x0F, 0x84});
+            E.Mem({0x81}, 0, RegICount);      /* add [ICount],Rest */
+            E.Put32(B.Cycles - Done);
+            Exits.push_back(E.Jump({0xE9}));
+            Emitter::Patch(Stay, E.P);
+        }
+    }
+
+    void Translate(Emitter &E, Block &B) {
+        std::vector<byte *> Exits;
+
+        E.Put({0x53});                        /* push rbx          */
+        E.Put({0x41, 0x54});                  /* push r12          */
+        E.Put({0x48, 0x83, 0xEC, 0x28});      /* sub rsp,40        */
+        E.Put({0x48, 0x89, (byte) (Arg0 == 0xD9 ? 0xCB : 0xFB)}); /* mov rbx,arg0 */
+        E.Put({0x49, 0xBC});                  /* mov r12,ZNTable   */
+        E.Put64((std::uintptr_t) ZNTable);
+
+        byte *Top = E.P;
+        if (Verify) CallPtr(E, (const void *) Begin, &B);
+        E.Mem({0x81}, 5, RegICount);          /* sub [ICount],Cycles */
+        E.Put32(B.Cycles);
+
+        for (int N = 0; N < B.Count; N++) {
+            const Instr &I = B.Code[N];
+            if (I.Fused) {
+                word Next = I.Next - 1 - Operands[I.Opcode2];
+                Translate(E, B, I.Opcode, I.Operand, I.Cycles - Cycles[I.Opcode2], Next, Exits);
+                Translate(E, B, I.Opcode2, I.Operand2, I.Cycles, I.Next, Exits);
+            } else {
+                Translate(E, B, I.Opcode, I.Operand, I.Cycles, I.Next, Exits);
+            }
+
+            /* Leave with a refund if the store switched banks */
+            /* or the slice is over, just like RunBlock()     */
+            if (I.Check && !I.Branch) {
+                int Rest = B.Cycles - I.Cycles;
+                E.Put({0x48});
+                E.Mem({0x8B}, 0, RegPage + sizeof(byte *) * (B.PC >> 8)); /* mov rax,[Page[n]] */
+                E.Put({0x48, 0xB9});          /* mov rcx,imm64     */
+                E.Put64((std::uintptr_t) B.Page);
+                E.Put({0x48, 0x39, 0xC8});    /* cmp rax,rcx       */
+                byte *Moved = E.Jump({0x0F, 0x85});
+                E.Mem({0x8B}, 0, RegICount);  /* mov eax,[ICount]  */
+                E.Put({0x05});                /* add eax,Rest      */
+                E.Put32(Rest);
+                E.Put({0x85, 0xC0});          /* test eax,eax      */
+                byte *Ok = E.Jump({0x0F, 0x8F});
+                Emitter::Patch(Moved, E.P);
+                E.Mem({0x81}, 0, RegICount);  /* add [ICount],Rest */
+                E.Put32(Rest);
+                SetPC(E, I.Next);
+                Exits.push_back(E.Jump({0xE9}));
+                Emitter::Patch(Ok, E.P);
+            }
+        }
+        if (!B.Jumps) SetPC(E, B.End);
+
+        /* Loop while the block jumps to itself and still fits */
+        E.Put({0x66});
+        E.Mem({0x81}, 7, RegPC);              /* cmp word [PC],imm */
+        E.Put16(B.PC);
+        Exits.push_back(E.Jump({0x0F, 0x85}));
+        E.Mem({0x81}, 7, RegICount);          /* cmp [ICount],Cycles */
+        E.Put32(B.Cycles);
+        Emitter::Patch(E.Jump({0x0F, 0x8D}), Top);
+
+        for (byte *X : Exits) Emitter::Patch(X, E.P);
+        SetPending(E, 0);
+        E.Put({0x48, 0x83, 0xC4, 0x28});      /* add rsp,40        */
+        E.Put({0x41, 0x5C});                  /* pop r12           */
+        E.Put({0x5B});                        /* pop rbx           */
+        E.Put({0xC3});                        /* ret               */
+    }
+
+    /* Drops the native code of every block compiled into the */
+    /* arena, counting their runs again so that hot blocks get */
+    /* compiled anew. Precompiled blocks stay as they are.     */
+    void Drop(BlockCache &C) {
+        for (unsigned N = 0; N < C.Used; N++) {
+            Block &B = C.Blocks[N];
+            byte *Native = (byte *) B.Native;
+            if (Native >= Arena && Native < Arena + ArenaSize) {
+                B.Native = nullptr;
+                B.Runs = 0;
+            }
+        }
+    }
+
+    static void Compile(M6502 *, BlockCache &C, Block &B) {
+        Jit &J = *static_cast<Jit *>(C.Jit);
+
+        /* Start over when the arena is full */
+        if (J.Arena + ArenaSize - J.Free < (std::ptrdiff_t) MaxBlockCode) {
+            J.Drop(C);
+            J.Free = J.Arena;
+        }
+
+        Emitter E{J.Free};
+        J.Translate(E, B);
+        B.Native = (void (*)(M6502 *)) J.Free;
+        J.Free = E.P;
+    }
+
+    /** Attach() *********************************************/
+    /** Sets the JIT_* mode for C, dropping all code it has **/
+    /** compiled; precompiled blocks stay. Returns the      **/
+    /** number of mismatches found since the last call, or  **/
+    /** -1 if there is no executable memory.                **/
+    /*********************************************************/
+    static int Attach(BlockCache &C, int Mode) {
+        Jit *J = static_cast<Jit *>(C.Jit);
+        int Result = J ? J->Mismatches : 0;
+
+        if (J) J->Drop(C);
+        if (Mode == JIT_OFF) {
+            delete J;
+            C.Jit = nullptr;
+            C.Compile = nullptr;
+            return Result;
+        }
+
+        if (!J) {
+            J = new Jit;
+#ifdef _WIN32
+            J->Arena = (byte *) VirtualAlloc(NULL, ArenaSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+            J->Arena = (byte *) mmap(nullptr, ArenaSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (J->Arena == (byte *) MAP_FAILED) J->Arena = nullptr;
+#endif
+            if (!J->Arena) {
+                delete J;
+                return -1;
+            }
+            C.Jit = J;
+            C.Compile = Compile;
+        }
+        J->Free = J->Arena;
+        J->Verify = Mode == JIT_VERIFY;
+        J->Mismatches = 0;
+        return Result;
+    }
+
+    ~Jit() {
+        if (!Arena) return;
+#ifdef _WIN32
+        VirtualFree(Arena, 0, MEM_RELEASE);
+#else
+        munmap(Arena, ArenaSize);
+#endif
+    }
+};
+
+} // namespace m6502
+
+#endif /* M6502_JIT_HPP */
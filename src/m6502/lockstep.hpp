@@ -0,0 +1,849 @@
+/** M65C02: threaded-code 65C02 emulator *********************/
+/**                                                         **/
+/**                        Lockstep.hpp                     **/
+/**                                                         **/
+/** This file contains an engine that runs 16 machines with **/
+/** the same ROM side by side, one per byte of an SSE2      **/
+/** register. Registers are kept as arrays across lanes,    **/
+/** and RAM is interleaved, so one address in every lane is **/
+/** a single 16-byte load. Lanes at the same PC run each    **/
+/** instruction together, the others are masked out until   **/
+/** the group at the lowest PC gets to them. Instructions   **/
+/** without a vector handler, and decimal arithmetic, run   **/
+/** through Core.hpp one lane at a time on the same state.  **/
+/*************************************************************/
+#ifndef M6502_LOCKSTEP_HPP
+#define M6502_LOCKSTEP_HPP
+
+#include <emmintrin.h>
+
+#include <bit>
+#include <cstring>
+#include <memory>
+
+#include "core.hpp"
+
+namespace m6502 {
+
+/** Lockstep<IO> *********************************************/
+/** IO supplies the hardware of each lane:                  **/
+/**   static byte Rd(M6502 *R, int Lane, word A);           **/
+/**   static void Wr(M6502 *R, int Lane, word A, byte V);   **/
+/**   static byte Loop(M6502 *R, int Lane);                 **/
+/** which work like Rd6502(), Wr6502() and Loop6502(). R is **/
+/** the lane's own M6502. It is complete in Loop(), while   **/
+/** in Rd() and Wr() only ICount and Page[] are current.    **/
+/**                                                         **/
+/** Each page is MAP_RAM, interleaved in Memory; MAP_ROM,   **/
+/** read through each lane's R.Page[] and written through   **/
+/** IO::Wr(); or MAP_IO, read and written through IO, with  **/
+/** opcodes fetched from R.Page[] as with FAST_RDOP. Zero   **/
+/** page and stack must be MAP_RAM. Call Flush() after      **/
+/** changing R.Page[] anywhere but in IO::Wr() or Loop().   **/
+/*************************************************************/
+template<class IO>
+struct Lockstep {
+    static constexpr int Lanes = 16;
+    static constexpr unsigned All = (1u << Lanes) - 1;
+
+    enum { MAP_ROM, MAP_RAM, MAP_IO };
+
+    struct Lane {
+        M6502 R;          /* All but the registers kept below */
+        Lockstep *Owner;
+        int Index;
+    };
+
+    /** LaneBus **********************************************/
+    /** PageBus over one lane, for running it through Core. **/
+    /*********************************************************/
+    struct LaneBus {
+        static constexpr bool PureOp = true;
+        static Lane &Of(M6502 *R) { return *reinterpret_cast<Lane *>(R); }
+        static byte Op(M6502 *R, word A) { Lane &L = Of(R); return L.Owner->Op(L.Index, A); }
+        static byte Rd(M6502 *R, word A) { Lane &L = Of(R); return L.Owner->Rd(L.Index, A); }
+        static void Wr(M6502 *R, word A, byte V) { Lane &L = Of(R); L.Owner->Wr(L.Index, A, V); }
+        static byte RdZP(M6502 *R, word A) { Lane &L = Of(R); return L.Owner->Ram(L.Index, (byte) A); }
+        static void WrZP(M6502 *R, word A, byte V) { Lane &L = Of(R); L.Owner->Ram(L.Index, (byte) A) = V; }
+        static void WrStack(M6502 *R, byte S, byte V) { Lane &L = Of(R); L.Owner->Ram(L.Index, 0x0100 | S) = V; }
+    };
+
+    using Scalar = Core<LaneBus, EagerFlags>;
+    using V = __m128i;
+    using Reg = byte (Lockstep::*)[Lanes];
+
+    struct alignas(16) Block { byte Rows[256 * Lanes]; }; /* A RAM page */
+
+    alignas(16) byte A[Lanes], X[Lanes], Y[Lanes], P[Lanes], S[Lanes];
+    alignas(16) word PC[Lanes];
+    alignas(16) int ICount[Lanes];
+    Lane L[Lanes];
+
+    byte Map[256];
+    byte *Pages[256];          /* MAP_RAM pages in Memory     */
+    std::unique_ptr<Block[]> Memory;
+    const byte *Code[256];     /* R.Page[] shared by all, or 0 */
+    unsigned Checked[256];     /* Code[] entry is valid if Gen */
+    unsigned Gen;
+    unsigned Running;          /* Lanes Loop() has not quit   */
+
+    word IdlePC;               /* Last backward jump target   */
+    unsigned IdleG;            /* Lanes that made it          */
+    bool IdleClean;            /* Nothing written since       */
+    alignas(16) byte IdleRegs[5][Lanes];
+    alignas(16) int IdleCount[Lanes];
+
+    unsigned long long Steps;  /* Vector steps run            */
+    unsigned long long Wide;   /* Instructions run in them    */
+    unsigned long long Serial; /* Instructions run one by one */
+
+    explicit Lockstep(int RamPages) : Memory(new Block[RamPages]()) {
+        std::memset(A, 0, sizeof(A));
+        std::memset(X, 0, sizeof(X));
+        std::memset(Y, 0, sizeof(Y));
+        std::memset(P, 0, sizeof(P));
+        std::memset(S, 0, sizeof(S));
+        std::memset(PC, 0, sizeof(PC));
+        std::memset(ICount, 0, sizeof(ICount));
+        for (int I = 0; I < Lanes; I++) L[I] = {{}, this, I};
+        std::memset(Map, MAP_ROM, sizeof(Map));
+        std::memset(Pages, 0, sizeof(Pages));
+        std::memset(Checked, 0, sizeof(Checked));
+        Gen = 1;
+        Running = 0;
+        IdlePC = 0;
+        IdleG = 0;
+        IdleClean = false;
+        Steps = Wide = Serial = 0;
+    }
+
+    Lockstep(const Lockstep &) = delete;
+    Lockstep &operator=(const Lockstep &) = delete;
+
+    /** Memory Map *******************************************/
+    /** MapRam() maps Count pages from Page to Memory pages  **/
+    /** from At, which may be shared to mirror them.         **/
+    /*********************************************************/
+    void MapRam(int Page, int Count, int At) {
+        for (int N = 0; N < Count; N++) {
+            Map[Page + N] = MAP_RAM;
+            Pages[Page + N] = Memory[At + N].Rows;
+        }
+        Flush();
+    }
+
+    void MapIO(int Page, int Count) {
+        for (int N = 0; N < Count; N++) Map[Page + N] = MAP_IO;
+        Flush();
+    }
+
+    void Flush() {
+        if (++Gen == 0) {
+            std::memset(Checked, 0, sizeof(Checked));
+            Gen = 1;
+        }
+    }
+
+    /** Lanes ************************************************/
+    /** Unpack() copies a lane's registers into its M6502,   **/
+    /** Pack() copies them back.                             **/
+    /*********************************************************/
+    byte &Ram(int I, word Addr) { return Pages[Addr >> 8][(Addr & 0xFF) * Lanes + I]; }
+
+    void Unpack(int I) {
+        M6502 &R = L[I].R;
+        R.A = A[I]; R.X = X[I]; R.Y = Y[I]; R.P = P[I]; R.S = S[I];
+        R.PC.W = PC[I];
+        R.ICount = ICount[I];
+    }
+
+    void Pack(int I) {
+        const M6502 &R = L[I].R;
+        A[I] = R.A; X[I] = R.X; Y[I] = R.Y; P[I] = R.P; S[I] = R.S;
+        PC[I] = R.PC.W;
+        ICount[I] = R.ICount;
+    }
+
+    byte Op(int I, word Addr) { return Map[Addr >> 8] == MAP_RAM ? Ram(I, Addr) : L[I].R.Page[Addr >> 8][Addr & 0xFF]; }
+
+    byte Rd(int I, word Addr) {
+        switch (Map[Addr >> 8]) {
+            case MAP_RAM: return Ram(I, Addr);
+            case MAP_ROM: return L[I].R.Page[Addr >> 8][Addr & 0xFF];
+            default: return IO::Rd(&L[I].R, I, Addr);
+        }
+    }
+
+    void Wr(int I, word Addr, byte Value) {
+        if (Map[Addr >> 8] == MAP_RAM) Ram(I, Addr) = Value;
+        else { IO::Wr(&L[I].R, I, Addr, Value); Flush(); }
+    }
+
+    /* Same, from vector handlers, which keep ICount out of R */
+    byte RdLane(int I, word Addr) {
+        if (Map[Addr >> 8] != MAP_IO) return Rd(I, Addr);
+        L[I].R.ICount = ICount[I];
+        byte Value = IO::Rd(&L[I].R, I, Addr);
+        ICount[I] = L[I].R.ICount;
+        return Value;
+    }
+
+    void WrLane(int I, word Addr, byte Value) {
+        if (Map[Addr >> 8] == MAP_RAM) { Ram(I, Addr) = Value; return; }
+        L[I].R.ICount = ICount[I];
+        Wr(I, Addr, Value);
+        ICount[I] = L[I].R.ICount;
+    }
+
+    /** Reset/Int/Run ****************************************/
+    /** Run() runs every lane until its Loop() returns       **/
+    /** INT_QUIT, exactly as Run6502() would on its own.     **/
+    /*********************************************************/
+    void Reset() {
+        for (int I = 0; I < Lanes; I++) {
+            Unpack(I);
+            Scalar::Reset(&L[I].R);
+            Pack(I);
+        }
+        Flush();
+    }
+
+    void Int(int I, byte Type) {
+        Unpack(I);
+        Scalar::Int(&L[I].R, Type);
+        Pack(I);
+    }
+
+    void Run() {
+        unsigned Group = 0;
+        word Lead = 0;
+
+        for (Running = All; Running;) {
+            /* Lanes that joined Lead stay with it, a split regroups */
+            /* at the lowest PC so that the others can catch up      */
+            unsigned Same = AtPC(Lead) & Running;
+            if (!Same || (Group & Running & ~Same)) {
+                Lead = Lowest(Running);
+                Same = AtPC(Lead) & Running;
+            }
+            Group = Same;
+
+            Step(Group, Lead);
+            Idle(Group, Lead);
+
+            for (unsigned Out = OutOfCycles() & Group; Out; Out &= Out - 1) {
+                int I = std::countr_zero(Out);
+                if (!Expire(I)) Running &= ~(1u << I);
+            }
+        }
+    }
+
+    /* Like Core::RunIdle(), a group that jumps back to where */
+    /* it jumped a pass ago, with the same registers and no   */
+    /* writes or volatile reads in between, skips the passes  */
+    /* left in the slice                                      */
+    void Idle(unsigned G, word From) {
+        const word To = PC[First(G)];
+        if (To >= From || (AtPC(To) & G) != G) return;
+
+        if (To == IdlePC && G == IdleG && IdleClean) {
+            const byte *Now[5] = {A, X, Y, S, P};
+            unsigned Same = G;
+            for (int N = 0; N < 5; N++) Same &= _mm_movemask_epi8(_mm_cmpeq_epi8(Load(Now[N]), Load(IdleRegs[N])));
+            if (Same == G) {
+                for (; G; G &= G - 1) {
+                    int I = std::countr_zero(G), Pass = IdleCount[I] - ICount[I];
+                    if (Pass <= 0 || ICount[I] <= Pass) continue;
+                    int Skip = (ICount[I] - 1) / Pass * Pass;
+                    ICount[I] -= Skip;
+                    L[I].R.ISkipped += Skip;
+                }
+                G = IdleG;
+            }
+        }
+
+        IdlePC = To;
+        IdleG = G;
+        IdleClean = true;
+        std::memcpy(IdleRegs[0], A, Lanes);
+        std::memcpy(IdleRegs[1], X, Lanes);
+        std::memcpy(IdleRegs[2], Y, Lanes);
+        std::memcpy(IdleRegs[3], S, Lanes);
+        std::memcpy(IdleRegs[4], P, Lanes);
+        std::memcpy(IdleCount, ICount, sizeof(ICount));
+    }
+
+    /* Ends a lane's slice like Core::Expire() */
+    bool Expire(int I) {
+        M6502 &R = L[I].R;
+        byte Type;
+
+        Unpack(I);
+        if (R.AfterCLI) {
+            Type = R.IRequest;
+            R.ICount += R.IBackup - 1;
+            R.AfterCLI = 0;
+        } else {
+            Type = IO::Loop(&R, I);
+            R.ICount = R.IPeriod;
+            Flush();
+        }
+        if (Type != INT_QUIT && Type) Scalar::Int(&R, Type);
+        Pack(I);
+        return Type != INT_QUIT;
+    }
+
+    /** Stepping *********************************************/
+    word Lowest(unsigned G) const {
+        word Min = 0xFFFF;
+        for (; G; G &= G - 1) if (PC[std::countr_zero(G)] < Min) Min = PC[std::countr_zero(G)];
+        return Min;
+    }
+
+    unsigned AtPC(word Addr) const {
+        const V *W = reinterpret_cast<const V *>(PC);
+        const V K = _mm_set1_epi16((short) Addr);
+        return _mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(W[0], K), _mm_cmpeq_epi16(W[1], K)));
+    }
+
+    unsigned OutOfCycles() const {
+        const V *C = reinterpret_cast<const V *>(ICount);
+        const V One = _mm_set1_epi32(1);
+        const V Lo = _mm_packs_epi32(_mm_cmpgt_epi32(One, C[0]), _mm_cmpgt_epi32(One, C[1]));
+        const V Hi = _mm_packs_epi32(_mm_cmpgt_epi32(One, C[2]), _mm_cmpgt_epi32(One, C[3]));
+        return _mm_movemask_epi8(_mm_packs_epi16(Lo, Hi));
+    }
+
+    /* Page Addr is in, if it holds the same code in every lane */
+    const byte *Shared(word Addr) {
+        const int N = Addr >> 8;
+        if (Checked[N] != Gen) {
+            const byte *Page = Map[N] == MAP_RAM ? nullptr : L[0].R.Page[N];
+            for (int I = 1; I < Lanes && Page; I++) {
+                if (L[I].R.Page[N] != Page) Page = nullptr;
+            }
+            Code[N] = Page;
+            Checked[N] = Gen;
+        }
+        return Code[N];
+    }
+
+    void Single(int I) {
+        Unpack(I);
+        Scalar::Singles[Op(I, PC[I])](&L[I].R);
+        Pack(I);
+    }
+
+    void Singles(unsigned G) {
+        IdleClean = false;
+        Serial += std::popcount(G);
+        for (; G; G &= G - 1) Single(std::countr_zero(G));
+    }
+
+    void Step(unsigned G, word Addr) {
+        const byte *Page = Shared(Addr);
+        if (!Page) return Singles(G);
+
+        const byte Opcode = Page[Addr & 0xFF];
+        word O = 0;
+        if ((Addr & 0xFF) + Operands[Opcode] <= 0xFF) {
+            if (Operands[Opcode] == 2) O = Page[(Addr & 0xFF) + 1] | Page[(Addr & 0xFF) + 2] << 8;
+            else if (Operands[Opcode]) O = Page[(Addr & 0xFF) + 1];
+        } else {
+            for (int N = 1; N <= Operands[Opcode]; N++) {
+                const byte *Next = Shared(Addr + N);
+                if (!Next) return Singles(G);
+                O |= Next[(Addr + N) & 0xFF] << (8 * (N - 1));
+            }
+        }
+
+        Steps++;
+        Wide += std::popcount(G);
+        if ((Kinds[Opcode] & MEM_WRITE) || ReadsVolatile(&L[0].R, Opcode, O)) IdleClean = false;
+        Vectors[Opcode](*this, G, Addr, O);
+    }
+
+    /** Vector Helpers ***************************************/
+    static V Splat(int Value) { return _mm_set1_epi8((char) Value); }
+    static V Load(const byte *Rg) { return _mm_load_si128(reinterpret_cast<const V *>(Rg)); }
+    static void Store(byte *Rg, V Value) { _mm_store_si128(reinterpret_cast<V *>(Rg), Value); }
+    static V Blend(V Old, V New, V M) { return _mm_or_si128(_mm_and_si128(M, New), _mm_andnot_si128(M, Old)); }
+    static void Put(byte *Rg, V Value, V M) { Store(Rg, Blend(Load(Rg), Value, M)); }
+
+    /* 0xFF in the lanes set in G */
+    static V Mask(unsigned G) {
+        const V Bits = _mm_set_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+        const V B = _mm_set_epi64x((long long) ((G >> 8) * 0x0101010101010101ull), (long long) ((G & 0xFF) * 0x0101010101010101ull));
+        return _mm_cmpeq_epi8(_mm_and_si128(B, Bits), Bits);
+    }
+
+    /* Unsigned X < Y */
+    static V Below(V X, V Y) { return _mm_andnot_si128(_mm_cmpeq_epi8(_mm_max_epu8(X, Y), X), Splat(0xFF)); }
+
+    static V NZ(V Value) {
+        const V Zero = _mm_cmpeq_epi8(Value, _mm_setzero_si128());
+        return _mm_or_si128(_mm_and_si128(Value, Splat(N_FLAG)), _mm_and_si128(Zero, Splat(Z_FLAG)));
+    }
+
+    /* Replaces the Clear bits of P with F in M lanes */
+    void Flags(V M, byte Clear, V F) {
+        const V Old = Load(P);
+        Store(P, Blend(Old, _mm_or_si128(_mm_andnot_si128(Splat(Clear), Old), F), M));
+    }
+
+    bool Any(unsigned G, byte Flag) const {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(Load(P), Splat(Flag)), Splat(Flag))) & G;
+    }
+
+    V Row(word Addr) const { return _mm_load_si128(reinterpret_cast<const V *>(Pages[Addr >> 8] + (Addr & 0xFF) * Lanes)); }
+    void PutRow(word Addr, V Value, V M) { Put(Pages[Addr >> 8] + (Addr & 0xFF) * Lanes, Value, M); }
+
+    /* Sets PC in M lanes and charges them Cycles */
+    void Advance(V M, word Next, int Cycles) {
+        V *W = reinterpret_cast<V *>(PC);
+        V *C = reinterpret_cast<V *>(ICount);
+        const V M0 = _mm_unpacklo_epi8(M, M), M1 = _mm_unpackhi_epi8(M, M);
+        const V K = _mm_set1_epi16((short) Next), N = _mm_set1_epi32(Cycles);
+        W[0] = Blend(W[0], K, M0);
+        W[1] = Blend(W[1], K, M1);
+        C[0] = _mm_sub_epi32(C[0], _mm_and_si128(_mm_unpacklo_epi16(M0, M0), N));
+        C[1] = _mm_sub_epi32(C[1], _mm_and_si128(_mm_unpackhi_epi16(M0, M0), N));
+        C[2] = _mm_sub_epi32(C[2], _mm_and_si128(_mm_unpacklo_epi16(M1, M1), N));
+        C[3] = _mm_sub_epi32(C[3], _mm_and_si128(_mm_unpackhi_epi16(M1, M1), N));
+    }
+
+    /* Adds Offset to PC and a cycle in T lanes, like JR() */
+    void Branch(V T, offset Offset) {
+        V *W = reinterpret_cast<V *>(PC);
+        V *C = reinterpret_cast<V *>(ICount);
+        const V T0 = _mm_unpacklo_epi8(T, T), T1 = _mm_unpackhi_epi8(T, T);
+        const V K = _mm_set1_epi16(Offset), One = _mm_set1_epi32(1);
+        W[0] = _mm_add_epi16(W[0], _mm_and_si128(T0, K));
+        W[1] = _mm_add_epi16(W[1], _mm_and_si128(T1, K));
+        C[0] = _mm_sub_epi32(C[0], _mm_and_si128(_mm_unpacklo_epi16(T0, T0), One));
+        C[1] = _mm_sub_epi32(C[1], _mm_and_si128(_mm_unpackhi_epi16(T0, T0), One));
+        C[2] = _mm_sub_epi32(C[2], _mm_and_si128(_mm_unpacklo_epi16(T1, T1), One));
+        C[3] = _mm_sub_epi32(C[3], _mm_and_si128(_mm_unpackhi_epi16(T1, T1), One));
+    }
+
+    /* Sets PC in M lanes to the words made of Lo and Hi */
+    void Jump(V M, V Lo, V Hi, short Delta) {
+        V *W = reinterpret_cast<V *>(PC);
+        const V K = _mm_set1_epi16(Delta);
+        W[0] = Blend(W[0], _mm_add_epi16(_mm_unpacklo_epi8(Lo, Hi), K), _mm_unpacklo_epi8(M, M));
+        W[1] = Blend(W[1], _mm_add_epi16(_mm_unpackhi_epi8(Lo, Hi), K), _mm_unpackhi_epi8(M, M));
+    }
+
+    static int First(unsigned G) { return std::countr_zero(G) & (Lanes - 1); }
+
+    /* True if Rg is the same in all G lanes */
+    static bool Flat(unsigned G, const byte *Rg) {
+        return (_mm_movemask_epi8(_mm_cmpeq_epi8(Load(Rg), Splat(Rg[First(G)]))) & G) == G;
+    }
+
+    /* Pointer at K in zero page if all G lanes have the same */
+    bool Pointer(unsigned G, word K, word &Addr) const {
+        const byte *Lo = &Pages[K >> 8][(K & 0xFF) * Lanes];
+        const byte *Hi = &Pages[(K + 1) >> 8][((K + 1) & 0xFF) * Lanes];
+        if (!Flat(G, Lo) || !Flat(G, Hi)) return false;
+        Addr = Lo[First(G)] | Hi[First(G)] << 8;
+        return true;
+    }
+
+    void Push(unsigned G, V M, V Value) {
+        if (Flat(G, S)) {
+            PutRow(0x0100 | S[First(G)], Value, M);
+            Put(S, _mm_sub_epi8(Load(S), Splat(1)), M);
+            return;
+        }
+        alignas(16) byte T[Lanes];
+        Store(T, Value);
+        for (; G; G &= G - 1) {
+            int I = std::countr_zero(G);
+            Ram(I, 0x0100 | S[I]--) = T[I];
+        }
+    }
+
+    V Pop(unsigned G, V M) {
+        if (Flat(G, S)) {
+            Put(S, _mm_add_epi8(Load(S), Splat(1)), M);
+            return Row(0x0100 | S[First(G)]);
+        }
+        alignas(16) byte T[Lanes] = {};
+        for (; G; G &= G - 1) {
+            int I = std::countr_zero(G);
+            T[I] = Ram(I, 0x0100 | ++S[I]);
+        }
+        return Load(T);
+    }
+
+    /** Addressing Modes *************************************/
+    /** Rd()/Wr() access the operand in every M lane. Zero   **/
+    /** page and absolute addresses are the same in all of   **/
+    /** them, so RAM there is one row. Indexed and indirect  **/
+    /** modes are too when Same() finds the index registers  **/
+    /** and pointers equal, or go lane by lane through EA(). **/
+    /*********************************************************/
+    struct Imm {
+        static V Rd(Lockstep &, unsigned, V, word O) { return Splat(O); }
+    };
+
+    struct Acc {
+        static V Rd(Lockstep &E, unsigned, V, word) { return Load(E.A); }
+        static void Wr(Lockstep &E, unsigned, V M, word, V Value) { Put(E.A, Value, M); }
+    };
+
+    struct Zp {
+        static V Rd(Lockstep &E, unsigned, V, word O) { return E.Row((byte) O); }
+        static void Wr(Lockstep &E, unsigned, V M, word O, V Value) { E.PutRow((byte) O, Value, M); }
+    };
+
+    struct Ab {
+        static V Rd(Lockstep &E, unsigned G, V, word O) {
+            if (E.Map[O >> 8] == MAP_RAM) return E.Row(O);
+            alignas(16) byte T[Lanes] = {};
+            for (; G; G &= G - 1) T[std::countr_zero(G)] = E.RdLane(std::countr_zero(G), O);
+            return Load(T);
+        }
+
+        static void Wr(Lockstep &E, unsigned G, V M, word O, V Value) {
+            if (E.Map[O >> 8] == MAP_RAM) return E.PutRow(O, Value, M);
+            alignas(16) byte T[Lanes];
+            Store(T, Value);
+            for (; G; G &= G - 1) E.WrLane(std::countr_zero(G), O, T[std::countr_zero(G)]);
+        }
+    };
+
+    template<class Mode, bool ZeroPage>
+    struct Lanewise {
+        static V Rd(Lockstep &E, unsigned G, V M, word O) {
+            word Addr;
+            if (Mode::Same(E, G, O, Addr)) return Ab::Rd(E, G, M, Addr);
+            alignas(16) byte T[Lanes] = {};
+            for (; G; G &= G - 1) {
+                int I = std::countr_zero(G);
+                T[I] = ZeroPage ? E.Ram(I, Mode::EA(E, I, O)) : E.RdLane(I, Mode::EA(E, I, O));
+            }
+            return Load(T);
+        }
+
+        static void Wr(Lockstep &E, unsigned G, V M, word O, V Value) {
+            word Addr;
+            if (Mode::Same(E, G, O, Addr)) return Ab::Wr(E, G, M, Addr, Value);
+            alignas(16) byte T[Lanes];
+            Store(T, Value);
+            for (; G; G &= G - 1) {
+                int I = std::countr_zero(G);
+                if (ZeroPage) E.Ram(I, Mode::EA(E, I, O)) = T[I];
+                else E.WrLane(I, Mode::EA(E, I, O), T[I]);
+            }
+        }
+    };
+
+    struct Zx : Lanewise<Zx, true> {
+        static word EA(Lockstep &E, int I, word O) { return (byte) (O + E.X[I]); }
+        static bool Same(Lockstep &E, unsigned G, word O, word &Addr) {
+            Addr = EA(E, First(G), O);
+            return Flat(G, E.X);
+        }
+    };
+
+    struct Zy : Lanewise<Zy, true> {
+        static word EA(Lockstep &E, int I, word O) { return (byte) (O + E.Y[I]); }
+        static bool Same(Lockstep &E, unsigned G, word O, word &Addr) {
+            Addr = EA(E, First(G), O);
+            return Flat(G, E.Y);
+        }
+    };
+
+    struct Ax : Lanewise<Ax, false> {
+        static word EA(Lockstep &E, int I, word O) { return O + E.X[I]; }
+        static bool Same(Lockstep &E, unsigned G, word O, word &Addr) {
+            Addr = EA(E, First(G), O);
+            return Flat(G, E.X);
+        }
+    };
+
+    struct Ay : Lanewise<Ay, false> {
+        static word EA(Lockstep &E, int I, word O) { return O + E.Y[I]; }
+        static bool Same(Lockstep &E, unsigned G, word O, word &Addr) {
+            Addr = EA(E, First(G), O);
+            return Flat(G, E.Y);
+        }
+    };
+
+    struct Ix : Lanewise<Ix, false> {
+        static word EA(Lockstep &E, int I, word O) {
+            word K = (byte) (O + E.X[I]);
+            return E.Op(I, K) | E.Op(I, K + 1) << 8;
+        }
+        static bool Same(Lockstep &E, unsigned G, word O, word &Addr) {
+            return Flat(G, E.X) && E.Pointer(G, (byte) (O + E.X[First(G)]), Addr);
+        }
+    };
+
+    struct Izp : Lanewise<Izp, false> {
+        static word EA(Lockstep &E, int I, word O) { return E.Op(I, O) | E.Op(I, O + 1) << 8; }
+        static bool Same(Lockstep &E, unsigned G, word O, word &Addr) { return E.Pointer(G, O, Addr); }
+    };
+
+    struct Iy : Lanewise<Iy, false> {
+        static word EA(Lockstep &E, int I, word O) { return Izp::EA(E, I, O) + E.Y[I]; }
+        static bool Same(Lockstep &E, unsigned G, word O, word &Addr) {
+            if (!Flat(G, E.Y) || !E.Pointer(G, O, Addr)) return false;
+            Addr += E.Y[First(G)];
+            return true;
+        }
+    };
+
+    /** Operations *******************************************/
+    /** Same as in Core.hpp, on M lanes at once. PC and      **/
+    /** ICount are already advanced past the instruction.    **/
+    /*********************************************************/
+    using Handler = void (*)(Lockstep &E, unsigned G, V M, word Next, word O);
+
+    template<Reg Rg, class Mode>
+    static void LD(Lockstep &E, unsigned G, V M, word, word O) {
+        const V Value = Mode::Rd(E, G, M, O);
+        Put(E.*Rg, Value, M);
+        E.Flags(M, N_FLAG | Z_FLAG, NZ(Value));
+    }
+
+    template<Reg Rg, class Mode>
+    static void ST(Lockstep &E, unsigned G, V M, word, word O) { Mode::Wr(E, G, M, O, Load(E.*Rg)); }
+
+    template<class Mode>
+    static void STZ(Lockstep &E, unsigned G, V M, word, word O) { Mode::Wr(E, G, M, O, _mm_setzero_si128()); }
+
+    template<class Mode>
+    static void ORA(Lockstep &E, unsigned G, V M, word, word O) {
+        const V Value = _mm_or_si128(Load(E.A), Mode::Rd(E, G, M, O));
+        Put(E.A, Value, M);
+        E.Flags(M, N_FLAG | Z_FLAG, NZ(Value));
+    }
+
+    template<class Mode>
+    static void AND(Lockstep &E, unsigned G, V M, word, word O) {
+        const V Value = _mm_and_si128(Load(E.A), Mode::Rd(E, G, M, O));
+        Put(E.A, Value, M);
+        E.Flags(M, N_FLAG | Z_FLAG, NZ(Value));
+    }
+
+    template<class Mode>
+    static void EOR(Lockstep &E, unsigned G, V M, word, word O) {
+        const V Value = _mm_xor_si128(Load(E.A), Mode::Rd(E, G, M, O));
+        Put(E.A, Value, M);
+        E.Flags(M, N_FLAG | Z_FLAG, NZ(Value));
+    }
+
+    template<class Mode>
+    static void BIT(Lockstep &E, unsigned G, V M, word, word O) {
+        const V Value = Mode::Rd(E, G, M, O);
+        const V Zero = _mm_cmpeq_epi8(_mm_and_si128(Value, Load(E.A)), _mm_setzero_si128());
+        E.Flags(M, N_FLAG | V_FLAG | Z_FLAG,
+                _mm_or_si128(_mm_and_si128(Value, Splat(N_FLAG | V_FLAG)), _mm_and_si128(Zero, Splat(Z_FLAG))));
+    }
+
+    template<Reg Rg, class Mode>
+    static void CMP(Lockstep &E, unsigned G, V M, word, word O) {
+        const V Value = Mode::Rd(E, G, M, O), Rv = Load(E.*Rg);
+        const V Carry = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(Rv, Value), Rv), Splat(C_FLAG));
+        E.Flags(M, N_FLAG | Z_FLAG | C_FLAG, _mm_or_si128(NZ(_mm_sub_epi8(Rv, Value)), Carry));
+    }
+
+    /* Binary ADC of Value, SBC being ADC of ~Value */
+    static void Add(Lockstep &E, V M, V Value) {
+        const V Av = Load(E.A);
+        const V Sum = _mm_add_epi8(Av, Value);
+        const V Result = _mm_add_epi8(Sum, _mm_and_si128(Load(E.P), Splat(C_FLAG)));
+        const V Carry = _mm_and_si128(_mm_or_si128(Below(Sum, Av), Below(Result, Sum)), Splat(C_FLAG));
+        const V Sign = _mm_and_si128(_mm_xor_si128(Av, Result), _mm_xor_si128(Value, Result));
+        const V Over = _mm_and_si128(_mm_srli_epi16(Sign, 1), Splat(V_FLAG));
+        Put(E.A, Result, M);
+        E.Flags(M, N_FLAG | Z_FLAG | C_FLAG | V_FLAG, _mm_or_si128(NZ(Result), _mm_or_si128(Carry, Over)));
+    }
+
+    template<class Mode>
+    static void ADC(Lockstep &E, unsigned G, V M, word, word O) { Add(E, M, Mode::Rd(E, G, M, O)); }
+
+    template<class Mode>
+    static void SBC(Lockstep &E, unsigned G, V M, word, word O) { Add(E, M, _mm_xor_si128(Mode::Rd(E, G, M, O), Splat(0xFF))); }
+
+    /* Read-modify-write operations return the result and C */
+    struct ASL {
+        static V Do(Lockstep &, V Value, V &Carry) {
+            Carry = _mm_and_si128(_mm_srli_epi16(Value, 7), Splat(C_FLAG));
+            return _mm_add_epi8(Value, Value);
+        }
+    };
+
+    struct LSR {
+        static V Do(Lockstep &, V Value, V &Carry) {
+            Carry = _mm_and_si128(Value, Splat(C_FLAG));
+            return _mm_and_si128(_mm_srli_epi16(Value, 1), Splat(0x7F));
+        }
+    };
+
+    struct ROL {
+        static V Do(Lockstep &E, V Value, V &Carry) {
+            Carry = _mm_and_si128(_mm_srli_epi16(Value, 7), Splat(C_FLAG));
+            return _mm_or_si128(_mm_add_epi8(Value, Value), _mm_and_si128(Load(E.P), Splat(C_FLAG)));
+        }
+    };
+
+    struct ROR {
+        static V Do(Lockstep &E, V Value, V &Carry) {
+            const V In = _mm_and_si128(_mm_slli_epi16(_mm_and_si128(Load(E.P), Splat(C_FLAG)), 7), Splat(0x80));
+            Carry = _mm_and_si128(Value, Splat(C_FLAG));
+            return _mm_or_si128(_mm_and_si128(_mm_srli_epi16(Value, 1), Splat(0x7F)), In);
+        }
+    };
+
+    struct INC {
+        static constexpr bool Keeps = true; /* Leaves C alone */
+        static V Do(Lockstep &, V Value, V &) { return _mm_add_epi8(Value, Splat(1)); }
+    };
+
+    struct DEC {
+        static constexpr bool Keeps = true;
+        static V Do(Lockstep &, V Value, V &) { return _mm_sub_epi8(Value, Splat(1)); }
+    };
+
+    template<class Fn, class Mode>
+    static void RMW(Lockstep &E, unsigned G, V M, word, word O) {
+        V Carry = _mm_setzero_si128();
+        const V Value = Fn::Do(E, Mode::Rd(E, G, M, O), Carry);
+        Mode::Wr(E, G, M, O, Value);
+        if constexpr (requires { Fn::Keeps; }) E.Flags(M, N_FLAG | Z_FLAG, NZ(Value));
+        else E.Flags(M, N_FLAG | Z_FLAG | C_FLAG, _mm_or_si128(NZ(Value), Carry));
+    }
+
+    template<Reg From, Reg To>
+    static void T(Lockstep &E, unsigned, V M, word, word) {
+        const V Value = Load(E.*From);
+        Put(E.*To, Value, M);
+        E.Flags(M, N_FLAG | Z_FLAG, NZ(Value));
+    }
+
+    static void TXS(Lockstep &E, unsigned, V M, word, word) { Put(E.S, Load(E.X), M); }
+
+    template<Reg Rg, int Delta>
+    static void IN(Lockstep &E, unsigned, V M, word, word) {
+        const V Value = _mm_add_epi8(Load(E.*Rg), Splat(Delta));
+        Put(E.*Rg, Value, M);
+        E.Flags(M, N_FLAG | Z_FLAG, NZ(Value));
+    }
+
+    template<byte Flag>
+    static void SE(Lockstep &E, unsigned, V M, word, word) { E.Flags(M, 0, Splat(Flag)); }
+
+    template<byte Flag>
+    static void CL(Lockstep &E, unsigned, V M, word, word) { E.Flags(M, Flag, _mm_setzero_si128()); }
+
+    template<byte Flag, bool Set>
+    static void BR(Lockstep &E, unsigned, V M, word, word O) {
+        const V Bit = _mm_and_si128(Load(E.P), Splat(Flag));
+        const V Taken = _mm_cmpeq_epi8(Bit, Set ? Splat(Flag) : _mm_setzero_si128());
+        E.Branch(_mm_and_si128(Taken, M), (offset) O);
+    }
+
+    static void BRA(Lockstep &E, unsigned, V M, word, word O) { E.Branch(M, (offset) O); }
+
+    template<Reg Rg>
+    static void PH(Lockstep &E, unsigned G, V M, word, word) { E.Push(G, M, Load(E.*Rg)); }
+
+    template<Reg Rg>
+    static void PL(Lockstep &E, unsigned G, V M, word, word) {
+        const V Value = E.Pop(G, M);
+        Put(E.*Rg, Value, M);
+        E.Flags(M, N_FLAG | Z_FLAG, NZ(Value));
+    }
+
+    /* Pushes the address of the last operand byte */
+    static void JSR(Lockstep &E, unsigned G, V M, word Next, word O) {
+        E.Push(G, M, Splat((Next - 1) >> 8));
+        E.Push(G, M, Splat((Next - 1) & 0xFF));
+        E.Jump(M, Splat(O & 0xFF), Splat(O >> 8), 0);
+    }
+
+    static void RTS(Lockstep &E, unsigned G, V M, word, word) {
+        const V Lo = E.Pop(G, M);
+        const V Hi = E.Pop(G, M);
+        E.Jump(M, Lo, Hi, 1);
+    }
+
+    static void JMP(Lockstep &E, unsigned, V M, word, word O) { E.Jump(M, Splat(O & 0xFF), Splat(O >> 8), 0); }
+
+    static void NOP(Lockstep &, unsigned, V, word, word) {}
+
+    /** Opcode Table *****************************************/
+    /** 0 runs the instruction through Core one lane at a    **/
+    /** time: BRK, RTI, PLP, CLI, TSB, TRB, JMP (a), JMP (a,X) **/
+    /*********************************************************/
+    static constexpr Reg RA = &Lockstep::A, RX = &Lockstep::X, RY = &Lockstep::Y, RS = &Lockstep::S, RP = &Lockstep::P;
+
+    static constexpr Handler Ops[256] = {
+        /* 0x00 */ 0, ORA<Ix>, NOP, NOP, 0, ORA<Zp>, RMW<ASL, Zp>, NOP,
+        /* 0x08 */ PH<RP>, ORA<Imm>, RMW<ASL, Acc>, NOP, 0, ORA<Ab>, RMW<ASL, Ab>, NOP,
+        /* 0x10 */ BR<N_FLAG, false>, ORA<Iy>, ORA<Izp>, NOP, 0, ORA<Zx>, RMW<ASL, Zx>, NOP,
+        /* 0x18 */ CL<C_FLAG>, ORA<Ay>, IN<RA, 1>, NOP, 0, ORA<Ax>, RMW<ASL, Ax>, NOP,
+        /* 0x20 */ JSR, AND<Ix>, NOP, NOP, BIT<Zp>, AND<Zp>, RMW<ROL, Zp>, NOP,
+        /* 0x28 */ 0, AND<Imm>, RMW<ROL, Acc>, NOP, BIT<Ab>, AND<Ab>, RMW<ROL, Ab>, NOP,
+        /* 0x30 */ BR<N_FLAG, true>, AND<Iy>, AND<Izp>, NOP, BIT<Zx>, AND<Zx>, RMW<ROL, Zx>, NOP,
+        /* 0x38 */ SE<C_FLAG>, AND<Ay>, IN<RA, -1>, NOP, BIT<Ax>, AND<Ax>, RMW<ROL, Ax>, NOP,
+        /* 0x40 */ 0, EOR<Ix>, NOP, NOP, NOP, EOR<Zp>, RMW<LSR, Zp>, NOP,
+        /* 0x48 */ PH<RA>, EOR<Imm>, RMW<LSR, Acc>, NOP, JMP, EOR<Ab>, RMW<LSR, Ab>, NOP,
+        /* 0x50 */ BR<V_FLAG, false>, EOR<Iy>, EOR<Izp>, NOP, NOP, EOR<Zx>, RMW<LSR, Zx>, NOP,
+        /* 0x58 */ 0, EOR<Ay>, PH<RY>, NOP, NOP, EOR<Ax>, RMW<LSR, Ax>, NOP,
+        /* 0x60 */ RTS, ADC<Ix>, NOP, NOP, STZ<Zp>, ADC<Zp>, RMW<ROR, Zp>, NOP,
+        /* 0x68 */ PL<RA>, ADC<Imm>, RMW<ROR, Acc>, NOP, 0, ADC<Ab>, RMW<ROR, Ab>, NOP,
+        /* 0x70 */ BR<V_FLAG, true>, ADC<Iy>, ADC<Izp>, NOP, STZ<Zx>, ADC<Zx>, RMW<ROR, Zx>, NOP,
+        /* 0x78 */ SE<I_FLAG>, ADC<Ay>, PL<RY>, NOP, 0, ADC<Ax>, RMW<ROR, Ax>, NOP,
+        /* 0x80 */ BRA, ST<RA, Ix>, NOP, NOP, ST<RY, Zp>, ST<RA, Zp>, ST<RX, Zp>, NOP,
+        /* 0x88 */ IN<RY, -1>, BIT<Imm>, T<RX, RA>, NOP, ST<RY, Ab>, ST<RA, Ab>, ST<RX, Ab>, NOP,
+        /* 0x90 */ BR<C_FLAG, false>, ST<RA, Iy>, ST<RA, Izp>, NOP, ST<RY, Zx>, ST<RA, Zx>, ST<RX, Zy>, NOP,
+        /* 0x98 */ T<RY, RA>, ST<RA, Ay>, TXS, NOP, STZ<Ab>, ST<RA, Ax>, STZ<Ax>, NOP,
+        /* 0xA0 */ LD<RY, Imm>, LD<RA, Ix>, LD<RX, Imm>, NOP, LD<RY, Zp>, LD<RA, Zp>, LD<RX, Zp>, NOP,
+        /* 0xA8 */ T<RA, RY>, LD<RA, Imm>, T<RA, RX>, NOP, LD<RY, Ab>, LD<RA, Ab>, LD<RX, Ab>, NOP,
+        /* 0xB0 */ BR<C_FLAG, true>, LD<RA, Iy>, LD<RA, Izp>, NOP, LD<RY, Zx>, LD<RA, Zx>, LD<RX, Zy>, NOP,
+        /* 0xB8 */ CL<V_FLAG>, LD<RA, Ay>, T<RS, RX>, NOP, LD<RY, Ax>, LD<RA, Ax>, LD<RX, Ay>, NOP,
+        /* 0xC0 */ CMP<RY, Imm>, CMP<RA, Ix>, NOP, NOP, CMP<RY, Zp>, CMP<RA, Zp>, RMW<DEC, Zp>, NOP,
+        /* 0xC8 */ IN<RY, 1>, CMP<RA, Imm>, IN<RX, -1>, NOP, CMP<RY, Ab>, CMP<RA, Ab>, RMW<DEC, Ab>, NOP,
+        /* 0xD0 */ BR<Z_FLAG, false>, CMP<RA, Iy>, CMP<RA, Izp>, NOP, NOP, CMP<RA, Zx>, RMW<DEC, Zx>, NOP,
+        /* 0xD8 */ CL<D_FLAG>, CMP<RA, Ay>, PH<RX>, NOP, NOP, CMP<RA, Ax>, RMW<DEC, Ax>, NOP,
+        /* 0xE0 */ CMP<RX, Imm>, SBC<Ix>, NOP, NOP, CMP<RX, Zp>, SBC<Zp>, RMW<INC, Zp>, NOP,
+        /* 0xE8 */ IN<RX, 1>, SBC<Imm>, NOP, NOP, CMP<RX, Ab>, SBC<Ab>, RMW<INC, Ab>, NOP,
+        /* 0xF0 */ BR<Z_FLAG, true>, SBC<Iy>, SBC<Izp>, NOP, NOP, SBC<Zx>, RMW<INC, Zx>, NOP,
+        /* 0xF8 */ SE<D_FLAG>, SBC<Ay>, PL<RX>, NOP, NOP, SBC<Ax>, RMW<INC, Ax>, NOP,
+    };
+
+    /* ADC and SBC, which go lane by lane in decimal mode */
+    static constexpr bool Decimal(int Opcode) {
+        return ((Opcode & 0xE0) == 0x60 || (Opcode & 0xE0) == 0xE0) && ((Opcode & 0x03) == 0x01 || (Opcode & 0x1F) == 0x12);
+    }
+
+    template<int Opcode>
+    static void Vector(Lockstep &E, unsigned G, word Addr, word O) {
+        constexpr Handler Op = Ops[Opcode];
+        if constexpr (Op == nullptr) {
+            E.Wide -= std::popcount(G);
+            E.Singles(G);
+        } else {
+            if constexpr (Decimal(Opcode)) {
+                if (E.Any(G, D_FLAG)) { E.Wide -= std::popcount(G); return E.Singles(G); }
+            }
+            const V M = Mask(G);
+            const word Next = Addr + 1 + Operands[Opcode];
+            E.Advance(M, Next, Cycles[Opcode]);
+            Op(E, G, M, Next, O);
+        }
+    }
+
+    using Step_t = void (*)(Lockstep &E, unsigned G, word Addr, word O);
+    template<int Opcode> struct VectorOf { static constexpr Step_t Value = Vector<Opcode>; };
+    static constexpr auto Vectors = Scalar::template MakeTable<Step_t, VectorOf>(std::make_index_sequence<256>());
+};
+
+} // namespace m6502
+
+#endif /* M6502_LOCKSTEP_HPP */
@@ -22,7 +22,25 @@
 #include "m6502.h"
 #include "tables.h"
 
-#define Op6502(A) Rd6502(A)
+/** Fast Memory Access ***************************************/
+/** With FAST_RDOP defined, opcodes and operands are read   **/
+/** straight through R->Page[] instead of calling Rd6502(). **/
+/** Zero page and stack are then assumed to be plain RAM    **/
+/** and are accessed through R->Page[0] and R->Page[1].     **/
+/*************************************************************/
+#ifdef FAST_RDOP
+static inline byte RdPage6502(M6502 *R, word A)
+{ return R->Page[A >> 8][A & 0xFF]; }
+#define Op6502(A)       RdPage6502(R,A)
+#define RdZP(A)         R->Page[0][(byte)(A)]
+#define WrZP(A,V)       R->Page[0][(byte)(A)]=V
+#define WrStack(A,V)    R->Page[1][(byte)(A)]=V
+#else
+#define Op6502(A)       Rd6502(A)
+#define RdZP(A)         Rd6502(A)
+#define WrZP(A,V)       Wr6502(A,V)
+#define WrStack(A,V)    Wr6502(A,V)
+#endif
 
 /* "Izp" added by uso. */
 
@@ -48,9 +66,9 @@
 /*************************************************************/
 #define MR_Ab(Rg)       MC_Ab(J);Rg=Rd6502(J.W)
 #define MR_Im(Rg)       Rg=Op6502(R->PC.W++)
-#define MR_Zp(Rg)       MC_Zp(J);Rg=Rd6502(J.W)
-#define MR_Zx(Rg)       MC_Zx(J);Rg=Rd6502(J.W)
-#define MR_Zy(Rg)       MC_Zy(J);Rg=Rd6502(J.W)
+#define MR_Zp(Rg)       MC_Zp(J);Rg=RdZP(J.W)
+#define MR_Zx(Rg)       MC_Zx(J);Rg=RdZP(J.W)
+#define MR_Zy(Rg)       MC_Zy(J);Rg=RdZP(J.W)
 #define MR_Ax(Rg)       MC_Ax(J);Rg=Rd6502(J.W)
 #define MR_Ay(Rg)       MC_Ay(J);Rg=Rd6502(J.W)
 #define MR_Ix(Rg)       MC_Ix(J);Rg=Rd6502(J.W)
@@ -61,9 +79,9 @@
 /** These macros calculate address and write to it.         **/
 /*************************************************************/
 #define MW_Ab(Rg)       MC_Ab(J);Wr6502(J.W,Rg)
-#define MW_Zp(Rg)       MC_Zp(J);Wr6502(J.W,Rg)
-#define MW_Zx(Rg)       MC_Zx(J);Wr6502(J.W,Rg)
-#define MW_Zy(Rg)       MC_Zy(J);Wr6502(J.W,Rg)
+#define MW_Zp(Rg)       MC_Zp(J);WrZP(J.W,Rg)
+#define MW_Zx(Rg)       MC_Zx(J);WrZP(J.W,Rg)
+#define MW_Zy(Rg)       MC_Zy(J);WrZP(J.W,Rg)
 #define MW_Ax(Rg)       MC_Ax(J);Wr6502(J.W,Rg)
 #define MW_Ay(Rg)       MC_Ay(J);Wr6502(J.W,Rg)
 #define MW_Ix(Rg)       MC_Ix(J);Wr6502(J.W,Rg)
@@ -74,8 +92,8 @@
 /** These macros calculate address and modify it.           **/
 /*************************************************************/
 #define MM_Ab(Cmd)      MC_Ab(J);I=Rd6502(J.W);Cmd(I);Wr6502(J.W,I)
-#define MM_Zp(Cmd)      MC_Zp(J);I=Rd6502(J.W);Cmd(I);Wr6502(J.W,I)
-#define MM_Zx(Cmd)      MC_Zx(J);I=Rd6502(J.W);Cmd(I);Wr6502(J.W,I)
+#define MM_Zp(Cmd)      MC_Zp(J);I=RdZP(J.W);Cmd(I);WrZP(J.W,I)
+#define MM_Zx(Cmd)      MC_Zx(J);I=RdZP(J.W);Cmd(I);WrZP(J.W,I)
 #define MM_Ax(Cmd)      MC_Ax(J);I=Rd6502(J.W);Cmd(I);Wr6502(J.W,I)
 
 /** Other Macros *********************************************/
@@ -84,7 +102,7 @@
 #define M_FL(Rg)        R->P=(R->P&~(Z_FLAG|N_FLAG))|ZNTable[Rg]
 #define M_LDWORD(Rg)    Rg.B.l=Op6502(R->PC.W++);Rg.B.h=Op6502(R->PC.W++)
 
-#define M_PUSH(Rg)      Wr6502(0x0100|R->S,Rg);R->S--
+#define M_PUSH(Rg)      WrStack(0x0100|R->S,Rg);R->S--
 #define M_POP(Rg)       R->S++;Rg=Op6502(0x0100|R->S)
 #define M_JR            R->PC.W+=(offset)Op6502(R->PC.W)+1;R->ICount--
 
@@ -245,6 +263,38 @@ void Int6502(M6502 *R, byte Type)
     }
 }
 
+/** Cache6502() **********************************************/
+/** This core has no block cache, so there is nothing to do **/
+/** here.                                                   **/
+/*************************************************************/
+void Cache6502(M6502 *R, const byte *Code, unsigned int Size)
+{
+}
+
+/** Jit6502() ************************************************/
+/** This core always interprets.                            **/
+/*************************************************************/
+int Jit6502(M6502 *R, int Mode)
+{
+    return(-1);
+}
+
+/** Watch6502()/Debug6502() **********************************/
+/** This core has no debugger. Watches are ignored, and     **/
+/** Debug6502() just runs until Loop6502() quits.           **/
+/*************************************************************/
+int Watch6502(M6502 *R, word A, int Kinds)
+{
+    return(0);
+}
+
+int Debug6502(M6502 *R, int Mode, word *Hit)
+{
+    Run6502(R);
+    if (Hit) *Hit = R->PC.W;
+    return(STOP_QUIT);
+}
+
 /** Run6502() ************************************************/
 /** This function will run 6502 code until Loop6502() call  **/
 /** returns INT_QUIT. It will return the PC at which        **/
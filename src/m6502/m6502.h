@@ -24,6 +24,27 @@ extern "C" {
 #define INT_NMI   2            /* Non-maskable interrupt     */
 #define INT_QUIT  3            /* Exit the emulation         */
 
+                               /* Jit6502() modes:           */
+#define JIT_OFF    0           /* Interpret everything       */
+#define JIT_ON     1           /* Compile hot ROM blocks     */
+#define JIT_VERIFY 2           /* Compile and check each op  */
+
+                               /* Watch6502() kinds:         */
+#define WATCH_EXEC  1          /* Stop before running Addr   */
+#define WATCH_READ  2          /* Stop after reading Addr    */
+#define WATCH_WRITE 4          /* Stop after writing Addr    */
+
+                               /* Debug6502() modes:         */
+#define DEBUG_RUN  0           /* Run until something stops  */
+#define DEBUG_STEP 1           /* Run one instruction        */
+#define DEBUG_OVER 2           /* Same, running JSR to RTS   */
+
+                               /* Debug6502() returns:       */
+#define STOP_QUIT  0           /* Loop6502() quit            */
+#define STOP_STEP  1           /* The step is done           */
+#define STOP_BREAK 2           /* Reached a WATCH_EXEC       */
+#define STOP_WATCH 3           /* Hit a WATCH_READ/WRITE     */
+
                                /* 6502 status flags:         */
 #define C_FLAG    0x01         /* 1: Carry occured           */
 #define Z_FLAG    0x02         /* 1: Result is zero          */
@@ -69,6 +90,22 @@ typedef struct
     byte IRequest;       /* Set to the INT_IRQ when pending IRQ */
     byte AfterCLI;       /* Private, don't touch                */
     int IBackup;         /* Private, don't touch                */
+    byte *Page[256];     /* Read pointers to 256-byte pages, as */
+                         /* used by Op6502() with FAST_RDOP     */
+    void *Cache;         /* Private, set up by Cache6502()      */
+    word NZ;             /* Private, N/Z result with LAZY_FLAGS */
+    int ISkipped;        /* Cycles skipped in idle loops, the   */
+                         /* caller may read and clear it        */
+    int IPending;        /* Cycles a cached block has taken off */
+                         /* ICount ahead of the instruction in  */
+                         /* progress, 0 outside blocks. Add it  */
+                         /* to ICount in Rd6502()/Wr6502() for  */
+                         /* exact timing                        */
+    byte Volatile[32];   /* Bit Page&7 of Volatile[Page>>3] is  */
+                         /* set for pages whose reads change by */
+                         /* themselves, eg. timers. Idle loops  */
+                         /* reading them are never skipped      */
+    void *Debug;         /* Private, set up by Watch6502()      */
     /* void *User; */    /* Arbitrary user data (ID,RAM*,etc.)  */
 } M6502;
 
@@ -93,12 +130,72 @@ void Int6502(register M6502 *R, register byte Type);
 /*************************************************************/
 word Run6502(register M6502 *R);
 
+/** Cache6502() **********************************************/
+/** This function tells Run6502() that Size bytes at Code   **/
+/** never change, so code mapped from there can be decoded  **/
+/** once and kept in a cache. Call it again after reloading **/
+/** Code, or with Size=0 to drop the cache. R->Cache must   **/
+/** be 0 before the first call. Cores without a cache       **/
+/** ignore it.                                              **/
+/*************************************************************/
+void Cache6502(register M6502 *R, const byte *Code, unsigned int Size);
+
+/** Jit6502() ************************************************/
+/** This function sets the JIT_* mode for the cache set up  **/
+/** by Cache6502(), which must be called first. Hot cached  **/
+/** blocks are then compiled to native code. In JIT_VERIFY  **/
+/** mode each compiled instruction is checked against the   **/
+/** interpreter, and mismatches are printed to stderr. It   **/
+/** returns the number of mismatches since the last call,   **/
+/** or -1 if there is no JIT and everything is interpreted. **/
+/*************************************************************/
+int Jit6502(register M6502 *R, int Mode);
+
+/** Watch6502() **********************************************/
+/** This function sets the WATCH_* kinds of accesses to     **/
+/** address A that stop Debug6502(), 0 clearing them, and   **/
+/** returns the kinds set before. Opcode, operand, stack    **/
+/** pull and pointer fetches are not watched. R->Debug must **/
+/** be 0 before the first call. Run6502() ignores watches.  **/
+/*************************************************************/
+int Watch6502(register M6502 *R, word A, int Kinds);
+
+/** Debug6502() **********************************************/
+/** This function runs 6502 code like Run6502(), through a  **/
+/** separate build of the core that checks watches before   **/
+/** every instruction and on every access, so Run6502()     **/
+/** pays nothing for them. It returns a STOP_* reason, and  **/
+/** if Hit is not 0, sets *Hit to the watched address on    **/
+/** STOP_WATCH or to PC otherwise. The slice goes on where  **/
+/** it stopped on the next call.                            **/
+/*************************************************************/
+int Debug6502(register M6502 *R, int Mode, word *Hit);
+
+/** DAsm6502() ***********************************************/
+/** This function writes the instruction at address A into  **/
+/** S in assembler syntax, and returns its length in bytes. **/
+/** Memory is read through R->Page[] only.                  **/
+/*************************************************************/
+int DAsm6502(const M6502 *R, char *S, word A);
+
+/** Static6502() *********************************************/
+/** This function comes from the C++ file tools/recompile   **/
+/** generates for one ROM image, and is only there in the   **/
+/** builds that link it. It hands the blocks precompiled    **/
+/** from that image to the cache set up by Cache6502(),     **/
+/** which must be called first. Code they do not cover is   **/
+/** still interpreted. Returns the number of blocks, or -1  **/
+/** if the cache holds a different image.                   **/
+/*************************************************************/
+int Static6502(register M6502 *R);
+
 /** Rd6502()/Wr6502/Op6502() *********************************/
 /** These functions are called when access to RAM occurs.   **/
 /** They allow to control memory access. Op6502 is the same **/
 /** as Rd6502, but used to read *opcodes* only, when many   **/
-/** checks can be skipped to make it fast. It is only       **/
-/** required if there is a #define FAST_RDOP.               **/
+/** checks can be skipped to make it fast. With #define     **/
+/** FAST_RDOP it is replaced by a direct lookup in R->Page, **/
+/** which must then hold a valid pointer for every page.    **/
 /************************************ TO BE WRITTEN BY USER **/
 void Wr6502(register word Addr, register byte Value);
 byte Rd6502(register word Addr);
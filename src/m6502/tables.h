@@ -13,7 +13,13 @@
 /**     changes to this file.                               **/
 /*************************************************************/
 
-static byte Cycles[256] =
+#ifdef __cplusplus
+#define M6502_TABLE static constexpr byte
+#else
+#define M6502_TABLE static byte
+#endif
+
+M6502_TABLE Cycles[256] =
 {
 /* https://github.com/mamedev/historic-mess/blob/master/src/emu/cpu/m6502/t6502.c
    https://github.com/mamedev/historic-mess/blob/master/src/emu/cpu/m6502/t65c02.c
@@ -36,7 +42,7 @@ static byte Cycles[256] =
     2,5,3,2,2,4,6,5,2,4,4,2,2,4,7,5,
 };
 
-byte ZNTable[256] =
+M6502_TABLE ZNTable[256] =
 {
     Z_FLAG,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
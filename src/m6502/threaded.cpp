@@ -0,0 +1,56 @@
+/** M65C02: threaded-code 65C02 emulator *********************/
+/**                                                         **/
+/**                       Threaded.cpp                      **/
+/**                                                         **/
+/** This file instantiates Core.hpp for the default memory  **/
+/** system and exports it through the M6502.h interface, so **/
+/** it can replace M6502.c without changes to the caller.   **/
+/** On x86-64 hosts Jit.hpp is added on top of the cache.   **/
+/** Debug.hpp builds a second, watched instance for         **/
+/** Debug6502().                                            **/
+/*************************************************************/
+#include "core.hpp"
+#include "debug.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include "jit.hpp"
+#define M6502_JIT
+#endif
+
+using Cpu = m6502::Core<m6502::DefaultBus>;
+
+extern "C" void Reset6502(M6502 *R) { Cpu::Reset(R); }
+
+extern "C" void Int6502(M6502 *R, byte Type) { Cpu::Int(R, Type); }
+
+extern "C" word Run6502(M6502 *R) { return Cpu::Run(R); }
+
+extern "C" int Jit6502(M6502 *R, int Mode) {
+#ifdef M6502_JIT
+    if (R->Cache) return m6502::Jit<m6502::DefaultBus>::Attach(*static_cast<m6502::BlockCache *>(R->Cache), Mode);
+#endif
+    return -1;
+}
+
+extern "C" void Cache6502(M6502 *R, const byte *Code, unsigned int Size) {
+    if (R->Cache) Jit6502(R, JIT_OFF);
+    delete static_cast<m6502::BlockCache *>(R->Cache);
+    R->Cache = Size ? new m6502::BlockCache(Code, Size) : nullptr;
+}
+
+static m6502::Watches &Watches(M6502 *R) {
+    if (!R->Debug) R->Debug = new m6502::Watches{};
+    return *static_cast<m6502::Watches *>(R->Debug);
+}
+
+extern "C" int Watch6502(M6502 *R, word A, int Kinds) {
+    m6502::Watches &W = Watches(R);
+    int Old = W.Kinds[A];
+    W.Kinds[A] = (byte) Kinds;
+    return Old;
+}
+
+extern "C" int Debug6502(M6502 *R, int Mode, word *Hit) {
+    Watches(R);
+    return m6502::Debugger<m6502::DefaultBus>::Run(R, Mode, Hit);
+}
@@ -0,0 +1,857 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#include "lcd.h"
+#include "machine.h"
+
+// The NMI occurs every 65536 clock cycles (61.04Hz) regardless of the rate that the LCD refreshes.
+#define NMI_CYCLES 65536
+
+// The CPU waits a read and a write for each byte the LCD DMA moves
+#define VIDEO_DMA_BYTE_CYCLES 2
+
+// The LCD clocks out a line every 256 cycles, 256 line periods per frame of which the first 160 are visible
+#define LCD_LINE_CYCLES 256
+#define LCD_LINES 256
+#define LCD_FRAME_CYCLES (LCD_LINES * LCD_LINE_CYCLES)
+
+/*
+ * Memory map, one entry per 256-byte page:
+ *   0000-1FFF  RAM
+ *   2000-20FF  I/O registers, dispatched through io_read_handlers / io_write_handlers
+ *   2100-3FFF  unmapped, reads as FFh
+ *   4000-5FFF  VRAM, mirrored at 6000-7FFF
+ *   8000-BFFF  ROM bank selected through 2026, mirrored on carts under 128 KB
+ *   C000-FFFF  last 16 KB of ROM
+ *
+ * Reads go through m->cpu.Page, which the CPU core also uses for opcode, zero page and stack access (FAST_RDOP).
+ * Writes go through write_pages; a NULL entry is either the I/O page or read-only memory.
+ */
+#define IO_PAGE 0x20
+
+typedef uint8_t (*io_read_handler)(MACHINE *m, uint16_t address);
+typedef void (*io_write_handler)(MACHINE *m, uint16_t address, uint8_t value);
+
+// The same for every machine, filled in by map_io_handlers before main
+static io_read_handler io_read_handlers[256];
+static io_write_handler io_write_handlers[256];
+
+// The machine the CPU callbacks work on in each thread, they are not given one
+static thread_local MACHINE *machine;
+
+static void sound_catch_up(MACHINE *m);
+static void lcd_catch_up(MACHINE *m, uint64_t now);
+static void video_dma(MACHINE *m);
+
+static inline bool bit_test(const uint64_t *bits, int n) {
+    return bits[n >> 6] >> (n & 63) & 1;
+}
+
+static inline void bit_set(uint64_t *bits, int n) {
+    bits[n >> 6] |= (uint64_t) 1 << (n & 63);
+}
+
+// Every screen line has to be drawn again, its pixels no longer follow from VRAM and the LCD registers
+static inline void lcd_invalidate(MACHINE *m) {
+    memset(m->lcd_stale, 0xFF, sizeof(m->lcd_stale));
+}
+
+// Marks the VRAM blocks holding length bytes from offset as written
+static inline void vram_write(MACHINE *m, uint16_t offset, int length) {
+    for (int block = offset >> VRAM_BLOCK_SHIFT; block <= (offset + length - 1) >> VRAM_BLOCK_SHIFT; block++)
+        bit_set(m->vram_written, block % VRAM_BLOCKS);
+}
+
+static inline void map_pages(uint8_t **pages, uint16_t from, uint16_t to, uint8_t *memory, size_t size) {
+    for (uint32_t address = from; address <= to; address += 256) {
+        pages[address >> 8] = memory + (address - from) % size;
+    }
+}
+
+// Maps ROM, then moves the pages with cheats for that window (8000-BFFF or C000-FFFF) onto their patched copies
+static inline void map_rom(MACHINE *m, uint16_t from, uint16_t to, const uint8_t *rom) {
+    map_pages(m->cpu.Page, from, to, (uint8_t *) rom, ROM_BANK_SIZE);
+
+    if (m->cheats && m->cheats->patched_pages) {
+        for (int page = from >> 8; page <= to >> 8; page++) {
+            uint8_t *patched = from >= 0xC000 ? m->cheats->fixed[page - 0xC0]
+                                              : m->cheats->banked[(m->cpu.Page[page] - m->rom->data) >> 8];
+            if (patched) m->cpu.Page[page] = patched;
+        }
+    }
+}
+
+static inline void map_bank(MACHINE *m) {
+    map_rom(m, 0x8000, 0xBFFF, m->rom->banks[m->bank]);
+}
+
+/*
+ * The IRQ line stays asserted through m->cpu.IRequest while an enabled IRQ flag is set, so a masked IRQ
+ * is taken after CLI. When it gets asserted in the middle of a slice the CPU stops, so that Loop6502
+ * can deliver it after the current instruction.
+ */
+static void update_irq(MACHINE *m) {
+    const uint8_t request = m->irq_enabled && (m->irq_timer_expired || m->sound_dma_expired) ? INT_IRQ : INT_NONE;
+
+    if (request == INT_IRQ && m->cpu.IRequest != INT_IRQ)
+        scheduler_stop(&m->scheduler);
+    m->cpu.IRequest = request;
+}
+
+static uint8_t irq_timer_value(MACHINE *m) {
+    if (!scheduler_pending(&m->scheduler, EVENT_IRQ_TIMER))
+        return m->irq_timer_counter;
+
+    return m->irq_timer_counter - (uint8_t) ((scheduler_now(&m->scheduler) - m->irq_timer_start) / m->timer_prescaler);
+}
+
+static void irq_timer_start_counting(MACHINE *m, uint8_t value) {
+    m->irq_timer_counter = value;
+    m->irq_timer_start = scheduler_now(&m->scheduler);
+    scheduler_add(&m->scheduler, EVENT_IRQ_TIMER, m->irq_timer_start + value * m->timer_prescaler);
+}
+
+/* Reset Sound DMA IRQ flag:
+        7       0
+        ---------
+        ???? ????
+
+        When this register is read, it resets the audio DMA IRQ flag (clears status reg bit too)
+ */
+static uint8_t io_read_sound_dma_status(MACHINE *m, uint16_t address) {
+    m->sound_dma_expired = false;
+    update_irq(m);
+    return 0;
+}
+
+static uint8_t io_read_irq_timer_status(MACHINE *m, uint16_t address) {
+    m->irq_timer_expired = false;
+    update_irq(m);
+    return 1;
+}
+
+/* IRQ Status:
+    7       0
+    ---------
+    ???? ??DT
+
+    D: DMA Audio system (1 = DMA audio finished)
+    T: IRQ Timer expired (1 = expired)
+*/
+static uint8_t io_read_irq_status(MACHINE *m, uint16_t address) {
+    return m->sound_dma_expired << 1 | m->irq_timer_expired;
+}
+
+static uint8_t io_read_irq_timer(MACHINE *m, uint16_t address) {
+    return irq_timer_value(m);
+}
+
+static uint8_t io_read_lcd(MACHINE *m, uint16_t address) {
+    return m->lcd_registers[address & 3];
+}
+
+/* 2020 - Controller
+
+    Controller:
+    7       0
+    ---------
+    SLAB UDLR
+
+    S: Start button
+    L: Select button
+    A: A button
+    B: B button
+    U: Up on D-pad
+    D: Down on D-pad
+    L: Left on D-pad
+    R: Right on D-pad
+
+    Pressing a button results in that bit going LOW.  Bits are high for buttons that are not pressed. (i.e. the register returns FFh when no buttons are pressed).
+*/
+static uint8_t io_read_controller(MACHINE *m, uint16_t address) {
+    return m->buttons;
+}
+
+// Unmapped I/O reads FFh and ignores writes. Read and write watches on 20xx in the debugger show who accesses it.
+static uint8_t io_read_unmapped(MACHINE *m, uint16_t address) {
+    return 0xFF;
+}
+
+static void io_write_lcd(MACHINE *m, uint16_t address, uint8_t value) {
+    lcd_catch_up(m, scheduler_now(&m->scheduler));
+    if (m->lcd_registers[address & 3] != value)
+        lcd_invalidate(m);
+    m->lcd_registers[address & 3] = value;
+}
+
+/* LCD DMA:
+    2008  Source low
+    2009  Source high
+    200A  Destination low
+    200B  Destination high
+    200C  Length in 16-byte units, 00h is 4096 bytes
+    200D  Control, writing 1 to bit 7 starts the transfer
+
+    The copy goes through the CPU address space, usually from ROM or RAM into VRAM, and the CPU waits until it is done.
+*/
+static void io_write_video_dma(MACHINE *m, uint16_t address, uint8_t value) {
+    m->video_dma[address - 0x2008] = value;
+
+    if (address == 0x200D && (value & 0x80))
+        video_dma(m);
+}
+
+/* Link port:
+    2021  Data, the level each line is driven to, or reads as
+    2022  Direction, 1 = this console drives the line
+
+    The cable joins each line to the same line of the other console. A line neither console drives reads high, one
+    both drive reads what this console drives. The other console's writes arrive LINK_QUANTUM_CYCLES after it made them.
+*/
+static uint8_t io_read_link_port(MACHINE *m, uint16_t address) {
+    if (address == 0x2022)
+        return m->link_direction;
+
+    uint8_t partner_data = 0xFF, partner_direction = 0x00;
+    if (m->link) {
+        link_receive(m->link, scheduler_now(&m->scheduler));
+        partner_data = m->link->partner_data;
+        partner_direction = m->link->partner_direction;
+    }
+
+    const uint8_t driven = m->link_direction | partner_direction;
+    return (m->link_data & m->link_direction) | (partner_data & partner_direction & ~m->link_direction) | ~driven;
+}
+
+static void io_write_link_port(MACHINE *m, uint16_t address, uint8_t value) {
+    if (address == 0x2021)
+        m->link_data = value;
+    else
+        m->link_direction = value;
+
+    if (m->link)
+        link_send(m->link, scheduler_now(&m->scheduler), m->link_data, m->link_direction);
+}
+
+static void io_write_sound_wave(MACHINE *m, uint16_t address, uint8_t value) {
+    sound_catch_up(m);
+    sound_wave_write(&m->sound, (address & 0x4) >> 2, address & 3, value);
+}
+
+static void io_write_sound_dma(MACHINE *m, uint16_t address, uint8_t value) {
+    sound_catch_up(m);
+    sound_dma_write(&m->sound, address - 0x2018, value);
+
+    if (address == 0x201C) {
+        if (!(value & 0x80))
+            scheduler_cancel(&m->scheduler, EVENT_AUDIO_DMA);
+        else if (!scheduler_pending(&m->scheduler, EVENT_AUDIO_DMA))
+            scheduler_add(&m->scheduler, EVENT_AUDIO_DMA, scheduler_now(&m->scheduler) + sound_dma_cycles(&m->sound));
+    }
+}
+
+static void io_write_sound_noise(MACHINE *m, uint16_t address, uint8_t value) {
+    sound_catch_up(m);
+    sound_noise_write(&m->sound, address & 3, value);
+}
+
+/* IRQ Timer:
+    7       0
+    ---------
+    TTTT TTTT
+
+    T: IRQ Timer.  Readable and writable.
+
+    When a value is written to this register, the timer will start decrementing until it is 00h, then it will stay at 00h.  When the timer expires, it sets a flag which triggers an IRQ.  This timer is clocked by a prescaler, which is reset when the timer is written to.  This prescaler can divide the system clock by 256 or 16384.
+
+    Writing 00h to the IRQ Timer register results in an instant IRQ. It does not wrap to FFh and continue counting;  it just stays at 00h and fires off an IRQ.
+*/
+static void io_write_irq_timer(MACHINE *m, uint16_t address, uint8_t value) {
+    irq_timer_start_counting(m, value);
+}
+
+/*
+ * System Control:
+    7       0
+    ---------
+    BBBS D?IN
+
+   B: Bank select bits for 8000-BFFF.
+   N: Enable the NMI (1 = enable)
+   I: Enable the IRQ (1 = enable)
+   S: IRQ Timer prescaler.  1 = divide by 16384, 0 = divide by 256
+   D: Display enable. 1 = enable display, 0 = disable display
+
+   Writing to this register resets the LCD rendering system and makes it start rendering from the upper left corner, regardless of the bit pattern
+ */
+static void io_write_system_control(MACHINE *m, uint16_t address, uint8_t value) {
+    m->bank = value >> 5;
+    map_bank(m);
+
+    m->nmi_enabled = 1 == (value & 1);
+    m->irq_enabled = 2 == (value & 2);
+    update_irq(m);
+
+    const uint16_t prescaler = (value & 0x10) ? 16384 : 256;
+    if (prescaler != m->timer_prescaler) {
+        // Keep counting from the current value at the new rate
+        const uint8_t counter = irq_timer_value(m);
+        m->timer_prescaler = prescaler;
+        if (scheduler_pending(&m->scheduler, EVENT_IRQ_TIMER))
+            irq_timer_start_counting(m, counter);
+    }
+
+    const uint64_t now = scheduler_now(&m->scheduler);
+    lcd_catch_up(m, now);
+    m->lcd_start = now;
+    m->lcd_line = 0;
+}
+
+static void io_write_unmapped(MACHINE *m, uint16_t address, uint8_t value) {
+}
+
+static inline void map_io(uint16_t from, uint16_t to, io_read_handler read, io_write_handler write) {
+    for (uint16_t address = from; address <= to; address++) {
+        if (read) io_read_handlers[address & 0xFF] = read;
+        if (write) io_write_handlers[address & 0xFF] = write;
+    }
+}
+
+static bool map_io_handlers() {
+    map_io(0x2000, 0x20FF, io_read_unmapped, io_write_unmapped);
+    map_io(0x2000, 0x2007, io_read_lcd, io_write_lcd);
+    map_io(0x2008, 0x200D, nullptr, io_write_video_dma);
+    map_io(0x2010, 0x2017, nullptr, io_write_sound_wave);
+    map_io(0x2018, 0x201C, nullptr, io_write_sound_dma);
+    map_io(0x2020, 0x2020, io_read_controller, nullptr);
+    map_io(0x2021, 0x2022, io_read_link_port, io_write_link_port);
+    map_io(0x2023, 0x2023, io_read_irq_timer, io_write_irq_timer);
+    map_io(0x2024, 0x2024, io_read_irq_timer_status, nullptr);
+    map_io(0x2025, 0x2025, io_read_sound_dma_status, nullptr);
+    map_io(0x2026, 0x2026, nullptr, io_write_system_control);
+    map_io(0x2027, 0x2027, io_read_irq_status, nullptr);
+    map_io(0x2028, 0x202A, nullptr, io_write_sound_noise);
+    map_io(0x202C, 0x202E, nullptr, io_write_sound_noise);
+    return true;
+}
+
+[[maybe_unused]] static const bool io_handlers_mapped = map_io_handlers();
+
+static void map_memory(MACHINE *m) {
+    memset(m->open_bus, 0xFF, sizeof(m->open_bus));
+
+    map_pages(m->cpu.Page, 0x0000, 0x1FFF, m->RAM, sizeof(m->RAM));
+    map_pages(m->cpu.Page, 0x2000, 0x3FFF, m->open_bus, sizeof(m->open_bus));
+    map_pages(m->cpu.Page, 0x4000, 0x7FFF, m->VRAM, sizeof(m->VRAM));
+    map_bank(m);
+    map_rom(m, 0xC000, 0xFFFF, m->rom->hi);
+
+    // Timers, the link port and the IRQ status change between reads, so loops polling them are not idle
+    memset(m->cpu.Volatile, 0, sizeof(m->cpu.Volatile));
+    m->cpu.Volatile[IO_PAGE >> 3] |= 1 << (IO_PAGE & 7);
+
+    memset(m->write_pages, 0, sizeof(m->write_pages));
+    map_pages(m->write_pages, 0x0000, 0x1FFF, m->RAM, sizeof(m->RAM));
+    map_pages(m->write_pages, 0x4000, 0x7FFF, m->VRAM, sizeof(m->VRAM));
+}
+
+static inline uint8_t machine_read(MACHINE *m, uint16_t address) {
+    if ((address >> 8) == IO_PAGE) {
+        return io_read_handlers[address & 0xFF](m, address);
+    }
+
+    return m->cpu.Page[address >> 8][address & 0xFF];
+}
+
+static inline void machine_write(MACHINE *m, uint16_t address, uint8_t value) {
+    uint8_t *page = m->write_pages[address >> 8];
+
+    if (page) {
+        page[address & 0xFF] = value;
+
+        // 4000-7FFF, VRAM and its mirror
+        if ((address & 0xC000) == 0x4000)
+            vram_write(m, address & 0x1FFF, 1);
+        return;
+    }
+
+    if ((address >> 8) == IO_PAGE) {
+        return io_write_handlers[address & 0xFF](m, address, value);
+    }
+
+    io_write_unmapped(m, address, value);
+}
+
+/*
+ * Copies page by page: spans between plain memory on both sides are one memmove, and only spans that read the I/O
+ * page or write anything but RAM and VRAM go byte by byte through the handlers. A destination just above its source
+ * repeats bytes like the hardware's byte loop does, so those spans go byte by byte as well.
+ */
+static void video_dma(MACHINE *m) {
+    uint16_t source = m->video_dma[0] | m->video_dma[1] << 8;
+    uint16_t destination = m->video_dma[2] | m->video_dma[3] << 8;
+    int length = m->video_dma[4] ? m->video_dma[4] * 16 : 4096;
+
+    lcd_catch_up(m, scheduler_now(&m->scheduler));
+    m->cpu.ICount -= length * VIDEO_DMA_BYTE_CYCLES;
+
+    while (length > 0) {
+        const int span = std::min({length, 256 - (source & 0xFF), 256 - (destination & 0xFF)});
+        const uint8_t *from = m->cpu.Page[source >> 8] + (source & 0xFF);
+        uint8_t *to = m->write_pages[destination >> 8] ? m->write_pages[destination >> 8] + (destination & 0xFF) : nullptr;
+
+        if ((source >> 8) != IO_PAGE && to && (to <= from || to >= from + span)) {
+            memmove(to, from, span);
+            if ((destination & 0xC000) == 0x4000)
+                vram_write(m, destination & 0x1FFF, span);
+        } else {
+            for (int i = 0; i < span; i++)
+                machine_write(m, destination + i, machine_read(m, source + i));
+        }
+
+        source += span;
+        destination += span;
+        length -= span;
+    }
+}
+
+extern "C" uint8_t Rd6502(uint16_t address) {
+    return machine_read(machine, address);
+}
+
+extern "C" void Wr6502(uint16_t address, uint8_t value) {
+    machine_write(machine, address, value);
+}
+
+// Audio DMA reads through the machine the sound belongs to
+static uint8_t sound_read(void *context, uint16_t address) {
+    return machine_read((MACHINE *) context, address);
+}
+
+/*
+ * Audio is generated on the CPU's clock rather than the host's: before a sound register changes and at the end of
+ * every frame, the samples due up to the current cycle are generated into m->samples.
+ */
+static void sound_catch_up(MACHINE *m) {
+    const uint64_t due = scheduler_now(&m->scheduler) * SAMPLE_RATE / UNSCALED_CLOCK;
+
+    for (; m->audio_samples < due; m->audio_samples++) {
+        const int16_t sample = sound_generate_sample(&m->sound);
+
+        if (m->sample_count < MACHINE_FRAME_SAMPLES)
+            m->samples[m->sample_count++] = sample;
+    }
+}
+
+// Whether any of the bytes a line is drawn from were written in this LCD frame or the one before
+static bool vram_line_written(const MACHINE *m, size_t offset, int bytes) {
+    for (int block = offset >> VRAM_BLOCK_SHIFT; block <= (int) (offset + bytes - 1) >> VRAM_BLOCK_SHIFT; block++) {
+        if (bit_test(m->vram_written, block % VRAM_BLOCKS) || bit_test(m->vram_written_before, block % VRAM_BLOCKS))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Draws line y, unless it would come out the same as it is: the LCD registers have not changed since it was drawn, and
+ * nothing was written to its bytes of VRAM since either. VRAM writes are marked in vram_written, which moves to
+ * vram_written_before when a new LCD frame begins; every line is drawn once per LCD frame, so a write stays marked
+ * until every line showing it has been drawn after it.
+ */
+static void render_line(MACHINE *m, int y) {
+    const uint8_t x_scroll = m->lcd_registers[2];
+    const int width = std::min<int>(m->lcd_registers[0], WATARA_SCREEN_WIDTH);
+    const int bytes = ((x_scroll & 3) + width + 3) / 4;
+
+    // 0x30 bytes per line, wrapping around the end of VRAM
+    const size_t offset = (x_scroll / 4 + (m->lcd_registers[3] + y) * 0x30) % sizeof(m->VRAM);
+    if (!bit_test(m->lcd_stale, y) && !vram_line_written(m, offset, bytes))
+        return;
+
+    m->lcd_stale[y >> 6] &= ~((uint64_t) 1 << (y & 63));
+    bit_set(m->lcd_changed, y);
+    m->lcd_lines_drawn++;
+
+    const uint8_t *vram_line = m->VRAM + offset;
+    uint8_t wrapped[WATARA_SCREEN_WIDTH / 4 + 1];
+    if (offset + bytes > sizeof(m->VRAM)) {
+        for (int i = 0; i < bytes; i++)
+            wrapped[i] = m->VRAM[(offset + i) % sizeof(m->VRAM)];
+        vram_line = wrapped;
+    }
+
+    lcd_decode(m->screen[y], vram_line, x_scroll & 3, width);
+}
+
+/*
+ * Draws the lines the LCD has clocked out since it was last called, line y being clocked out LCD_LINE_CYCLES * (y + 1)
+ * cycles into an LCD frame. Instead of waking up for every line, the LCD catches up before anything it shows changes
+ * through the I/O page: a register write, a system control write restarting it, an LCD DMA, and the end of every
+ * frame. Each line is still drawn with the registers it was clocked out with, but from VRAM as it is when the LCD
+ * catches up; only a game rewriting VRAM of lines the raster has already passed in the same frame sees the difference.
+ */
+static void lcd_catch_up(MACHINE *m, uint64_t now) {
+    // A whole LCD frame went by: finish its visible lines and move on to the one in progress
+    if (now - m->lcd_start >= LCD_FRAME_CYCLES) {
+        for (; m->lcd_line < WATARA_SCREEN_HEIGHT; m->lcd_line++)
+            render_line(m, m->lcd_line);
+
+        m->lcd_start += (now - m->lcd_start) / LCD_FRAME_CYCLES * LCD_FRAME_CYCLES;
+        m->lcd_line = 0;
+        memcpy(m->vram_written_before, m->vram_written, sizeof(m->vram_written));
+        memset(m->vram_written, 0, sizeof(m->vram_written));
+    }
+
+    const int line = std::min((int) ((now - m->lcd_start) / LCD_LINE_CYCLES), WATARA_SCREEN_HEIGHT);
+    for (; m->lcd_line < line; m->lcd_line++)
+        render_line(m, m->lcd_line);
+}
+
+static void nmi_event(void *context, uint64_t when) {
+    MACHINE *m = (MACHINE *) context;
+
+    scheduler_add(&m->scheduler, EVENT_NMI, when + NMI_CYCLES);
+    sound_catch_up(m);
+    lcd_catch_up(m, when);
+    m->frame_done = true;
+
+    // Frozen bytes go back before the NMI handler gets to see them
+    if (m->cheats) {
+        for (int i = 0; i < m->cheats->freeze_count; i++) {
+            const CHEAT_FREEZE &freeze = m->cheats->freezes[i];
+            uint8_t &byte = m->write_pages[freeze.address >> 8][freeze.address & 0xFF];
+            if (byte != freeze.value && (freeze.address & 0xC000) == 0x4000)
+                vram_write(m, freeze.address & 0x1FFF, 1);
+            byte = freeze.value;
+        }
+    }
+}
+
+static void irq_timer_event(void *context, uint64_t when) {
+    MACHINE *m = (MACHINE *) context;
+
+    m->irq_timer_counter = 0;
+    m->irq_timer_expired = true;
+    update_irq(m);
+}
+
+static void audio_dma_event(void *context, uint64_t when) {
+    MACHINE *m = (MACHINE *) context;
+
+    m->sound_dma_expired = true;
+    update_irq(m);
+}
+
+static void link_event(void *context, uint64_t when) {
+    MACHINE *m = (MACHINE *) context;
+
+    // A machine loaded from the state of a linked one, run-ahead's shadow for one, has no cable of its own
+    if (!m->link)
+        return;
+
+    link_sync(m->link, when);
+    scheduler_add(&m->scheduler, EVENT_LINK, when + LINK_QUANTUM_CYCLES);
+}
+
+static const event_handler event_handlers[EVENT_COUNT] = {
+        nmi_event,
+        irq_timer_event,
+        audio_dma_event,
+        link_event,
+};
+
+/* Called whenever the CPU reaches the next scheduled event, returns INT_QUIT at the end of each frame */
+extern "C" byte Loop6502(M6502 *R) {
+    scheduler_run(&machine->scheduler);
+
+    if (machine->frame_done)
+        return INT_QUIT;
+
+    return R->IRequest;
+}
+
+
+bool machine_load(MACHINE *m, const char *pathname) {
+    ROM_IMAGE *rom = rom_open(pathname);
+    if (!rom)
+        return false;
+
+    machine_insert(m, rom);
+    return true;
+}
+
+void machine_insert(MACHINE *m, ROM_IMAGE *rom) {
+    rom_retain(rom);
+    machine_eject(m);
+    m->rom = rom;
+}
+
+void machine_eject(MACHINE *m) {
+    if (m->rom)
+        rom_release(m->rom);
+    m->rom = nullptr;
+}
+
+void machine_reset(MACHINE *m) {
+    machine_select(m); // Reset6502 reads the vector through Rd6502
+
+    memset(m->RAM, 0x00, sizeof(m->RAM));
+    memset(m->VRAM, 0x00, sizeof(m->VRAM));
+    memset(m->screen, 0x00, sizeof(m->screen));
+    memset(m->vram_written, 0, sizeof(m->vram_written));
+    memset(m->vram_written_before, 0, sizeof(m->vram_written_before));
+    memset(m->lcd_changed, 0, sizeof(m->lcd_changed));
+    lcd_invalidate(m);
+
+    m->buttons = 0b11111111;
+    m->bank = 0;
+    m->irq_enabled = true;
+    m->nmi_enabled = true;
+    m->irq_timer_counter = 0;
+    m->irq_timer_expired = false;
+    m->sound_dma_expired = false;
+    m->frame_done = false;
+    m->timer_prescaler = 256;
+    m->lcd_registers[0] = 160; // LCD_X_Size
+    m->lcd_registers[1] = 160; // LCD_Y_Size
+    m->lcd_registers[2] = 0;   // X_Scroll
+    m->lcd_registers[3] = 0;   // Y_Scroll
+    memset(m->video_dma, 0, sizeof(m->video_dma));
+    m->link_data = 0xFF;
+    m->link_direction = 0x00;
+    m->lcd_line = 0;
+    m->lcd_start = 0;
+    m->irq_timer_start = 0;
+    m->audio_samples = 0;
+    m->sample_count = 0;
+
+    map_memory(m);
+    Cache6502(&m->cpu, m->rom->data, m->rom->size); /* ROM code runs from predecoded blocks */
+#ifdef WATARA_JIT
+    Jit6502(&m->cpu, WATARA_JIT);
+#endif
+#ifdef WATARA_AOT
+    if (Static6502(&m->cpu) < 0) /* Blocks generated by watara-recompile, for one ROM only */
+        printf("Precompiled blocks are for another ROM, interpreting\n");
+#endif
+    Reset6502(&m->cpu);
+
+    sound_init(&m->sound, sound_read, m);
+
+    scheduler_init(&m->scheduler, &m->cpu, event_handlers, m);
+    scheduler_add(&m->scheduler, EVENT_NMI, NMI_CYCLES);
+    scheduler_next(&m->scheduler);
+}
+
+void machine_cheat(MACHINE *m, CHEATS *cheats) {
+    m->cheats = cheats;
+
+    map_bank(m);
+    map_rom(m, 0xC000, 0xFFFF, m->rom->hi);
+}
+
+void machine_connect(MACHINE *m, LINK *link) {
+    m->link = link;
+
+    // Both ends sync on the same cycles, multiples of the quantum
+    const uint64_t now = scheduler_now(&m->scheduler);
+    if (link)
+        scheduler_add(&m->scheduler, EVENT_LINK, (now / LINK_QUANTUM_CYCLES + 1) * LINK_QUANTUM_CYCLES);
+    else
+        scheduler_cancel(&m->scheduler, EVENT_LINK);
+}
+
+void machine_select(MACHINE *m) {
+    machine = m;
+}
+
+void machine_run_frame(MACHINE *m) {
+    // Runs until the frame ends, the LCD lines are rendered as they are clocked out
+    machine_begin_frame(m);
+    Run6502(&m->cpu);
+
+    machine_end_frame(m);
+}
+
+void machine_run_ahead(MACHINE *m, MACHINE *shadow, int frames, MACHINE_STATE *state) {
+    machine_save_state(m, state);
+    machine_load_state(shadow, state);
+
+    for (int frame = 0; frame < frames; frame++)
+        machine_run_frame(shadow);
+
+    machine_select(m);
+}
+
+void machine_render(MACHINE *m) {
+    lcd_invalidate(m);
+    for (int y = 0; y < WATARA_SCREEN_HEIGHT; y++)
+        render_line(m, y);
+}
+
+void machine_begin_frame(MACHINE *m) {
+    machine_select(m);
+    m->frame_done = false;
+    m->sample_count = 0;
+    memset(m->lcd_changed, 0, sizeof(m->lcd_changed));
+    m->lcd_lines_drawn = 0;
+}
+
+void machine_end_frame(MACHINE *m) {
+    if (m->nmi_enabled)
+        Int6502(&m->cpu, INT_NMI);
+
+    // An IRQ raised on the same cycle is taken on top of the NMI handler
+    if (m->cpu.IRequest == INT_IRQ)
+        Int6502(&m->cpu, INT_IRQ);
+}
+
+#define STATE_FIELD(field) sizeof(MACHINE_STATE::field)
+static_assert(STATE_FIELD(magic) + STATE_FIELD(version) + STATE_FIELD(size) + STATE_FIELD(rom_hash) + STATE_FIELD(A) +
+              STATE_FIELD(P) + STATE_FIELD(X) + STATE_FIELD(Y) + STATE_FIELD(S) + STATE_FIELD(IRequest) +
+              STATE_FIELD(AfterCLI) + STATE_FIELD(unused) + STATE_FIELD(PC) + STATE_FIELD(NZ) + STATE_FIELD(IPeriod) +
+              STATE_FIELD(ICount) + STATE_FIELD(IBackup) + STATE_FIELD(buttons) + STATE_FIELD(bank) +
+              STATE_FIELD(irq_enabled) + STATE_FIELD(nmi_enabled) + STATE_FIELD(irq_timer_counter) +
+              STATE_FIELD(irq_timer_expired) + STATE_FIELD(sound_dma_expired) + STATE_FIELD(frame_done) +
+              STATE_FIELD(timer_prescaler) + STATE_FIELD(lcd_registers) + STATE_FIELD(video_dma) +
+              STATE_FIELD(link_data) + STATE_FIELD(link_direction) + STATE_FIELD(reserved) + STATE_FIELD(lcd_line) +
+              STATE_FIELD(reserved2) + STATE_FIELD(irq_timer_start) + STATE_FIELD(lcd_start) + STATE_FIELD(cycles) +
+              STATE_FIELD(slice) + STATE_FIELD(when) + STATE_FIELD(audio_samples) + STATE_FIELD(channels) +
+              STATE_FIELD(noise_channel) + STATE_FIELD(dma_channel) + STATE_FIELD(RAM) + STATE_FIELD(VRAM) +
+              STATE_FIELD(reserved3) == sizeof(MACHINE_STATE), "MACHINE_STATE has padding that is never saved");
+#undef STATE_FIELD
+
+void machine_save_state(const MACHINE *m, MACHINE_STATE *state) {
+    state->magic = MACHINE_STATE_MAGIC;
+    state->version = MACHINE_STATE_VERSION;
+    state->size = sizeof(MACHINE_STATE);
+    state->rom_hash = m->rom->hash;
+
+    state->A = m->cpu.A;
+    state->P = m->cpu.P;
+    state->X = m->cpu.X;
+    state->Y = m->cpu.Y;
+    state->S = m->cpu.S;
+    state->IRequest = m->cpu.IRequest;
+    state->AfterCLI = m->cpu.AfterCLI;
+    state->unused = 0;
+    state->PC = m->cpu.PC.W;
+    state->NZ = m->cpu.NZ;
+    state->IPeriod = m->cpu.IPeriod;
+    state->ICount = m->cpu.ICount;
+    state->IBackup = m->cpu.IBackup;
+
+    state->buttons = m->buttons;
+    state->bank = m->bank;
+    state->irq_enabled = m->irq_enabled;
+    state->nmi_enabled = m->nmi_enabled;
+    state->irq_timer_counter = m->irq_timer_counter;
+    state->irq_timer_expired = m->irq_timer_expired;
+    state->sound_dma_expired = m->sound_dma_expired;
+    state->frame_done = m->frame_done;
+    state->timer_prescaler = m->timer_prescaler;
+    memcpy(state->lcd_registers, m->lcd_registers, sizeof(state->lcd_registers));
+    memcpy(state->video_dma, m->video_dma, sizeof(state->video_dma));
+    state->link_data = m->link_data;
+    state->link_direction = m->link_direction;
+    memset(state->reserved, 0, sizeof(state->reserved));
+    state->lcd_line = m->lcd_line;
+    state->reserved2 = 0;
+    state->lcd_start = m->lcd_start;
+    state->irq_timer_start = m->irq_timer_start;
+
+    state->cycles = m->scheduler.cycles;
+    state->slice = m->scheduler.slice;
+    memcpy(state->when, m->scheduler.when, sizeof(state->when));
+    state->audio_samples = m->audio_samples;
+
+    memcpy(state->channels, m->sound.channels, sizeof(state->channels));
+    // Copied whole, padding byte and all, which sound_init() zeroed
+    memcpy(&state->noise_channel, &m->sound.noise_channel, sizeof(state->noise_channel));
+    memcpy(&state->dma_channel, &m->sound.dma_channel, sizeof(state->dma_channel));
+
+    memcpy(state->RAM, m->RAM, sizeof(state->RAM));
+    memcpy(state->VRAM, m->VRAM, sizeof(state->VRAM));
+    memset(state->reserved3, 0, sizeof(state->reserved3));
+}
+
+bool machine_load_state(MACHINE *m, const MACHINE_STATE *state) {
+    if (state->magic != MACHINE_STATE_MAGIC || state->version != MACHINE_STATE_VERSION ||
+        state->size != sizeof(MACHINE_STATE) || state->rom_hash != m->rom->hash)
+        return false;
+
+    m->cpu.A = state->A;
+    m->cpu.P = state->P;
+    m->cpu.X = state->X;
+    m->cpu.Y = state->Y;
+    m->cpu.S = state->S;
+    m->cpu.IRequest = state->IRequest;
+    m->cpu.AfterCLI = state->AfterCLI;
+    m->cpu.PC.W = state->PC;
+    m->cpu.NZ = state->NZ;
+    m->cpu.IPeriod = state->IPeriod;
+    m->cpu.ICount = state->ICount;
+    m->cpu.IBackup = state->IBackup;
+
+    m->buttons = state->buttons;
+    m->bank = state->bank;
+    m->irq_enabled = state->irq_enabled;
+    m->nmi_enabled = state->nmi_enabled;
+    m->irq_timer_counter = state->irq_timer_counter;
+    m->irq_timer_expired = state->irq_timer_expired;
+    m->sound_dma_expired = state->sound_dma_expired;
+    m->frame_done = state->frame_done;
+    m->timer_prescaler = state->timer_prescaler;
+    memcpy(m->lcd_registers, state->lcd_registers, sizeof(m->lcd_registers));
+    memcpy(m->video_dma, state->video_dma, sizeof(m->video_dma));
+    m->link_data = state->link_data;
+    m->link_direction = state->link_direction;
+    m->lcd_line = state->lcd_line;
+    m->lcd_start = state->lcd_start;
+    m->irq_timer_start = state->irq_timer_start;
+
+    m->scheduler.cycles = state->cycles;
+    m->scheduler.slice = state->slice;
+    memcpy(m->scheduler.when, state->when, sizeof(m->scheduler.when));
+    m->audio_samples = state->audio_samples;
+
+    memcpy(m->sound.channels, state->channels, sizeof(m->sound.channels));
+    memcpy(&m->sound.noise_channel, &state->noise_channel, sizeof(m->sound.noise_channel));
+    memcpy(&m->sound.dma_channel, &state->dma_channel, sizeof(m->sound.dma_channel));
+
+    memcpy(m->RAM, state->RAM, sizeof(m->RAM));
+    memcpy(m->VRAM, state->VRAM, sizeof(m->VRAM));
+    lcd_invalidate(m);
+
+    // The only pages that move at run time
+    map_bank(m);
+    return true;
+}
+
+bool machine_save_state_file(const MACHINE *m, const char *pathname) {
+    MACHINE_STATE *state = new MACHINE_STATE;
+    machine_save_state(m, state);
+
+    FILE *file = fopen(pathname, "wb");
+    bool saved = file && fwrite(state, sizeof(MACHINE_STATE), 1, file) == 1;
+    if (file && fclose(file))
+        saved = false;
+
+    delete state;
+    return saved;
+}
+
+bool machine_load_state_file(MACHINE *m, const char *pathname) {
+    MACHINE_STATE *state = new MACHINE_STATE;
+
+    FILE *file = fopen(pathname, "rb");
+    bool loaded = file && fread(state, sizeof(MACHINE_STATE), 1, file) == 1;
+    if (file)
+        fclose(file);
+
+    loaded = loaded && machine_load_state(m, state);
+    delete state;
+    return loaded;
+}
@@ -0,0 +1,192 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "cheat.h"
+#include "link.h"
+#include "m6502/m6502.h"
+#include "rom.h"
+#include "scheduler.h"
+#include "sound.h"
+
+#define WATARA_SCREEN_WIDTH 160
+#define WATARA_SCREEN_HEIGHT 160
+
+// VRAM writes are tracked in blocks of 16 bytes, screen lines in 64-bit words of 64 lines
+#define VRAM_BLOCK_SHIFT 4
+#define VRAM_BLOCKS (8192 >> VRAM_BLOCK_SHIFT)
+#define LCD_LINE_WORDS ((WATARA_SCREEN_HEIGHT + 63) / 64)
+
+// Room for the mono samples of one frame, 65536 cycles make 722 or 723 of them
+#define MACHINE_FRAME_SAMPLES 1024
+
+/*
+ * One Supervision console: everything the emulation reads or writes, and nothing else, so that any number of them
+ * can run in one process, each on its own thread. The fields used on every instruction or I/O access come first and
+ * share a few cache lines, the memory and the screen come after. Machines are 64-byte aligned so that two of them
+ * never share a cache line.
+ *
+ * Allocate machines zeroed (new MACHINE()), load or insert a ROM and reset them before running any frames, and eject
+ * the ROM before deleting them.
+ */
+typedef struct alignas(64) {
+    // CPU, read pages included, and the write pages next to them
+    M6502 cpu;
+    uint8_t *write_pages[256];
+
+    // I/O state
+    uint8_t buttons;               // Controller at 2020, active low, set by the frontend before each frame
+    uint8_t bank;                  // ROM bank at 8000-BFFF
+    uint8_t irq_enabled;
+    uint8_t nmi_enabled;
+    uint8_t irq_timer_counter;     // Value the IRQ timer had when its prescaler was last reset
+    uint8_t irq_timer_expired;
+    uint8_t sound_dma_expired;
+    bool frame_done;
+    uint16_t timer_prescaler;
+    uint8_t lcd_registers[4];      // LCD_X_Size, LCD_Y_Size, X_Scroll, Y_Scroll
+    uint8_t video_dma[6];          // LCD DMA at 2008-200D
+    uint8_t link_data;             // Link port at 2021, and which of its lines are outputs at 2022
+    uint8_t link_direction;
+    int lcd_line;                  // Next line of the LCD frame started at lcd_start to draw
+    uint64_t lcd_start;            // Cycle the LCD started the current frame at
+    uint64_t irq_timer_start;      // Cycle the prescaler was last reset at
+    uint64_t audio_samples;        // Samples generated since reset, sample n is due at CPU cycle n * 4 MHz / 44100
+    SCHEDULER scheduler;
+    SOUND sound;
+
+    // Memory and the LCD output
+    uint8_t RAM[8192];
+    uint8_t VRAM[8192];
+    uint8_t open_bus[256];
+    uint16_t screen[WATARA_SCREEN_HEIGHT][WATARA_SCREEN_WIDTH];
+    uint64_t vram_written[VRAM_BLOCKS / 64];        // Blocks written since the LCD frame began
+    uint64_t vram_written_before[VRAM_BLOCKS / 64]; // and during the LCD frame before
+    uint64_t lcd_stale[LCD_LINE_WORDS];  // Lines to draw whatever VRAM holds, the LCD registers changed since
+    uint64_t lcd_changed[LCD_LINE_WORDS]; // Lines drawn again since the frame began, for the frontend to present
+    int lcd_lines_drawn;           // How many, the others still show what they did
+    int16_t samples[MACHINE_FRAME_SAMPLES]; // Audio of the last frame at SAMPLE_RATE
+    int sample_count;
+    ROM_IMAGE *rom;                // Shared with any other machine running the same cart
+    LINK *link;                    // Cable to another console, NULL when nothing is plugged in
+    CHEATS *cheats;                // ROM patches and RAM freezes, NULL when there are none
+} MACHINE;
+
+#define MACHINE_STATE_MAGIC 0x53565357 // "WSVS"
+#define MACHINE_STATE_VERSION 5
+
+/*
+ * Save state: everything in a MACHINE that is not a pointer, the ROM or the screen, laid out flat so that taking or
+ * restoring one is a few copies into a 16 KB block. The layout is that of the build that wrote it; the header rejects
+ * states from another version, struct size or ROM.
+ *
+ * Take and restore them between frames. The screen is not saved, every visible line is drawn again by the next frame.
+ * Gaps are filled by reserved fields saved as 0, so that equal machines save byte for byte equal states.
+ */
+typedef struct {
+    // Header
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;                 // sizeof(MACHINE_STATE)
+    uint32_t rom_hash;
+
+    // CPU, M6502 without its pointers
+    uint8_t A, P, X, Y, S;
+    uint8_t IRequest;
+    uint8_t AfterCLI;
+    uint8_t unused;
+    uint16_t PC;
+    uint16_t NZ;
+    int32_t IPeriod, ICount, IBackup;
+
+    // I/O state
+    uint8_t buttons;
+    uint8_t bank;
+    uint8_t irq_enabled;
+    uint8_t nmi_enabled;
+    uint8_t irq_timer_counter;
+    uint8_t irq_timer_expired;
+    uint8_t sound_dma_expired;
+    uint8_t frame_done;
+    uint16_t timer_prescaler;
+    uint8_t lcd_registers[4];
+    uint8_t video_dma[6];
+    uint8_t link_data;
+    uint8_t link_direction;
+    uint8_t reserved[2];
+    int32_t lcd_line;
+    uint32_t reserved2;
+    uint64_t irq_timer_start;
+    uint64_t lcd_start;
+
+    // Scheduler, without its handlers
+    uint64_t cycles;
+    int64_t slice;
+    uint64_t when[EVENT_COUNT];
+    uint64_t audio_samples;
+
+    // Sound, without its DMA read callback
+    SV_CHANNEL channels[2];
+    SV_NOISE_CHANNEL noise_channel;
+    SV_DMA_CHANNEL dma_channel;
+
+    uint8_t RAM[8192];
+    uint8_t VRAM[8192];
+    uint8_t reserved3[2];          // Up to a whole uint64_t, for rewind deltas
+} MACHINE_STATE;
+
+// Maps the ROM image at pathname for m alone, returns false if it cannot be mapped or is not a cart
+bool machine_load(MACHINE *m, const char *pathname);
+
+// Runs m from rom, which any number of other machines may be running from too
+void machine_insert(MACHINE *m, ROM_IMAGE *rom);
+
+// Lets go of the ROM, unmapping it if no other machine runs from it
+void machine_eject(MACHINE *m);
+
+// Powers the machine on with the ROM it has loaded, selecting it in the calling thread
+void machine_reset(MACHINE *m);
+
+// Runs m with cheats made for its ROM, or without any (NULL). Call it again between frames after adding codes.
+void machine_cheat(MACHINE *m, CHEATS *cheats);
+
+// Plugs m into one end of a cable, right after resetting it and the console on the other end, or unplugs it (NULL)
+void machine_connect(MACHINE *m, LINK *link);
+
+// Makes m the machine Rd6502, Wr6502 and Loop6502 work on in the calling thread
+void machine_select(MACHINE *m);
+
+// Runs one frame through Run6502 on the calling thread, leaving its audio in m->samples
+void machine_run_frame(MACHINE *m);
+
+// Gets m ready to run a frame in the calling thread, done by machine_run_frame or before running it through Debug6502
+void machine_begin_frame(MACHINE *m);
+
+// Takes the interrupts due at the end of a frame, done by machine_run_frame or after running it through Debug6502
+void machine_end_frame(MACHINE *m);
+
+/*
+ * Run-ahead: copies the state of m into shadow, a second machine reset with the same ROM, and runs it frames ahead
+ * with the buttons m holds. shadow->screen is then what m will show that many frames later if the input stays the
+ * same. m itself is not run, so its sound carries on as if nothing happened. state is scratch space.
+ */
+void machine_run_ahead(MACHINE *m, MACHINE *shadow, int frames, MACHINE_STATE *state);
+
+// Draws every visible line from VRAM as it is now, for the screen to match a state just loaded
+void machine_render(MACHINE *m);
+
+// Copies the state of m into state
+void machine_save_state(const MACHINE *m, MACHINE_STATE *state);
+
+// Puts m back into state, returns false and leaves m alone if state was written by another build or for another ROM
+bool machine_load_state(MACHINE *m, const MACHINE_STATE *state);
+
+// The same through a file, returns false if it cannot be written or read, or does not fit m
+bool machine_save_state_file(const MACHINE *m, const char *pathname);
+bool machine_load_state_file(MACHINE *m, const char *pathname);
+
+#endif //MACHINE_H
@@ -1,61 +1,166 @@
+#include <algorithm>
 #include <cstdio>
 #include <cstdint>
 #include <cstring>
 #include <cstdlib>
+#include <thread>
 
 #include <windows.h>
 
 #include "MiniFB.h"
-#include "m6502/m6502.h"
-#include "sound.h"
+#include "lcd.h"
+#include "machine.h"
+#include "movie.h"
+#include "rewind.h"
+#include "scaler.h"
 
-static M6502 cpu;
+static MACHINE *console = new MACHINE();
 
-static uint8_t VRAM[8192];
-static uint8_t RAM[8192];
-static uint8_t ROM[128 << 10];
+// A minute of rewind, at a few hundred bytes to 1 KB per frame
+#define REWIND_FRAMES 3700
+#define REWIND_RING_SIZE (4 << 20)
+static REWIND history;
 
-#define WATARA_SCREEN_WIDTH 160
-#define WATARA_SCREEN_HEIGHT 160
-static uint16_t SCREEN[WATARA_SCREEN_HEIGHT][WATARA_SCREEN_WIDTH];
+// Input being recorded to <rom>.movie with F9
+static MOVIE movie;
+static bool recording = false;
 
-#define RGB565(r, g, b) ((((r) >> 3) << 11) | (((g) >> 2) << 5) | ((b) >> 3))
-static const uint16_t watara_palette[] = {
-        RGB565(0x7b, 0xc7, 0x7b),
-        RGB565(0x52, 0xa6, 0x8c),
-        RGB565(0x2e, 0x62, 0x60),
-        RGB565(0x0d, 0x32, 0x2e),
-};
+// Cable to another emulator, which keeps the two consoles in lockstep from reset: nothing may reset or rewind one
+static LINK *cable = nullptr;
+
+// What the window showed last, each frame blended into it when ghosting is on
+static uint16_t ghost_screen[WATARA_SCREEN_HEIGHT][WATARA_SCREEN_WIDTH];
+
+// Software scaling filter the window shows the frames through, NULL to leave scaling to StretchDIBits
+static SCALER *scaler = nullptr;
 
 static uint8_t *key_status = (uint8_t *) mfb_keystatus();
 
-size_t rom_size;
+// Latches the keyboard into the controller at 2020 for the next frame
+static void read_buttons() {
+    uint8_t buttons = 0b11111111;
 
-static uint8_t irq_timer_counter = 0;
-static uint8_t irq_timer_expired = true;
+    if (key_status[0x27]) buttons ^= 0b1;
+    if (key_status[0x25]) buttons ^= 0b10;
 
-static uint8_t irq_enabled = true;
-static uint8_t nmi_enabled = true;
-static uint16_t timer_prescaler = 256;
-static uint16_t bank = 0;
+    if (key_status[0x28]) buttons ^= 0b100;
+    if (key_status[0x26]) buttons ^= 0b1000;
 
-uint8_t lcd_registers[4] = {
-        160, // LCD_X_Size
-        160, // LCD_Y_Size
-        0,   // X_Scroll
-        0,   // Y_Scroll
-};
+    if (key_status['X']) buttons ^= 0b10000;
+    if (key_status['Z']) buttons ^= 0b100000;
 
-static inline void readfile(const char *pathname, uint8_t *dst) {
+    if (key_status[0x0d]) buttons ^= 0b10000000;
+    if (key_status[0x20]) buttons ^= 0b10000000;
 
+    console->buttons = buttons;
+}
 
-    FILE *file = fopen(pathname, "rb");
-    fseek(file, 0, SEEK_END);
-    rom_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+// F9 resets the machine and records its input to <rom>.movie, until F9 is pressed again or a state is loaded
+static void handle_movie_key(const char *rom_pathname, bool stop) {
+    static bool pressed = false;
+    char pathname[MAX_PATH];
+
+    snprintf(pathname, sizeof(pathname), "%s.movie", rom_pathname);
+
+    // A movie holds buttons alone, with no record of cheats, so one recorded with them would not play back the same
+    if (key_status[0x78] && !pressed && !recording && !cable && console->cheats) {
+        printf("Cheats are on, movie not recorded\n");
+    } else if (key_status[0x78] && !pressed && !recording && !cable) {
+        machine_reset(console);
+        rewind_clear(&history);
+        movie_init(&movie, console->rom->hash);
+        recording = true;
+        printf("Recording %s\n", pathname);
+    } else if (recording && (stop || (key_status[0x78] && !pressed))) {
+        if (movie_save(&movie, pathname))
+            printf("Recorded %u frames to %s\n", movie.frames, pathname);
+        else
+            printf("Cannot write %s\n", pathname);
+        movie_free(&movie);
+        recording = false;
+    }
 
-    fread(dst, sizeof(uint8_t), rom_size, file);
-    fclose(file);
+    pressed = key_status[0x78];
+}
+
+// Boot snapshots are kept in the working directory, named after the hash of the ROM they boot and the frames they ran
+// headless before being stored, or "manual" for frames 0, the one stored with F6
+static void boot_pathname(char *pathname, size_t size, int frames) {
+    if (frames > 0)
+        snprintf(pathname, size, "watara-%08X-%d.boot", console->rom->hash, frames);
+    else
+        snprintf(pathname, size, "watara-%08X-manual.boot", console->rom->hash);
+}
+
+// Restores the F6 boot snapshot of the ROM, else the one for boot_frames, or makes that one by running boot_frames
+// frames headless with no buttons held
+static void boot(int boot_frames) {
+    char pathname[MAX_PATH];
+    LARGE_INTEGER frequency, start, end;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    boot_pathname(pathname, sizeof(pathname), 0);
+    bool loaded = machine_load_state_file(console, pathname);
+    if (!loaded && boot_frames > 0) {
+        boot_pathname(pathname, sizeof(pathname), boot_frames);
+        loaded = machine_load_state_file(console, pathname);
+    }
+
+    if (loaded) {
+        machine_render(console);
+        QueryPerformanceCounter(&end);
+        printf("Booted from %s in %.2f ms\n", pathname, (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart);
+        return;
+    }
+
+    if (boot_frames <= 0)
+        return;
+
+    for (int frame = 0; frame < boot_frames; frame++)
+        machine_run_frame(console);
+
+    if (machine_save_state_file(console, pathname))
+        printf("Stored the first %d frames in %s\n", boot_frames, pathname);
+    else
+        printf("Cannot write %s\n", pathname);
+}
+
+// F2 saves the machine to <rom>.state between frames, F4 loads it back, F6 makes it the boot snapshot
+static void handle_state_keys(const char *rom_pathname) {
+    static bool saving = false, loading = false, booting = false;
+    char pathname[MAX_PATH];
+
+    snprintf(pathname, sizeof(pathname), "%s.state", rom_pathname);
+
+    if (key_status[0x71] && !saving && !machine_save_state_file(console, pathname))
+        printf("Cannot write %s\n", pathname);
+    if (key_status[0x73] && !loading && !cable) {
+        if (machine_load_state_file(console, pathname)) {
+            machine_render(console);
+            rewind_clear(&history);
+            if (recording)
+                handle_movie_key(rom_pathname, true);
+        } else {
+            printf("Cannot load %s\n", pathname);
+        }
+    }
+
+    // The boot snapshot is taken before cheats apply and must stay free of them
+    if (key_status[0x75] && !booting && console->cheats) {
+        printf("Cheats are on, boot snapshot not stored\n");
+    } else if (key_status[0x75] && !booting) {
+        boot_pathname(pathname, sizeof(pathname), 0);
+        if (machine_save_state_file(console, pathname))
+            printf("Boot snapshot stored in %s\n", pathname);
+        else
+            printf("Cannot write %s\n", pathname);
+    }
+
+    saving = key_status[0x71];
+    loading = key_status[0x73];
+    booting = key_status[0x75];
 }
 
 #define SOUND_FREQUENCY 44100
@@ -120,324 +225,301 @@ DWORD WINAPI SoundThread(LPVOID lpParam) {
     return 0;
 }
 
-DWORD WINAPI TicksThread(LPVOID lpParam) {
-    LARGE_INTEGER start, current, queryperf;
-
-
-    QueryPerformanceFrequency(&queryperf);
-    uint32_t hostfreq = (uint32_t) queryperf.QuadPart;
-
-    QueryPerformanceCounter(&start); // Get the starting time
-    uint32_t last_sound_tick = 0;
-
-
-    updateEvent = CreateEvent(NULL, 1, 1, NULL);
-    while (1) {
-        QueryPerformanceCounter(&current); // Get the current time
+// Hands the samples of the frame just run to SoundThread, one buffer at a time
+static void queue_audio(const MACHINE *m) {
+    for (int i = 0; i < m->sample_count; i++) {
+        audio_buffer[sample_index++] = m->samples[i];
+        audio_buffer[sample_index++] = m->samples[i];
 
-        // Calculate elapsed time in ticks since the start
-        uint32_t elapsedTime = (uint32_t) (current.QuadPart - start.QuadPart);
-
-        if (elapsedTime - last_sound_tick >= hostfreq / SOUND_FREQUENCY) {
-            const int16_t sample =  sound_generate_sample();
-
-            audio_buffer[sample_index++] = sample;
-            audio_buffer[sample_index++] = sample;
-
-            if (sample_index >= AUDIO_BUFFER_LENGTH) {
-                SetEvent(updateEvent);
-                sample_index = 0;
-            }
-
-            last_sound_tick = elapsedTime;
+        if (sample_index >= AUDIO_BUFFER_LENGTH) {
+            SetEvent(updateEvent);
+            sample_index = 0;
         }
     }
 }
 
-extern "C" uint8_t Rd6502(uint16_t address) {
-    if (address <= 0x1FFF) {
-        return RAM[address];
-    }
-
-    if (address == 0x2023) {
-        return irq_timer_counter;
-    }
-
-    if (address == 0x2024) {
-        printf("IRQ timer STATUS reset\n");
-        irq_timer_expired = true;
-        return 1;
-    }
-
-/* Reset Sound DMA IRQ flag:
-        7       0
-        ---------
-        ???? ????
+// Bands of the lines the LCD drew again in the last frame, the window still shows the others as they are
+static int changed_rects(const MACHINE *m, MFB_RECT *rects) {
+    int count = 0;
 
-        When this register is read, it resets the audio DMA IRQ flag (clears status reg bit too)
- */
-    if (address == 0x2025) {
-        printf("Sound DMA STATUS reset\n");
-        return 0;
-    }
-
-/* IRQ Status:
-    7       0
-    ---------
-    ???? ??DT
-
-    D: DMA Audio system (1 = DMA audio finished)
-    T: IRQ Timer expired (1 = expired)
-*/
-    if (address == 0x2027) {
-        printf("IRQ STATUS read\n");
-        return irq_timer_expired;
-    }
+    for (int y = 0; y < WATARA_SCREEN_HEIGHT; y++) {
+        if (!(m->lcd_changed[y >> 6] >> (y & 63) & 1))
+            continue;
 
-    if (address >= 0x2000 && address <= 0x2007) {
-        return lcd_registers[address & 3];
+        if (count && rects[count - 1].y + rects[count - 1].height == y)
+            rects[count - 1].height++;
+        else
+            rects[count++] = {y, 1};
     }
+    return count;
+}
 
-/* 2020 - Controller
-
-    Controller:
-    7       0
-    ---------
-    SLAB UDLR
+// Shows a frame, only the bands in rects when there are any and the window takes the frame as it is
+static int present(const uint16_t *screen, const MFB_RECT *rects, int count) {
+    if (scaler)
+        return mfb_update((void *) scaler_run(scaler, screen), 60);
+    if (rects)
+        return mfb_update_rects((void *) screen, rects, count, 60);
+    return mfb_update((void *) screen, 60);
+}
 
-    S: Start button
-    L: Select button
-    A: A button
-    B: B button
-    U: Up on D-pad
-    D: Down on D-pad
-    L: Left on D-pad
-    R: Right on D-pad
+#ifdef WATARA_DEBUGGER
+static bool debug_break = true; // Enter the monitor before the first instruction
 
-    Pressing a button results in that bit going LOW.  Bits are high for buttons that are not pressed. (i.e. the register returns FFh when no buttons are pressed).
-*/
-    if (address == 0x2020) {
-        uint8_t buttons = 0b11111111;
+static void debug_show() {
+    M6502 &cpu = console->cpu;
+    char text[32];
 
-        if (key_status[0x27]) buttons ^= 0b1;
-        if (key_status[0x25]) buttons ^= 0b10;
+    DAsm6502(&cpu, text, cpu.PC.W);
+    printf("A=%02X X=%02X Y=%02X S=%02X P=%02X  %04X  %s\n", cpu.A, cpu.X, cpu.Y, cpu.S, cpu.P, cpu.PC.W, text);
+}
 
-        if (key_status[0x28]) buttons ^= 0b100;
-        if (key_status[0x26]) buttons ^= 0b1000;
+static void debug_toggle(uint16_t address, int kind) {
+    const int kinds = Watch6502(&console->cpu, address, 0) ^ kind;
 
-        if (key_status['X']) buttons ^= 0b10000;
-        if (key_status['Z']) buttons ^= 0b100000;
+    Watch6502(&console->cpu, address, kinds);
+    printf("%04X:%s%s%s%s\n", address, kinds & WATCH_EXEC ? " break" : "", kinds & WATCH_READ ? " read" : "",
+           kinds & WATCH_WRITE ? " write" : "", kinds ? "" : " -");
+}
 
-        if (key_status[0x0d]) buttons ^= 0b10000000;
-        if (key_status[0x20]) buttons ^= 0b10000000;
+// Reads commands from stdin until one of them resumes the CPU, returns the Debug6502 mode for it
+static int debug_monitor() {
+    char line[64];
+    unsigned address;
 
-        return buttons;
+    for (;;) {
+        printf("> ");
+        fflush(stdout);
+        if (!fgets(line, sizeof(line), stdin))
+            exit(0);
+
+        const bool has_address = sscanf(line + 1, "%x", &address) == 1;
+        switch (line[0]) {
+            case 's': return DEBUG_STEP;
+            case 'n': return DEBUG_OVER;
+            case 'c': return DEBUG_RUN;
+            case 'q': exit(0);
+            case 'b': if (has_address) { debug_toggle(address, WATCH_EXEC); continue; } break;
+            case 'r': if (has_address) { debug_toggle(address, WATCH_READ); continue; } break;
+            case 'w': if (has_address) { debug_toggle(address, WATCH_WRITE); continue; } break;
+            case 'd': {
+                uint16_t pc = has_address ? address : console->cpu.PC.W;
+                for (int i = 0; i < 16; i++) {
+                    char text[32];
+                    const int length = DAsm6502(&console->cpu, text, pc);
+                    printf("%04X  %s\n", pc, text);
+                    pc += length;
+                }
+                continue;
+            }
+        }
+        printf("s step, n step over, c continue, b/r/w XXXX toggle break/read/write watch, d [XXXX] disassemble, q quit\n");
     }
+}
 
+// Runs the frame through Debug6502, dropping into the monitor on every stop. F12 breaks in.
+static void debug_run() {
+    static int mode = DEBUG_RUN;
+    uint16_t hit;
 
-    // HI ROM. Last 16384 bytes of ROM
-    if (address >= 0xC000) {
-        return ROM[rom_size - 16384 + (address - 0xC000)]; // TODO: precalculate once
-    }
+    if (key_status[0x7B])
+        debug_break = true;
 
-    // LO ROM bank
-    if (address >= 0x8000 && address <= 0xBFFF) {
-        return ROM[bank + (address - 0x8000)];
-    }
+    for (;;) {
+        if (debug_break) {
+            debug_show();
+            mode = debug_monitor();
+            debug_break = false;
+        }
 
-    if (address >= 0x4000) {
-        return VRAM[address - 0x4000];
+        switch (Debug6502(&console->cpu, mode, &hit)) {
+            case STOP_QUIT: return;
+            case STOP_BREAK: printf("Breakpoint at %04X\n", hit); break;
+            case STOP_WATCH: printf("Watch hit at %04X\n", hit); break;
+        }
+        debug_break = true;
     }
-
-    printf("READ >>>>>>>>> 0x%04x PC:%04x\r\n", address, cpu.PC.W);
-    return 0xFF;
 }
+#endif
 
-extern "C" void Wr6502(uint16_t address, uint8_t value) {
-    if (address <= 0x1FFF) {
-        RAM[address] = value;
-        return;
-    }
-
-    if (address >= 0x2000 && address <= 0x2007) {
-        lcd_registers[address & 3] = value;
-        return;
-    }
+int main(int argc, char **argv) {
+    int scale = 4;
+    int ghosting_level = 0;
+    int run_ahead = 0;
+    int boot_frames = -1;
+    int idle_cycles = 0, idle_frames = 0, lines_drawn = 0;
+    MFB_RECT rects[WATARA_SCREEN_HEIGHT / 2];
+    LARGE_INTEGER queryperf, ahead_start, ahead_end;
+    int64_t ahead_ticks = 0;
 
-    if (address >= 0x2008 && address <= 0x200D) {
-        printf("DMA register write\n");
-        return;
+    if (!argv[1]) {
+        printf("Usage: watara.exe <rom.bin> [scale_factor] [ghosting_level] [run_ahead_frames] [boot_frames] [link_name] [filter]\n");
+        return -1;
     }
 
-    if (address >= 0x2021 && address <= 0x2022) {
-        printf("Link port\n");
-        return;
+    if (argc > 2) {
+        scale = atoi(argv[2]);
     }
 
-    if ((address >= 0x2010 && address <= 0x2017)) {
 
-        return sound_wave_write((address & 0x4) >> 2, address & 3, value);
+    // 0 shows every frame as it is, up to 15 keeps that many 16ths of the previous frame
+    if (argc > 3) {
+        ghosting_level = std::clamp(atoi(argv[3]), 0, LCD_GHOST_LEVELS - 1);
     }
 
-    if (address >= 0x2018 && address <= 0x201C) {
-
-        return sound_dma_write(address - 0x2018, value);
+    if (argc > 4) {
+        run_ahead = atoi(argv[4]);
     }
 
-    if ((address >= 0x2028 && address <= 0x202A)) {
-        return sound_noise_write(address - 0x2028, value);
+    // Any boot_frames turns the boot snapshot cache on, 0 only uses snapshots stored with F6
+    if (argc > 5) {
+        boot_frames = atoi(argv[5]);
     }
 
-
-    if ((address >= 0x202C && address <= 0x202E)) {
-        return sound_noise_write(address - 0x202C, value);
+    // Two emulators given the same link name are cabled together
+    if (argc > 6) {
+        cable = link_open(argv[6]);
+        if (!cable)
+            return 1;
     }
-/* IRQ Timer:
-    7       0
-    ---------
-    TTTT TTTT
-
-    T: IRQ Timer.  Readable and writable.
-
-    When a value is written to this register, the timer will start decrementing until it is 00h, then it will stay at 00h.  When the timer expires, it sets a flag which triggers an IRQ.  This timer is clocked by a prescaler, which is reset when the timer is written to.  This prescaler can divide the system clock by 256 or 16384.
-
-    Writing 00h to the IRQ Timer register results in an instant IRQ. It does not wrap to FFh and continue counting;  it just stays at 00h and fires off an IRQ.
-*/
-    if (address == 0x2023) {
-        irq_timer_counter = value;
 
-        if (value == 0) {
-            Int6502(&cpu, INT_IRQ);
-            irq_timer_expired = true;
+    // nearest, scale2x, scale3x, scale4x or lcd scale in software on up to 4 threads, by scale_factor for nearest and
+    // lcd; the window stretches the result by whatever integer factor is left
+    if (argc > 7) {
+        SCALER_FILTER filter;
+        if (!scaler_parse(argv[7], &filter)) {
+            printf("Unknown filter %s, use nearest, scale2x, scale3x, scale4x or lcd\n", argv[7]);
+            return 1;
         }
-        printf("irq_timer_counter %d\n", value);
-//        timer_prescaler = 256;
-        return;
-    }
-
-/*
- * System Control:
-    7       0
-    ---------
-    BBBS D?IN
-
-   B: Bank select bits for 8000-BFFF.
-   N: Enable the NMI (1 = enable)
-   I: Enable the IRQ (1 = enable)
-   S: IRQ Timer prescaler.  1 = divide by 16384, 0 = divide by 256
-   D: Display enable. 1 = enable display, 0 = disable display
-
-   Writing to this register resets the LCD rendering system and makes it start rendering from the upper left corner, regardless of the bit pattern
- */
-    if (address == 0x2026) {
-        bank = (value >> 5) * 16384;
-        nmi_enabled = 1 == (value & 1);
-        irq_enabled = 2 == (value & 2);
-        timer_prescaler = 1 == (value & 5) ? 16384 : 256;
-        printf("timer_prescaler irq_enabled nmi_enabled  %d %d %d 0x%02x\n", timer_prescaler, irq_enabled, nmi_enabled, value);
-        return;
-    }
 
-    if (address >= 0x4000) {
-        VRAM[address - 0x4000] = value;
-        return;
+        const int threads = std::clamp((int) std::thread::hardware_concurrency(), 1, 4);
+        scaler = scaler_new(WATARA_SCREEN_WIDTH, WATARA_SCREEN_HEIGHT, filter, scale, threads);
+        if (!scaler) {
+            printf("Filter %s cannot scale by %d\n", argv[7], scale);
+            return 1;
+        }
     }
 
-    printf("WRITE >>>>>>>>> 0x%04x : 0x%02x PC:%04x\r\n", address, value, cpu.PC.W);
-}
-
-extern "C" byte Loop6502(M6502 *R) {
-    static int timer = 0;
+    const int factor = scaler ? scaler->factor : 1;
+    const int stretch = scale > factor ? scale / factor : 1;
+    if (!mfb_open("Watara Supervision", WATARA_SCREEN_WIDTH * factor, WATARA_SCREEN_HEIGHT * factor, stretch))
+        return 0;
 
-    if (!irq_timer_expired && irq_timer_counter == 0) {
-        printf("Counter expired, IRQ\n");
-        irq_timer_expired = true;
-        return INT_IRQ;
+    if (!machine_load(console, argv[1])) {
+        printf("Cannot read %s\n", argv[1]);
+        return 1;
     }
-
-    if (timer_prescaler == 256) {
-        irq_timer_counter--;
-        // printf("irq_timer_counter tick %i\n", irq_timer_counter);
+    machine_reset(console);
+    if (boot_frames >= 0 && !cable)
+        boot(boot_frames);
+
+    // Codes in <rom>.cheats apply from here on, after the boot snapshot so that it stays free of them
+    char cheats_pathname[MAX_PATH];
+    snprintf(cheats_pathname, sizeof(cheats_pathname), "%s.cheats", argv[1]);
+    CHEATS *cheats = cheats_new(console->rom);
+    cheats_load(cheats, console->rom, cheats_pathname);
+    if (cheats->patches || cheats->freeze_count) {
+        printf("%d patches and %d freezes from %s\n", cheats->patches, cheats->freeze_count, cheats_pathname);
+        machine_cheat(console, cheats);
     } else {
-        timer += 256;
-        if (timer == timer_prescaler) {
-            irq_timer_counter--;
-            // printf("irq_timer_counter tick %i\n", irq_timer_counter);
-            timer = 0;
-        }
-    }
-
-    return INT_QUIT;
-}
-
-int main(int argc, char **argv) {
-    int scale = 4;
-    int ghosting_level = 0;
-
-    if (!argv[1]) {
-        printf("Usage: watara.exe <rom.bin> [scale_factor] [ghosting_level]\n");
-        return -1;
+        cheats_free(cheats);
     }
 
-    if (argc > 2) {
-        scale = atoi(argv[2]);
+    if (cable) {
+        printf("Waiting for the other console on link %s\n", argv[6]);
+        while (!link_connected(cable)) {
+            if (present(&console->screen[0][0], nullptr, 0) == -1) {
+                link_close(cable);
+                return 1;
+            }
+        }
+        machine_connect(console, cable);
     }
-
-
-    if (argc > 3) {
-        ghosting_level = atoi(argv[3]);
+    rewind_init(&history, REWIND_FRAMES, REWIND_RING_SIZE);
+
+    // Run-ahead shows the frame run_ahead frames from now, taken from a second machine so that the console's sound
+    // never hears the frames it throws away
+    MACHINE *shadow = nullptr;
+    MACHINE_STATE *ahead_state = nullptr;
+    if (run_ahead > 0 && !cable) {
+        shadow = new MACHINE();
+        machine_insert(shadow, console->rom);
+        machine_reset(shadow);
+        machine_cheat(shadow, console->cheats);
+        ahead_state = new MACHINE_STATE;
     }
+    QueryPerformanceFrequency(&queryperf);
+    memcpy(ghost_screen, console->screen, sizeof(ghost_screen));
 
-    if (!mfb_open("Watara Supervision", WATARA_SCREEN_WIDTH, WATARA_SCREEN_HEIGHT, scale))
-        return 0;
-
+    updateEvent = CreateEvent(NULL, 1, 1, NULL);
     CreateThread(NULL, 0, SoundThread, NULL, 0, NULL);
-    CreateThread(NULL, 0, TicksThread, NULL, 0, NULL);
 
-    readfile(argv[1], ROM);
-    memset(VRAM, 0x00, sizeof(VRAM));
-    memset(RAM, 0x00, sizeof(RAM));
-    Reset6502(&cpu);
-
-    sound_init();
-
-    cpu.IPeriod = 256;
     for (;;) {
-        for (int i = 0; i < 256; i++) {
-            Run6502(&cpu);
-
-            /* render scanline */
-            {
-                auto *screen = (uint16_t *) &SCREEN;
-                int offset = lcd_registers[2] / 4 + lcd_registers[3] * 0x30;
-
-                for (int y = 0; y < WATARA_SCREEN_HEIGHT; y++) {
-                    auto *vram_line = VRAM + offset;
-                    uint8_t pixel = *vram_line++;
-
-                    for (int x = lcd_registers[2] & 3; x < lcd_registers[0];) {
-                        screen[x++] = watara_palette[pixel & 3];
-                        pixel >>= 2;
-                        screen[x++] = watara_palette[pixel & 3];
-                        pixel >>= 2;
-                        screen[x++] = watara_palette[pixel & 3];
-                        pixel >>= 2;
-                        screen[x++] = watara_palette[pixel & 3];
-
-                        pixel = *vram_line++;
-                    }
-                    screen += 160;
-                    offset += 0x30;
+        const uint16_t *screen = &console->screen[0][0];
+        handle_movie_key(argv[1], false);
+        handle_state_keys(argv[1]);
+
+        // Backspace steps back one frame at a time instead of running one
+        if (key_status[0x08] && !cable && rewind_step(&history, console)) {
+            machine_render(console);
+            if (recording)
+                movie_truncate(&movie, movie.frames - 1);
+        } else {
+            read_buttons();
+            if (recording)
+                movie_record(&movie, console->buttons);
+#ifdef WATARA_DEBUGGER
+            machine_begin_frame(console);
+            debug_run();
+            machine_end_frame(console);
+#else
+            machine_run_frame(console);
+#endif
+            queue_audio(console);
+            rewind_push(&history, console);
+
+            if (shadow) {
+                QueryPerformanceCounter(&ahead_start);
+                machine_run_ahead(console, shadow, run_ahead, ahead_state);
+                QueryPerformanceCounter(&ahead_end);
+                ahead_ticks += ahead_end.QuadPart - ahead_start.QuadPart;
+                screen = &shadow->screen[0][0];
+            }
+
+            // Cycles the core did not have to emulate because the game was spinning in an idle loop
+            idle_cycles += console->cpu.ISkipped;
+            console->cpu.ISkipped = 0;
+            lines_drawn += console->lcd_lines_drawn;
+            if (++idle_frames == 60) {
+                printf("Idle: %d of 65536 cycles per frame skipped\n", idle_cycles / idle_frames);
+                printf("LCD: %d of %d lines drawn per frame\n", lines_drawn / idle_frames, WATARA_SCREEN_HEIGHT);
+                if (shadow)
+                    printf("Run-ahead: %d us of host time per extra frame\n",
+                           (int) (ahead_ticks * 1000000 / queryperf.QuadPart / idle_frames / run_ahead));
+                if (cable) {
+                    printf("Link: %llu of %llu syncs waited for the other console\n",
+                           (unsigned long long) cable->waits, (unsigned long long) cable->syncs);
+                    cable->waits = cable->syncs = 0;
                 }
+                idle_cycles = idle_frames = lines_drawn = 0;
+                ahead_ticks = 0;
             }
         }
 
-        // The NMI occurs every 65536 clock cycles (61.04Hz) regardless of the rate that the LCD refreshes.
-        if (nmi_enabled)
-            Int6502(&cpu, INT_NMI);
-
+        if (ghosting_level) {
+            lcd_ghost(&ghost_screen[0][0], screen, WATARA_SCREEN_WIDTH * WATARA_SCREEN_HEIGHT, ghosting_level);
+            screen = &ghost_screen[0][0];
+        }
 
-        if (mfb_update(SCREEN, 60) == -1)
+        // Only the lines that changed go to the window, unless they all may have: the shadow machine draws every line
+        // each time, and ghosting fades lines the LCD did not draw
+        const int update = shadow || ghosting_level ? present(screen, nullptr, 0)
+                                                    : present(screen, rects, changed_rects(console, rects));
+        if (update == -1) {
+            // Unplugging lets the other console run on by itself
+            if (cable)
+                link_close(cable);
             return 1;
+        }
     }
-}
+}
\ No newline at end of file
@@ -0,0 +1,89 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "movie.h"
+
+void movie_init(MOVIE *movie, uint32_t rom_hash) {
+    memset(movie, 0, sizeof(*movie));
+    movie->rom_hash = rom_hash;
+}
+
+void movie_free(MOVIE *movie) {
+    free(movie->buttons);
+    memset(movie, 0, sizeof(*movie));
+}
+
+void movie_record(MOVIE *movie, uint8_t buttons) {
+    if (movie->frames == movie->capacity) {
+        const uint32_t capacity = movie->capacity ? movie->capacity * 2 : 4096;
+        auto *grown = (uint8_t *) realloc(movie->buttons, capacity);
+        if (!grown)
+            return;
+
+        movie->buttons = grown;
+        movie->capacity = capacity;
+    }
+
+    movie->buttons[movie->frames++] = buttons;
+}
+
+void movie_truncate(MOVIE *movie, uint32_t frames) {
+    if (frames < movie->frames)
+        movie->frames = frames;
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t) (value >> (i * 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+bool movie_save(const MOVIE *movie, const char *pathname) {
+    uint8_t header[16];
+    put_u32(header, MOVIE_MAGIC);
+    put_u32(header + 4, MOVIE_VERSION);
+    put_u32(header + 8, movie->rom_hash);
+    put_u32(header + 12, movie->frames);
+
+    FILE *file = fopen(pathname, "wb");
+    if (!file)
+        return false;
+
+    bool saved = fwrite(header, sizeof(header), 1, file) == 1 &&
+                 fwrite(movie->buttons, sizeof(uint8_t), movie->frames, file) == movie->frames;
+    if (fclose(file))
+        saved = false;
+    return saved;
+}
+
+bool movie_load(MOVIE *movie, const char *pathname) {
+    uint8_t header[16];
+
+    FILE *file = fopen(pathname, "rb");
+    if (!file)
+        return false;
+
+    if (fread(header, sizeof(header), 1, file) != 1 || get_u32(header) != MOVIE_MAGIC ||
+        get_u32(header + 4) != MOVIE_VERSION) {
+        fclose(file);
+        return false;
+    }
+
+    const uint32_t frames = get_u32(header + 12);
+    auto *buttons = (uint8_t *) malloc(frames ? frames : 1);
+    if (!buttons || fread(buttons, sizeof(uint8_t), frames, file) != frames) {
+        free(buttons);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+
+    movie_free(movie);
+    movie->rom_hash = get_u32(header + 8);
+    movie->frames = movie->capacity = frames;
+    movie->buttons = buttons;
+    return true;
+}
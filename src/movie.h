@@ -0,0 +1,39 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define MOVIE_MAGIC 0x4D565357 // "WSVM"
+#define MOVIE_VERSION 1
+
+/*
+ * Input movie: the controller byte at 2020 for every frame from power-on. The controller is latched once per frame
+ * and nothing else from the host reaches the machine, so replaying the bytes into a machine reset with the same ROM
+ * runs the same frames bit for bit.
+ *
+ * On disk it is a header of four little-endian uint32_t, magic, version, ROM hash and frame count, followed by one
+ * byte per frame.
+ */
+typedef struct {
+    uint32_t rom_hash;
+    uint32_t frames;
+    uint32_t capacity;
+    uint8_t *buttons;
+} MOVIE;
+
+// Starts an empty movie for the ROM with the given hash
+void movie_init(MOVIE *movie, uint32_t rom_hash);
+void movie_free(MOVIE *movie);
+
+// Adds the buttons of the next frame
+void movie_record(MOVIE *movie, uint8_t buttons);
+
+// Drops the frames from the given one on, for a machine rewound to it
+void movie_truncate(MOVIE *movie, uint32_t frames);
+
+// Return false if the file cannot be written or read, or is not a movie of this version
+bool movie_save(const MOVIE *movie, const char *pathname);
+bool movie_load(MOVIE *movie, const char *pathname);
+
+#endif //MOVIE_H
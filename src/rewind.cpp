@@ -0,0 +1,174 @@
+#include <cstdint>
+#include <cstring>
+
+#include "rewind.h"
+
+#define STATE_WORDS (sizeof(MACHINE_STATE) / sizeof(uint64_t))
+static_assert(sizeof(MACHINE_STATE) % sizeof(uint64_t) == 0, "Deltas work on whole words of the state");
+static_assert(STATE_WORDS <= UINT16_MAX, "Run lengths are 16-bit");
+
+// Every other word changed: one run header per changed word, plus the end
+#define MAX_DELTA_SIZE ((STATE_WORDS + 1) * 2 * sizeof(uint16_t) + STATE_WORDS * sizeof(uint64_t))
+
+static inline uint64_t load_word(const uint8_t *p) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+static inline void store_word(uint8_t *p, uint64_t word) {
+    memcpy(p, &word, sizeof(word));
+}
+
+static inline void store_run(uint8_t *p, uint16_t skip, uint16_t count) {
+    memcpy(p, &skip, sizeof(skip));
+    memcpy(p + sizeof(skip), &count, sizeof(count));
+}
+
+/*
+ * XORs next into state, so that state becomes next, and writes the XOR encoded as runs to out.
+ * Returns the length of the delta.
+ */
+static size_t encode_delta(MACHINE_STATE *state, const MACHINE_STATE *next, uint8_t *out) {
+    auto *a = (uint8_t *) state;
+    auto *b = (const uint8_t *) next;
+    uint8_t *p = out;
+    size_t i = 0;
+
+    while (i < STATE_WORDS) {
+        const size_t from = i;
+        while (i < STATE_WORDS && load_word(a + i * 8) == load_word(b + i * 8)) i++;
+        if (i == STATE_WORDS)
+            break;
+
+        uint8_t *run = p;
+        p += 2 * sizeof(uint16_t);
+
+        const size_t start = i;
+        for (; i < STATE_WORDS; i++) {
+            const uint64_t x = load_word(a + i * 8) ^ load_word(b + i * 8);
+            if (!x)
+                break;
+            store_word(p, x);
+            store_word(a + i * 8, load_word(b + i * 8));
+            p += sizeof(uint64_t);
+        }
+        store_run(run, (uint16_t) (start - from), (uint16_t) (i - start));
+    }
+
+    store_run(p, 0, 0);
+    return p + 2 * sizeof(uint16_t) - out;
+}
+
+// XORs a delta into state
+static void apply_delta(MACHINE_STATE *state, const uint8_t *delta) {
+    auto *a = (uint8_t *) state;
+    size_t i = 0;
+
+    for (;;) {
+        uint16_t skip, count;
+        memcpy(&skip, delta, sizeof(skip));
+        memcpy(&count, delta + sizeof(skip), sizeof(count));
+        delta += 2 * sizeof(uint16_t);
+        if (!count)
+            return;
+
+        for (i += skip; count--; i++, delta += sizeof(uint64_t))
+            store_word(a + i * 8, load_word(a + i * 8) ^ load_word(delta));
+    }
+}
+
+bool rewind_init(REWIND *rewind, int max_frames, size_t ring_size) {
+    memset(rewind, 0, sizeof(*rewind));
+    if (max_frames < 1 || ring_size < MAX_DELTA_SIZE)
+        return false;
+
+    rewind->ring = new uint8_t[ring_size];
+    rewind->ring_size = ring_size;
+    rewind->frames = new REWIND_FRAME[max_frames];
+    rewind->max_frames = max_frames;
+    rewind->scratch = new uint8_t[MAX_DELTA_SIZE];
+    return true;
+}
+
+void rewind_free(REWIND *rewind) {
+    delete[] rewind->ring;
+    delete[] rewind->frames;
+    delete[] rewind->scratch;
+    memset(rewind, 0, sizeof(*rewind));
+}
+
+void rewind_clear(REWIND *rewind) {
+    rewind->has_keyframe = false;
+    rewind->write = 0;
+    rewind->first = 0;
+    rewind->count = 0;
+}
+
+// Finds room for size bytes, dropping the oldest frames until there is
+static size_t rewind_allocate(REWIND *rewind, size_t size) {
+    for (;;) {
+        if (!rewind->count) {
+            rewind->write = 0;
+            return 0;
+        }
+
+        if (rewind->count < rewind->max_frames) {
+            const size_t oldest = rewind->frames[rewind->first].offset;
+
+            if (oldest < rewind->write) {
+                // Frames lie in oldest..write, free space after them and before them
+                if (rewind->write + size <= rewind->ring_size) return rewind->write;
+                if (size <= oldest) return 0;
+            } else if (rewind->write + size <= oldest) {
+                // Newer frames wrapped around to the start
+                return rewind->write;
+            }
+        }
+
+        rewind->first = (rewind->first + 1) % rewind->max_frames;
+        rewind->count--;
+    }
+}
+
+void rewind_push(REWIND *rewind, const MACHINE *m) {
+    if (!rewind->has_keyframe) {
+        machine_save_state(m, &rewind->keyframe);
+        rewind->has_keyframe = true;
+        return;
+    }
+
+    machine_save_state(m, &rewind->next);
+    const size_t size = encode_delta(&rewind->keyframe, &rewind->next, rewind->scratch);
+
+    const size_t offset = rewind_allocate(rewind, size);
+    memcpy(rewind->ring + offset, rewind->scratch, size);
+    rewind->write = offset + size;
+
+    REWIND_FRAME *frame = &rewind->frames[(rewind->first + rewind->count) % rewind->max_frames];
+    frame->offset = offset;
+    frame->size = size;
+    rewind->count++;
+}
+
+bool rewind_step(REWIND *rewind, MACHINE *m) {
+    if (!rewind->has_keyframe || !rewind->count)
+        return false;
+
+    const int newest = (rewind->first + rewind->count - 1) % rewind->max_frames;
+    const REWIND_FRAME *frame = &rewind->frames[newest];
+
+    apply_delta(&rewind->keyframe, rewind->ring + frame->offset);
+    rewind->write = frame->offset;
+    rewind->count--;
+
+    return machine_load_state(m, &rewind->keyframe);
+}
+
+size_t rewind_used(const REWIND *rewind) {
+    size_t used = 0;
+
+    for (int i = 0; i < rewind->count; i++)
+        used += rewind->frames[(rewind->first + i) % rewind->max_frames].size;
+    return used;
+}
@@ -0,0 +1,58 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "machine.h"
+
+// One frame of history: where its delta is in the ring and how long it is
+typedef struct {
+    size_t offset;
+    size_t size;
+} REWIND_FRAME;
+
+/*
+ * Rewind history: the newest save state in full, the keyframe, and for every frame before it the XOR of that frame's
+ * state with the next one, run-length encoded. XOR works both ways, so stepping back one frame decodes one delta
+ * into the keyframe, which then is the state of the frame before.
+ *
+ * Deltas are packed one after another into a byte ring allocated once; when it or the frame list is full the oldest
+ * frames are dropped. A delta is a list of runs over the state taken as 64-bit words:
+ *   uint16_t skip, count  words left alone, words XORed
+ *   uint64_t xor[count]
+ * ending with a run whose count is 0.
+ */
+typedef struct {
+    MACHINE_STATE keyframe;   // State after the newest frame pushed
+    MACHINE_STATE next;       // State being pushed
+    bool has_keyframe;
+
+    uint8_t *ring;
+    size_t ring_size;
+    size_t write;             // Where the newest delta ends
+    REWIND_FRAME *frames;     // Deltas, oldest first from first
+    int max_frames;
+    int first;
+    int count;
+
+    uint8_t *scratch;         // Worst-case delta, encoded before it is copied into the ring
+} REWIND;
+
+// Allocates room for up to max_frames deltas in ring_size bytes, returns false if that is not possible
+bool rewind_init(REWIND *rewind, int max_frames, size_t ring_size);
+void rewind_free(REWIND *rewind);
+
+// Drops the history, the next push starts over from a new keyframe
+void rewind_clear(REWIND *rewind);
+
+// Records the state of m, call it once after every frame
+void rewind_push(REWIND *rewind, const MACHINE *m);
+
+// Puts m back one frame, returns false when the history is used up
+bool rewind_step(REWIND *rewind, MACHINE *m);
+
+// Bytes of the ring the deltas take up
+size_t rewind_used(const REWIND *rewind);
+
+#endif //REWIND_H
@@ -0,0 +1,116 @@
+#include <cstdio>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "rom.h"
+
+// Maps the whole file read-only, leaving its size in size and the handles to unmap it in rom
+static const uint8_t *map_file(ROM_IMAGE *rom, const char *pathname, size_t *size) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(pathname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    LARGE_INTEGER length;
+    *size = GetFileSizeEx(file, &length) ? (size_t) length.QuadPart : 0;
+    if (*size == 0 || *size > ROM_MAX_SIZE) {
+        CloseHandle(file);
+        return nullptr;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        *size = 0;
+        return nullptr;
+    }
+
+    rom->file = file;
+    rom->mapping = mapping;
+    return (const uint8_t *) view;
+#else
+    const int file = open(pathname, O_RDONLY);
+    if (file < 0)
+        return nullptr;
+
+    struct stat status;
+    *size = fstat(file, &status) ? 0 : (size_t) status.st_size;
+    if (*size == 0 || *size > ROM_MAX_SIZE) {
+        close(file);
+        return nullptr;
+    }
+
+    // The mapping keeps the file open
+    void *view = mmap(nullptr, *size, PROT_READ, MAP_SHARED, file, 0);
+    close(file);
+    if (view == MAP_FAILED) {
+        *size = 0;
+        return nullptr;
+    }
+    return (const uint8_t *) view;
+#endif
+}
+
+static void unmap_file(ROM_IMAGE *rom) {
+#ifdef _WIN32
+    UnmapViewOfFile(rom->data);
+    CloseHandle((HANDLE) rom->mapping);
+    CloseHandle((HANDLE) rom->file);
+#else
+    munmap((void *) rom->data, rom->size);
+#endif
+}
+
+ROM_IMAGE *rom_open(const char *pathname) {
+    ROM_IMAGE *rom = new ROM_IMAGE();
+
+    rom->data = map_file(rom, pathname, &rom->size);
+    if (!rom->data) {
+        if (rom->size)
+            printf("%s is %zu bytes, carts are 16 KB banks up to %d KB\n", pathname, rom->size, ROM_MAX_SIZE >> 10);
+        else
+            printf("Cannot map %s\n", pathname);
+        delete rom;
+        return nullptr;
+    }
+
+    if (rom->size % ROM_BANK_SIZE) {
+        printf("%s is %zu bytes, carts are 16 KB banks up to %d KB\n", pathname, rom->size, ROM_MAX_SIZE >> 10);
+        unmap_file(rom);
+        delete rom;
+        return nullptr;
+    }
+
+    const size_t banks = rom->size / ROM_BANK_SIZE;
+    for (size_t bank = 0; bank < ROM_BANKS; bank++)
+        rom->banks[bank] = rom->data + (bank % banks) * ROM_BANK_SIZE;
+    rom->hi = rom->data + rom->size - ROM_BANK_SIZE;
+
+    rom->hash = 2166136261u;
+    for (size_t i = 0; i < rom->size; i++)
+        rom->hash = (rom->hash ^ rom->data[i]) * 16777619u;
+
+    return rom;
+}
+
+void rom_retain(ROM_IMAGE *rom) {
+    rom->users++;
+}
+
+void rom_release(ROM_IMAGE *rom) {
+    if (--rom->users > 0)
+        return;
+
+    unmap_file(rom);
+    delete rom;
+}
@@ -0,0 +1,39 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define ROM_BANK_SIZE 16384
+#define ROM_BANKS 8 // Selected by bits 5-7 of 2026
+#define ROM_MAX_SIZE (ROM_BANKS * ROM_BANK_SIZE)
+
+/*
+ * Cartridge image, the file mapped read-only. Any number of machines can run from the same image, which stays mapped
+ * until the last of them lets it go.
+ *
+ * Carts are 16 KB banks, up to 8 of them. 8000-BFFF shows the bank selected through 2026, mirrored on carts with
+ * fewer banks (a 32 KB cart repeats its 2 banks 4 times, a 64 KB one its 4 banks twice), and C000-FFFF always shows
+ * the last bank. Both are worked out once when the image is opened.
+ */
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    uint32_t hash;                     // FNV-1a of the image, save states and movies only load into the ROM they were made with
+    const uint8_t *banks[ROM_BANKS];   // 8000-BFFF for each bank number
+    const uint8_t *hi;                 // C000-FFFF
+    int users;                         // Machines running from it, see rom_retain and rom_release
+
+    // Platform mapping handles
+    void *file;
+    void *mapping;
+} ROM_IMAGE;
+
+// Maps the cartridge at pathname, returns NULL after printing why if it cannot be opened or is not 16 KB banks
+ROM_IMAGE *rom_open(const char *pathname);
+
+// Counts one more or one less machine running from rom, the last release unmaps it. Call both from one thread.
+void rom_retain(ROM_IMAGE *rom);
+void rom_release(ROM_IMAGE *rom);
+
+#endif //ROM_H
@@ -0,0 +1,407 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SCALER_SSE2
+#endif
+
+#include "scaler.h"
+
+static const char *const filter_names[SCALER_FILTER_COUNT] = {"nearest", "scale2x", "scale3x", "scale4x", "lcd"};
+
+// 3/4 of each RGB565 channel: a half plus a quarter, masked so that no channel shifts into the next
+static inline uint16_t darken(uint16_t pixel) {
+    return (uint16_t) (((pixel >> 1) & 0x7BEF) + ((pixel >> 2) & 0x39E7));
+}
+
+static void nearest_row(uint16_t *out, const uint16_t *row, int width, int factor) {
+    for (int x = 0; x < width; x++) {
+        for (int i = 0; i < factor; i++)
+            out[x * factor + i] = row[x];
+    }
+}
+
+static void darken_row(uint16_t *out, const uint16_t *row, int width) {
+    for (int x = 0; x < width; x++)
+        out[x] = darken(row[x]);
+}
+
+/*
+ * Scale2x and Scale3x name the pixels around E as
+ *   A B C
+ *   D E F
+ *   G H I
+ * with the rows above and below the frame and the columns beside it repeating its edges. Where B and H differ and D
+ * and F differ E sits on an edge, and the corners of its square take the colour of the two neighbours that match.
+ */
+static void scale2x_pixels(uint16_t *out0, uint16_t *out1, const uint16_t *up, const uint16_t *row,
+                           const uint16_t *down, int width, int from, int to) {
+    for (int x = from; x < to; x++) {
+        const uint16_t B = up[x], D = row[x > 0 ? x - 1 : x], E = row[x], F = row[x < width - 1 ? x + 1 : x];
+        const uint16_t H = down[x];
+        const bool edge = B != H && D != F;
+
+        out0[x * 2] = edge && D == B ? D : E;
+        out0[x * 2 + 1] = edge && B == F ? F : E;
+        out1[x * 2] = edge && D == H ? D : E;
+        out1[x * 2 + 1] = edge && H == F ? F : E;
+    }
+}
+
+static void scale3x_pixels(uint16_t *out0, uint16_t *out1, uint16_t *out2, const uint16_t *up, const uint16_t *row,
+                           const uint16_t *down, int width, int from, int to) {
+    for (int x = from; x < to; x++) {
+        const int left = x > 0 ? x - 1 : x, right = x < width - 1 ? x + 1 : x;
+        const uint16_t A = up[left], B = up[x], C = up[right];
+        const uint16_t D = row[left], E = row[x], F = row[right];
+        const uint16_t G = down[left], H = down[x], I = down[right];
+        const bool edge = B != H && D != F;
+        const bool db = edge && D == B, bf = edge && B == F, dh = edge && D == H, hf = edge && H == F;
+
+        out0[x * 3] = db ? D : E;
+        out0[x * 3 + 1] = (db && E != C) || (bf && E != A) ? B : E;
+        out0[x * 3 + 2] = bf ? F : E;
+        out1[x * 3] = (db && E != G) || (dh && E != A) ? D : E;
+        out1[x * 3 + 1] = E;
+        out1[x * 3 + 2] = (bf && E != I) || (hf && E != C) ? F : E;
+        out2[x * 3] = dh ? D : E;
+        out2[x * 3 + 1] = (dh && E != I) || (hf && E != G) ? H : E;
+        out2[x * 3 + 2] = hf ? F : E;
+    }
+}
+
+#ifdef SCALER_SSE2
+static inline __m128i select_sse2(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/*
+ * Stores a0 b0 c0 a1 b1 c1 ... a7 b7 c7 as three vectors. Each takes its pixels from a, b and c in turns of 3 lanes,
+ * in lanes 0 3 6, 1 4 7 and 2 5: shifting the first pixel wanted to lane 0, 1 or 0 and repeating dwords 0 0 1 1 or
+ * 0 0 0 0 puts the next ones 3 lanes apart.
+ */
+static inline void store3_sse2(uint16_t *out, __m128i a, __m128i b, __m128i c) {
+    const __m128i first = _mm_setr_epi16(-1, 0, 0, -1, 0, 0, -1, 0);
+    const __m128i second = _mm_setr_epi16(0, -1, 0, 0, -1, 0, 0, -1);
+    const __m128i third = _mm_setr_epi16(0, 0, -1, 0, 0, -1, 0, 0);
+    const auto merge = [&](__m128i x, __m128i y, __m128i z) {
+        return _mm_or_si128(_mm_or_si128(_mm_and_si128(x, first), _mm_and_si128(y, second)), _mm_and_si128(z, third));
+    };
+
+    _mm_storeu_si128((__m128i *) out, merge(_mm_shuffle_epi32(a, 0x50), _mm_shuffle_epi32(_mm_slli_si128(b, 2), 0x50),
+                                            _mm_shuffle_epi32(c, 0x00)));
+    _mm_storeu_si128((__m128i *) (out + 8), merge(_mm_shuffle_epi32(_mm_srli_si128(c, 4), 0x50),
+                                                  _mm_shuffle_epi32(_mm_srli_si128(a, 4), 0x50),
+                                                  _mm_shuffle_epi32(_mm_srli_si128(b, 6), 0x00)));
+    _mm_storeu_si128((__m128i *) (out + 16), merge(_mm_shuffle_epi32(_mm_srli_si128(b, 10), 0x50),
+                                                   _mm_shuffle_epi32(_mm_srli_si128(c, 8), 0x50),
+                                                   _mm_shuffle_epi32(_mm_srli_si128(a, 12), 0x00)));
+}
+
+// Whole vectors of the row, with the pixels no vector covers in plain C
+static void nearest_row_sse2(uint16_t *out, const uint16_t *row, int width, int factor) {
+    int x = 0;
+
+    switch (factor) {
+        case 1:
+            memcpy(out, row, width * sizeof(uint16_t));
+            return;
+        case 2:
+        case 4:
+            for (; x + 8 <= width; x += 8) {
+                const __m128i pixels = _mm_loadu_si128((const __m128i *) (row + x));
+                const __m128i low = _mm_unpacklo_epi16(pixels, pixels), high = _mm_unpackhi_epi16(pixels, pixels);
+                if (factor == 2) {
+                    _mm_storeu_si128((__m128i *) (out + x * 2), low);
+                    _mm_storeu_si128((__m128i *) (out + x * 2 + 8), high);
+                } else {
+                    _mm_storeu_si128((__m128i *) (out + x * 4), _mm_unpacklo_epi32(low, low));
+                    _mm_storeu_si128((__m128i *) (out + x * 4 + 8), _mm_unpackhi_epi32(low, low));
+                    _mm_storeu_si128((__m128i *) (out + x * 4 + 16), _mm_unpacklo_epi32(high, high));
+                    _mm_storeu_si128((__m128i *) (out + x * 4 + 24), _mm_unpackhi_epi32(high, high));
+                }
+            }
+            break;
+        case 3:
+            for (; x + 8 <= width; x += 8) {
+                const __m128i pixels = _mm_loadu_si128((const __m128i *) (row + x));
+                store3_sse2(out + x * 3, pixels, pixels, pixels);
+            }
+            break;
+        default:
+            // 8 copies of each pixel, the next pixel's overwriting the ones beyond its square; not for the last one,
+            // whose extra copies would land in the next output row
+            for (; x < width - 1; x++)
+                _mm_storeu_si128((__m128i *) (out + x * factor), _mm_set1_epi16((short) row[x]));
+            break;
+    }
+    nearest_row(out + x * factor, row + x, width - x, factor);
+}
+
+static void darken_row_sse2(uint16_t *out, const uint16_t *row, int width) {
+    const __m128i halves = _mm_set1_epi16(0x7BEF), quarters = _mm_set1_epi16(0x39E7);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m128i pixels = _mm_loadu_si128((const __m128i *) (row + x));
+        _mm_storeu_si128((__m128i *) (out + x), _mm_add_epi16(_mm_and_si128(_mm_srli_epi16(pixels, 1), halves),
+                                                              _mm_and_si128(_mm_srli_epi16(pixels, 2), quarters)));
+    }
+    darken_row(out + x, row + x, width - x);
+}
+
+// 8 pixels at a time from x = 1, each vector reading the pixels on either side of it
+static void scale2x_row_sse2(uint16_t *out0, uint16_t *out1, const uint16_t *up, const uint16_t *row,
+                             const uint16_t *down, int width) {
+    const __m128i ones = _mm_set1_epi16(-1);
+
+    int x = 1;
+    for (; x + 9 <= width; x += 8) {
+        const __m128i B = _mm_loadu_si128((const __m128i *) (up + x));
+        const __m128i D = _mm_loadu_si128((const __m128i *) (row + x - 1));
+        const __m128i E = _mm_loadu_si128((const __m128i *) (row + x));
+        const __m128i F = _mm_loadu_si128((const __m128i *) (row + x + 1));
+        const __m128i H = _mm_loadu_si128((const __m128i *) (down + x));
+        const __m128i edge = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi16(B, H), _mm_cmpeq_epi16(D, F)), ones);
+
+        const __m128i e0 = select_sse2(_mm_and_si128(edge, _mm_cmpeq_epi16(D, B)), D, E);
+        const __m128i e1 = select_sse2(_mm_and_si128(edge, _mm_cmpeq_epi16(B, F)), F, E);
+        const __m128i e2 = select_sse2(_mm_and_si128(edge, _mm_cmpeq_epi16(D, H)), D, E);
+        const __m128i e3 = select_sse2(_mm_and_si128(edge, _mm_cmpeq_epi16(H, F)), F, E);
+
+        _mm_storeu_si128((__m128i *) (out0 + x * 2), _mm_unpacklo_epi16(e0, e1));
+        _mm_storeu_si128((__m128i *) (out0 + x * 2 + 8), _mm_unpackhi_epi16(e0, e1));
+        _mm_storeu_si128((__m128i *) (out1 + x * 2), _mm_unpacklo_epi16(e2, e3));
+        _mm_storeu_si128((__m128i *) (out1 + x * 2 + 8), _mm_unpackhi_epi16(e2, e3));
+    }
+    scale2x_pixels(out0, out1, up, row, down, width, 0, 1);
+    scale2x_pixels(out0, out1, up, row, down, width, x, width);
+}
+
+static void scale3x_row_sse2(uint16_t *out0, uint16_t *out1, uint16_t *out2, const uint16_t *up, const uint16_t *row,
+                             const uint16_t *down, int width) {
+    const __m128i ones = _mm_set1_epi16(-1);
+
+    int x = 1;
+    for (; x + 9 <= width; x += 8) {
+        const __m128i A = _mm_loadu_si128((const __m128i *) (up + x - 1));
+        const __m128i B = _mm_loadu_si128((const __m128i *) (up + x));
+        const __m128i C = _mm_loadu_si128((const __m128i *) (up + x + 1));
+        const __m128i D = _mm_loadu_si128((const __m128i *) (row + x - 1));
+        const __m128i E = _mm_loadu_si128((const __m128i *) (row + x));
+        const __m128i F = _mm_loadu_si128((const __m128i *) (row + x + 1));
+        const __m128i G = _mm_loadu_si128((const __m128i *) (down + x - 1));
+        const __m128i H = _mm_loadu_si128((const __m128i *) (down + x));
+        const __m128i I = _mm_loadu_si128((const __m128i *) (down + x + 1));
+        const __m128i edge = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi16(B, H), _mm_cmpeq_epi16(D, F)), ones);
+
+        const __m128i db = _mm_and_si128(edge, _mm_cmpeq_epi16(D, B));
+        const __m128i bf = _mm_and_si128(edge, _mm_cmpeq_epi16(B, F));
+        const __m128i dh = _mm_and_si128(edge, _mm_cmpeq_epi16(D, H));
+        const __m128i hf = _mm_and_si128(edge, _mm_cmpeq_epi16(H, F));
+        const __m128i ea = _mm_cmpeq_epi16(E, A), ec = _mm_cmpeq_epi16(E, C);
+        const __m128i eg = _mm_cmpeq_epi16(E, G), ei = _mm_cmpeq_epi16(E, I);
+
+        store3_sse2(out0 + x * 3, select_sse2(db, D, E),
+                    select_sse2(_mm_or_si128(_mm_andnot_si128(ec, db), _mm_andnot_si128(ea, bf)), B, E),
+                    select_sse2(bf, F, E));
+        store3_sse2(out1 + x * 3, select_sse2(_mm_or_si128(_mm_andnot_si128(eg, db), _mm_andnot_si128(ea, dh)), D, E),
+                    E, select_sse2(_mm_or_si128(_mm_andnot_si128(ei, bf), _mm_andnot_si128(ec, hf)), F, E));
+        store3_sse2(out2 + x * 3, select_sse2(dh, D, E),
+                    select_sse2(_mm_or_si128(_mm_andnot_si128(ei, dh), _mm_andnot_si128(eg, hf)), H, E),
+                    select_sse2(hf, F, E));
+    }
+    scale3x_pixels(out0, out1, out2, up, row, down, width, 0, 1);
+    scale3x_pixels(out0, out1, out2, up, row, down, width, x, width);
+}
+#endif
+
+static void scale_nearest(const SCALER *s, uint16_t *out, const uint16_t *row, int width) {
+#ifdef SCALER_SSE2
+    if (s->vector)
+        return nearest_row_sse2(out, row, width, s->factor);
+#endif
+    nearest_row(out, row, width, s->factor);
+}
+
+static void scale_darken(const SCALER *s, uint16_t *out, const uint16_t *row, int width) {
+#ifdef SCALER_SSE2
+    if (s->vector)
+        return darken_row_sse2(out, row, width);
+#endif
+    darken_row(out, row, width);
+}
+
+static void scale_2x(const SCALER *s, uint16_t *out0, uint16_t *out1, const uint16_t *up, const uint16_t *row,
+                     const uint16_t *down, int width) {
+#ifdef SCALER_SSE2
+    if (s->vector)
+        return scale2x_row_sse2(out0, out1, up, row, down, width);
+#endif
+    scale2x_pixels(out0, out1, up, row, down, width, 0, width);
+}
+
+static void scale_3x(const SCALER *s, uint16_t *out0, uint16_t *out1, uint16_t *out2, const uint16_t *up,
+                     const uint16_t *row, const uint16_t *down, int width) {
+#ifdef SCALER_SSE2
+    if (s->vector)
+        return scale3x_row_sse2(out0, out1, out2, up, row, down, width);
+#endif
+    scale3x_pixels(out0, out1, out2, up, row, down, width, 0, width);
+}
+
+// Scales the band-th of bands horizontal bands of the current pass's source rows
+static void scale_band(SCALER *s, int band) {
+    // The second Scale4x pass scales the first one's output
+    const bool second = s->pass == 1;
+    const uint16_t *frame = second ? s->twice : s->frame;
+    const int width = second ? s->width * 2 : s->width, height = second ? s->height * 2 : s->height;
+    const int first = height * band / s->bands, last = height * (band + 1) / s->bands;
+
+    for (int y = first; y < last; y++) {
+        const uint16_t *row = frame + y * width;
+        const uint16_t *up = y > 0 ? row - width : row, *down = y < height - 1 ? row + width : row;
+
+        switch (s->filter) {
+            case SCALER_NEAREST:
+            case SCALER_LCD_GRID: {
+                const int stride = width * s->factor;
+                uint16_t *out = s->out + (size_t) y * s->factor * stride;
+                scale_nearest(s, out, row, width);
+
+                // The grid: the square's bottom row, then its right column in the rows above
+                int copies = s->factor - 1;
+                if (s->filter == SCALER_LCD_GRID) {
+                    scale_darken(s, out + copies * stride, out, stride);
+                    for (int x = s->factor - 1; x < stride; x += s->factor)
+                        out[x] = darken(out[x]);
+                    copies--;
+                }
+                for (int i = 1; i <= copies; i++)
+                    memcpy(out + i * stride, out, stride * sizeof(uint16_t));
+                break;
+            }
+            case SCALER_SCALE2X:
+            case SCALER_SCALE4X: {
+                uint16_t *out = (s->filter == SCALER_SCALE4X && !second ? s->twice : s->out) + (size_t) y * 4 * width;
+                scale_2x(s, out, out + width * 2, up, row, down, width);
+                break;
+            }
+            case SCALER_SCALE3X: {
+                uint16_t *out = s->out + (size_t) y * 9 * width;
+                scale_3x(s, out, out + width * 3, out + width * 6, up, row, down, width);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+static void worker(SCALER *s, int band) {
+    uint64_t generation = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(s->mutex);
+            s->start.wait(lock, [&] { return s->quit || s->generation != generation; });
+            if (s->quit)
+                return;
+            generation = s->generation;
+        }
+
+        scale_band(s, band);
+
+        std::lock_guard<std::mutex> lock(s->mutex);
+        if (--s->pending == 0)
+            s->done.notify_one();
+    }
+}
+
+// Runs one pass over every band, the caller taking band 0, and returns once all of them are done
+static void run_pass(SCALER *s, int pass) {
+    s->pass = pass;
+
+    if (!s->workers.empty()) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        s->pending = (int) s->workers.size();
+        s->generation++;
+        s->start.notify_all();
+    }
+
+    scale_band(s, 0);
+
+    if (!s->workers.empty()) {
+        std::unique_lock<std::mutex> lock(s->mutex);
+        s->done.wait(lock, [&] { return s->pending == 0; });
+    }
+}
+
+bool scaler_parse(const char *name, SCALER_FILTER *filter) {
+    for (int i = 0; i < SCALER_FILTER_COUNT; i++) {
+        if (!strcmp(name, filter_names[i])) {
+            *filter = (SCALER_FILTER) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+int scaler_factor(SCALER_FILTER filter, int factor) {
+    switch (filter) {
+        case SCALER_SCALE2X: return 2;
+        case SCALER_SCALE3X: return 3;
+        case SCALER_SCALE4X: return 4;
+        default: return factor;
+    }
+}
+
+SCALER *scaler_new(int width, int height, SCALER_FILTER filter, int factor, int threads) {
+    factor = scaler_factor(filter, factor);
+    if (factor < 1 || factor > SCALER_MAX_FACTOR || (filter == SCALER_LCD_GRID && factor < 2))
+        return nullptr;
+
+    SCALER *s = new SCALER();
+    s->filter = filter;
+    s->factor = factor;
+    s->width = width;
+    s->height = height;
+#ifdef SCALER_SSE2
+    s->vector = true;
+#endif
+    s->out_size = (size_t) width * height * factor * factor;
+    s->out = (uint16_t *) calloc(s->out_size, sizeof(uint16_t));
+    if (filter == SCALER_SCALE4X)
+        s->twice = (uint16_t *) calloc((size_t) width * height * 4, sizeof(uint16_t));
+
+    // No more bands than source rows
+    s->bands = threads < 1 ? 1 : threads > height ? height : threads;
+    for (int band = 1; band < s->bands; band++)
+        s->workers.emplace_back(worker, s, band);
+    return s;
+}
+
+void scaler_free(SCALER *s) {
+    {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        s->quit = true;
+        s->start.notify_all();
+    }
+    for (std::thread &thread : s->workers)
+        thread.join();
+
+    free(s->out);
+    free(s->twice);
+    delete s;
+}
+
+const uint16_t *scaler_run(SCALER *s, const uint16_t *frame) {
+    s->frame = frame;
+
+    run_pass(s, 0);
+    if (s->filter == SCALER_SCALE4X)
+        run_pass(s, 1);
+    return s->out;
+}
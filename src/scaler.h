@@ -0,0 +1,71 @@
+#ifndef SCALER_H
+#define SCALER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define SCALER_MAX_FACTOR 8
+
+typedef enum {
+    SCALER_NEAREST,                // Each pixel as a square of factor by factor, any factor
+    SCALER_SCALE2X,                // Scale2x (EPX): edges between two colours smoothed, factor 2
+    SCALER_SCALE3X,                // Scale3x, the same rules over 3 by 3, factor 3
+    SCALER_SCALE4X,                // Scale2x applied twice, factor 4
+    SCALER_LCD_GRID,               // Nearest with the last row and column of every square at 3/4 brightness, factor 2 up
+    SCALER_FILTER_COUNT
+} SCALER_FILTER;
+
+/*
+ * Software scaler from RGB565 frames to RGB565 output factor times their size, for a window showing it 1:1 or at a
+ * further integer scale.
+ *
+ * A frame is cut into horizontal bands of source rows, one per thread: the caller's and threads - 1 workers, started
+ * once and woken for every frame. The bands only read the rows around them and write output rows of their own, so
+ * they need no locking between them; Scale4x runs as two Scale2x passes, all bands finishing the first before any
+ * starts the second. Rows are scaled by SSE2 kernels on x86-64, in plain C elsewhere.
+ *
+ * The output, and the Scale2x frame on the way to Scale4x, are allocated once by scaler_new and reused every frame.
+ */
+typedef struct {
+    SCALER_FILTER filter;
+    int factor;                    // Output pixels across and down for each pixel of the frame
+    int width, height;             // Of the frames
+    bool vector;                   // Scale rows with the SSE2 kernels, false to run the plain C ones
+    uint16_t *out;                 // width * factor by height * factor
+    uint16_t *twice;               // Scale4x: the frame after the first Scale2x pass
+    size_t out_size;
+
+    // Work of the current pass, read by every band
+    const uint16_t *frame;
+    int pass;
+
+    // Worker pool, one per band but the caller's: pending bands of the current pass, and a generation bumped for
+    // every pass started
+    int bands;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    uint64_t generation;
+    int pending;
+    bool quit;
+} SCALER;
+
+// Names of the filters on the command line: nearest, scale2x, scale3x, scale4x, lcd. Returns false for any other.
+bool scaler_parse(const char *name, SCALER_FILTER *filter);
+
+// The factor a filter scales by, factor itself for those that take any
+int scaler_factor(SCALER_FILTER filter, int factor);
+
+// Scales width by height frames with filter on threads threads, 1 for the caller's alone. NULL if factor does not fit.
+SCALER *scaler_new(int width, int height, SCALER_FILTER filter, int factor, int threads);
+void scaler_free(SCALER *scaler);
+
+// Scales frame into scaler->out and returns it, valid until the next call
+const uint16_t *scaler_run(SCALER *scaler, const uint16_t *frame);
+
+#endif //SCALER_H
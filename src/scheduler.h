@@ -0,0 +1,126 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdint>
+
+#include "m6502/m6502.h"
+
+// Timed hardware events, dispatched in this order when several are due on the same cycle
+typedef enum {
+    EVENT_NMI = 0,   // 65536-cycle frame clock
+    EVENT_IRQ_TIMER, // IRQ timer reached 00h
+    EVENT_AUDIO_DMA, // Audio DMA finished its sample
+    EVENT_LINK,      // Link cable lockstep, only while linked
+    EVENT_COUNT
+} EVENT;
+
+#define EVENT_NEVER UINT64_MAX
+
+// Longest slice when nothing is scheduled
+#define SCHEDULER_MAX_SLICE 65536
+
+// ICount used to stop the CPU after the current instruction.
+// It has to be below minus the longest predecoded block, which only checks ICount after its stores.
+#define SCHEDULER_STOP (-0x10000)
+
+// Called with the scheduler's context and the cycle the event was scheduled for, which may be a few cycles before the CPU got there
+typedef void (*event_handler)(void *context, uint64_t when);
+
+/*
+ * The CPU runs in slices that end at the next event: Loop6502 calls scheduler_run, which dispatches
+ * every due event and sets IPeriod to the cycles left until the next one.
+ * Inside a slice the current cycle is cycles + slice - ICount - IPending, so events added by I/O handlers can
+ * shorten the running slice by moving slice and ICount together.
+ */
+typedef struct {
+    uint64_t cycles;                     // CPU cycles up to the start of the current slice
+    int64_t slice;                       // Length of the current slice
+    uint64_t when[EVENT_COUNT];          // Cycle each event is due at, EVENT_NEVER when not scheduled
+    event_handler handlers[EVENT_COUNT];
+    M6502 *cpu;                          // CPU whose slices are timed
+    void *context;                       // Passed to the handlers
+} SCHEDULER;
+
+inline void scheduler_init(SCHEDULER *scheduler, M6502 *cpu, const event_handler handlers[EVENT_COUNT], void *context) {
+    scheduler->cycles = 0;
+    scheduler->slice = 0;
+    scheduler->cpu = cpu;
+    scheduler->context = context;
+
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        scheduler->when[i] = EVENT_NEVER;
+        scheduler->handlers[i] = handlers[i];
+    }
+}
+
+// Current CPU cycle, counting the instruction in progress when called from an I/O handler. A cached block takes its
+// whole cost off ICount up front, the part not yet due is given back from IPending.
+inline uint64_t scheduler_now(const SCHEDULER *scheduler) {
+    return scheduler->cycles + scheduler->slice - scheduler->cpu->ICount - scheduler->cpu->IPending;
+}
+
+inline bool scheduler_pending(const SCHEDULER *scheduler, const EVENT event) {
+    return scheduler->when[event] != EVENT_NEVER;
+}
+
+// Stop the CPU after the current instruction, so that Loop6502 runs at once
+inline void scheduler_stop(SCHEDULER *scheduler) {
+    const int64_t delta = scheduler->cpu->ICount - SCHEDULER_STOP;
+
+    scheduler->slice -= delta;
+    scheduler->cpu->ICount -= (int) delta;
+}
+
+inline void scheduler_add(SCHEDULER *scheduler, const EVENT event, const uint64_t when) {
+    scheduler->when[event] = when;
+
+    // Shorten the running slice when the event is due before it ends
+    const uint64_t end = scheduler->cycles + scheduler->slice;
+    if (when < end) {
+        if (when <= scheduler_now(scheduler)) {
+            scheduler_stop(scheduler);
+        } else {
+            const int64_t delta = (int64_t) (end - when);
+            scheduler->slice -= delta;
+            scheduler->cpu->ICount -= (int) delta;
+        }
+    }
+}
+
+inline void scheduler_cancel(SCHEDULER *scheduler, const EVENT event) {
+    scheduler->when[event] = EVENT_NEVER;
+}
+
+// Start a slice that ends at the next event
+inline void scheduler_next(SCHEDULER *scheduler) {
+    uint64_t next = scheduler->cycles + SCHEDULER_MAX_SLICE;
+
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        if (scheduler->when[i] < next) next = scheduler->when[i];
+    }
+
+    scheduler->slice = next > scheduler->cycles ? (int64_t) (next - scheduler->cycles) : 1;
+    scheduler->cpu->IPeriod = scheduler->cpu->ICount = (int) scheduler->slice;
+}
+
+// Called from Loop6502 at the end of a slice: dispatch every due event and start the next slice
+inline void scheduler_run(SCHEDULER *scheduler) {
+    scheduler->cycles = scheduler_now(scheduler);
+    scheduler->slice = scheduler->cpu->ICount = 0;
+
+    for (;;) {
+        int due = EVENT_COUNT;
+        for (int i = 0; i < EVENT_COUNT; i++) {
+            if (scheduler->when[i] <= scheduler->cycles && (due == EVENT_COUNT || scheduler->when[i] < scheduler->when[due])) due = i;
+        }
+        if (due == EVENT_COUNT) break;
+
+        const uint64_t when = scheduler->when[due];
+        scheduler->when[due] = EVENT_NEVER;
+        scheduler->handlers[due](scheduler->context, when);
+    }
+
+    scheduler_next(scheduler);
+}
+
+#endif //SCHEDULER_H
@@ -1,8 +1,6 @@
 #ifndef SOUND_H
 #define SOUND_H
 
-extern "C" uint8_t Rd6502(uint16_t address);
-
 #define UNSCALED_CLOCK 4000000
 #define SAMPLE_RATE 44100
 
@@ -72,31 +70,39 @@ typedef struct {
     uint16_t clock_divisor;   // Clock cycles per sample output
 } SV_DMA_CHANNEL;
 
-// Global state
-static SV_CHANNEL channels[2];
-static SV_NOISE_CHANNEL noise_channel;
-static SV_DMA_CHANNEL dma_channel;
+// Reads DMA sample data from the CPU address space of the machine the sound belongs to
+typedef uint8_t (*sound_read_handler)(void *context, uint16_t address);
+
+// Sound state of one machine
+typedef struct {
+    SV_CHANNEL channels[2];
+    SV_NOISE_CHANNEL noise_channel;
+    SV_DMA_CHANNEL dma_channel;
+
+    sound_read_handler read;
+    void *context; // Passed to read
+} SOUND;
 
 // Function to initialize the sound system
-inline void sound_init() {
-    memset(channels, 0, sizeof(channels));
-    memset(&noise_channel, 0, sizeof(noise_channel));
-    memset(&dma_channel, 0, sizeof(dma_channel));
+inline void sound_init(SOUND *sound, sound_read_handler read, void *context) {
+    memset(sound, 0, sizeof(*sound));
+    sound->read = read;
+    sound->context = context;
 
     // Initialize LFSR with all bits set to 1
-    noise_channel.lfsr = 0x7FFF; // 15-bit value (all 1s)
+    sound->noise_channel.lfsr = 0x7FFF; // 15-bit value (all 1s)
 
     // Default the divisor to something reasonable
-    noise_channel.divisor = 8;
+    sound->noise_channel.divisor = 8;
 }
 
 // Register write handler for square wave channels
-inline void sound_wave_write(const int channel_index, const int reg_index, const uint8_t value) {
+inline void sound_wave_write(SOUND *sound, const int channel_index, const int reg_index, const uint8_t value) {
     if (channel_index < 0 || channel_index > 1 || reg_index < 0 || reg_index > 3) {
         return; // Invalid parameters
     }
 
-    SV_CHANNEL *channel = &channels[channel_index];
+    SV_CHANNEL *channel = &sound->channels[channel_index];
     channel->reg[reg_index] = value;
 
     switch (reg_index) {
@@ -131,18 +137,18 @@ inline void sound_wave_write(const int channel_index, const int reg_index, const
 }
 
 // Register write handler for noise channel
-inline void sound_noise_write(const int reg_index, const uint8_t value) {
+inline void sound_noise_write(SOUND *sound, const int reg_index, const uint8_t value) {
     if (reg_index < 0 || reg_index > 2) {
         return; // Invalid parameters - only 3 registers (0-2)
     }
 
-    noise_channel.reg[reg_index] = value;
+    sound->noise_channel.reg[reg_index] = value;
 
     switch (reg_index) {
         case 0: { // CH4_Freq_Vol - Frequency and Volume
             // Update frequency and volume settings
-            noise_channel.frequency = (value & 0xF0) >> 4;
-            noise_channel.volume = value & 0x0F;
+            sound->noise_channel.frequency = (value & 0xF0) >> 4;
+            sound->noise_channel.volume = value & 0x0F;
 
             // Set divisor based on frequency value
             static const uint32_t divisors[16] = {
@@ -164,61 +170,61 @@ inline void sound_noise_write(const int reg_index, const uint8_t value) {
                 131072  // F - 30.52Hz (duplicate of D)
             };
 
-            noise_channel.divisor = divisors[noise_channel.frequency];
+            sound->noise_channel.divisor = divisors[sound->noise_channel.frequency];
             break;
         }
 
         case 1: { // CH4_Length - Length counter
             // Update length counter
-            noise_channel.length = value;
+            sound->noise_channel.length = value;
             break;
         }
 
         case 2: { // CH4_Control - Control flags
             // Parse control flags
-            noise_channel.noise_enable = (value & 0x10) != 0;
-            noise_channel.left_output = (value & 0x04) != 0;
-            noise_channel.right_output = (value & 0x02) != 0;
-            noise_channel.continuous_mode = (value & 0x01) != 0;
-            noise_channel.lfsr_mode = (value & 0x01) != 0;
+            sound->noise_channel.noise_enable = (value & 0x10) != 0;
+            sound->noise_channel.left_output = (value & 0x04) != 0;
+            sound->noise_channel.right_output = (value & 0x02) != 0;
+            sound->noise_channel.continuous_mode = (value & 0x01) != 0;
+            sound->noise_channel.lfsr_mode = (value & 0x01) != 0;
 
             // Reset LFSR to all 1's when writing to control register
-            noise_channel.lfsr = 0x7FFF; // 15 bits all set to 1
+            sound->noise_channel.lfsr = 0x7FFF; // 15 bits all set to 1
 
             // Reset position counter
-            noise_channel.position = 0;
+            sound->noise_channel.position = 0;
             break;
         }
     }
 }
 
 // Register write handler for DMA channel
-inline void sound_dma_write(const int reg_index, const uint8_t value) {
+inline void sound_dma_write(SOUND *sound, const int reg_index, const uint8_t value) {
 
-    dma_channel.reg[reg_index] = value;
+    sound->dma_channel.reg[reg_index] = value;
 
     switch (reg_index) {
         case 0: { // CH3_Addrlow - Low byte of address
-            dma_channel.address = (dma_channel.address & 0xFF00) | value;
+            sound->dma_channel.address = (sound->dma_channel.address & 0xFF00) | value;
             break;
         }
 
         case 1: { // CH3_Addrehi - High byte of address
-            dma_channel.address = (dma_channel.address & 0x00FF) | (value << 8);
+            sound->dma_channel.address = (sound->dma_channel.address & 0x00FF) | (value << 8);
             break;
         }
 
         case 2: { // CH3_Length - Length of sample
-            dma_channel.length = value;
+            sound->dma_channel.length = value;
             break;
         }
 
         case 3: { // CH3_Control - Control settings
             // Parse ROM bank and output flags
-            dma_channel.rom_bank = (value & 0x70) >> 4;  // Bits 4-6: ROM bank (0-7)
-            dma_channel.left_output = (value & 0x04) != 0;  // Bit 2: Output to left
-            dma_channel.right_output = (value & 0x02) != 0; // Bit 1: Output to right
-            dma_channel.frequency = value & 0x03;          // Bits 0-1: Frequency
+            sound->dma_channel.rom_bank = (value & 0x70) >> 4;  // Bits 4-6: ROM bank (0-7)
+            sound->dma_channel.left_output = (value & 0x04) != 0;  // Bit 2: Output to left
+            sound->dma_channel.right_output = (value & 0x02) != 0; // Bit 1: Output to right
+            sound->dma_channel.frequency = value & 0x03;          // Bits 0-1: Frequency
 
             // Set clock divisor based on frequency setting
             static constexpr uint16_t divisors[4] = {
@@ -227,36 +233,43 @@ inline void sound_dma_write(const int reg_index, const uint8_t value) {
                 1024, // 10 - 1024 clocks
                 2048  // 11 - 2048 clocks
             };
-            dma_channel.clock_divisor = divisors[dma_channel.frequency];
+            sound->dma_channel.clock_divisor = divisors[sound->dma_channel.frequency];
             break;
         }
 
         case 4: { // CH3_Trigger - Trigger playback
             // Check if bit 7 is set to trigger playback
             if (value & 0x80) {
-                dma_channel.triggered = true;
+                sound->dma_channel.triggered = true;
 
                 // If this is a fresh trigger (not already playing), initialize playback state
-                if (dma_channel.samples_played == 0) {
+                if (sound->dma_channel.samples_played == 0) {
                     // Set current address to start address
-                    dma_channel.current_address = dma_channel.address;
+                    sound->dma_channel.current_address = sound->dma_channel.address;
                     // Reset sample counters
-                    dma_channel.samples_played = 0;
-                    dma_channel.position = 0;
-                    dma_channel.high_nibble = true; // Start with high nibble
+                    sound->dma_channel.samples_played = 0;
+                    sound->dma_channel.position = 0;
+                    sound->dma_channel.high_nibble = true; // Start with high nibble
 
                     // Load first byte
-                    dma_channel.current_byte = Rd6502(dma_channel.current_address);
-                        //read_rom_byte(dma_channel.rom_bank, dma_channel.current_address);
+                    sound->dma_channel.current_byte = sound->read(sound->context, sound->dma_channel.current_address);
+                        //read_rom_byte(sound->dma_channel.rom_bank, sound->dma_channel.current_address);
                 }
             } else {
-                dma_channel.triggered = false;
+                sound->dma_channel.triggered = false;
             }
             break;
         }
     }
 }
 
+// CPU cycles the DMA channel takes to play its whole sample
+inline uint32_t sound_dma_cycles(const SOUND *sound) {
+    const uint32_t total_bytes = (sound->dma_channel.length == 0) ? 4096 : (sound->dma_channel.length * 16);
+
+    return total_bytes * 2 * sound->dma_channel.clock_divisor; // Each byte provides 2 samples
+}
+
 // Helper function: get threshold position for current duty cycle
 static inline uint16_t get_duty_threshold(const SV_CHANNEL *channel) {
     switch (channel->duty) {
@@ -274,45 +287,45 @@ static inline uint16_t get_duty_threshold(const SV_CHANNEL *channel) {
 }
 
 // Helper function: update LFSR for noise generation
-static inline void update_noise_lfsr() {
+static inline void update_noise_lfsr(SOUND *sound) {
     // Calculate feedback bit using bits 14 and 15 (actually indices 13 and 14 in zero-based)
-    uint16_t bit0 = noise_channel.lfsr & 1;
-    uint16_t bit1 = (noise_channel.lfsr & 2) >> 1;
+    uint16_t bit0 = sound->noise_channel.lfsr & 1;
+    uint16_t bit1 = (sound->noise_channel.lfsr & 2) >> 1;
     uint16_t feedback = bit0 ^ bit1;
 
     // Shift the register right by 1
-    noise_channel.lfsr >>= 1;
+    sound->noise_channel.lfsr >>= 1;
 
     // Apply feedback to highest bit (bit 14 for 15-bit mode, bit 6 for 7-bit mode)
     if (feedback) {
-        if (noise_channel.lfsr_mode) {
+        if (sound->noise_channel.lfsr_mode) {
             // 15-bit mode: feedback to bit 14
-            noise_channel.lfsr |= 0x4000;
+            sound->noise_channel.lfsr |= 0x4000;
         } else {
             // 7-bit mode: truncate to 7 bits and feedback to bit 6
-            noise_channel.lfsr &= 0x7F;  // Mask to keep only 7 bits
+            sound->noise_channel.lfsr &= 0x7F;  // Mask to keep only 7 bits
             if (feedback) {
-                noise_channel.lfsr |= 0x40;  // Set bit 6
+                sound->noise_channel.lfsr |= 0x40;  // Set bit 6
             }
         }
     }
 
     // Ensure LFSR never becomes 0 (would get stuck)
-    if (noise_channel.lfsr == 0) {
-        noise_channel.lfsr = noise_channel.lfsr_mode ? 0x7FFF : 0x7F;
+    if (sound->noise_channel.lfsr == 0) {
+        sound->noise_channel.lfsr = sound->noise_channel.lfsr_mode ? 0x7FFF : 0x7F;
     }
 }
 
 // Function to generate a single sample
 // Called at sample rate (44100Hz)
-inline int16_t sound_generate_sample() {
+inline int16_t sound_generate_sample(SOUND *sound) {
     int16_t left_output = 0;
     int16_t right_output = 0;
     int16_t final_output = 0;
 
     // Process both square wave channels
     for (int i = 0; i < 2; i++) {
-        SV_CHANNEL *channel = &channels[i];
+        SV_CHANNEL *channel = &sound->channels[i];
 
         if (channel->enabled && channel->size > 0) {
             // Determine if waveform is in high or low state
@@ -342,73 +355,72 @@ inline int16_t sound_generate_sample() {
     }
 
     // Process noise channel
-    if (noise_channel.noise_enable) {
+    if (sound->noise_channel.noise_enable) {
         // Check if we should update the LFSR (based on frequency/divisor)
         // We need to scale the divisor to match our sample rate
-        uint16_t noise_period = (uint16_t)((uint32_t)SAMPLE_RATE * noise_channel.divisor / UNSCALED_CLOCK);
+        uint16_t noise_period = (uint16_t)((uint32_t)SAMPLE_RATE * sound->noise_channel.divisor / UNSCALED_CLOCK);
         if (noise_period == 0) noise_period = 1; // Avoid division by zero
 
-        noise_channel.position++;
-        if (noise_channel.position >= noise_period) {
-            noise_channel.position = 0;
+        sound->noise_channel.position++;
+        if (sound->noise_channel.position >= noise_period) {
+            sound->noise_channel.position = 0;
 
             // Update LFSR
-            update_noise_lfsr();
+            update_noise_lfsr(sound);
 
             // Handle length counter if not in continuous mode
-            if (!noise_channel.continuous_mode && noise_channel.length > 0) {
-                noise_channel.length--;
-                if (noise_channel.length == 0) {
-                    noise_channel.noise_enable = false; // Disable when length expires
+            if (!sound->noise_channel.continuous_mode && sound->noise_channel.length > 0) {
+                sound->noise_channel.length--;
+                if (sound->noise_channel.length == 0) {
+                    sound->noise_channel.noise_enable = false; // Disable when length expires
                 }
             }
         }
 
         // Generate noise output based on LFSR state (use lowest bit)
-        if (noise_channel.noise_enable && (noise_channel.lfsr & 1)) {
+        if (sound->noise_channel.noise_enable && (sound->noise_channel.lfsr & 1)) {
             // Mix to appropriate output channels based on control flags
-            if (noise_channel.left_output) {
-                left_output += noise_channel.volume;
+            if (sound->noise_channel.left_output) {
+                left_output += sound->noise_channel.volume;
             }
-            if (noise_channel.right_output) {
-                right_output += noise_channel.volume;
+            if (sound->noise_channel.right_output) {
+                right_output += sound->noise_channel.volume;
             }
         }
     }
 
 
-    if (dma_channel.triggered) {
+    if (sound->dma_channel.triggered) {
         // Calculate total sample length in bytes
-        uint16_t total_bytes = (dma_channel.length == 0) ? 4096 : (dma_channel.length * 16);
+        uint16_t total_bytes = (sound->dma_channel.length == 0) ? 4096 : (sound->dma_channel.length * 16);
         uint16_t total_samples = total_bytes * 2; // Each byte provides 2 samples (high and low nibbles)
 
         // Check if we've reached the end of the sample
-        if (dma_channel.samples_played >= total_samples) {
+        if (sound->dma_channel.samples_played >= total_samples) {
             // Sample playback complete
-            dma_channel.triggered = false;
+            sound->dma_channel.triggered = false;
             return 0;
         }
 
         // Process current sample
-        if (dma_channel.high_nibble) {
+        if (sound->dma_channel.high_nibble) {
             // Output high nibble (bits 4-7)
-            final_output = (dma_channel.current_byte >> 4) & 0x0F;
+            final_output = (sound->dma_channel.current_byte >> 4) & 0x0F;
         } else {
             // Output low nibble (bits 0-3)
-            final_output = dma_channel.current_byte & 0x0F;
+            final_output = sound->dma_channel.current_byte & 0x0F;
 
             // After processing low nibble, advance to next byte
-            dma_channel.current_address++;
-            printf("dma read\n");
-            dma_channel.current_byte = Rd6502(dma_channel.current_address);
-            // dma_channel.current_byte = read_rom_byte(dma_channel.rom_bank, dma_channel.current_address);
+            sound->dma_channel.current_address++;
+            sound->dma_channel.current_byte = sound->read(sound->context, sound->dma_channel.current_address);
+            // sound->dma_channel.current_byte = read_rom_byte(sound->dma_channel.rom_bank, sound->dma_channel.current_address);
         }
 
         // Alternate between high and low nibble
-        dma_channel.high_nibble = !dma_channel.high_nibble;
+        sound->dma_channel.high_nibble = !sound->dma_channel.high_nibble;
 
         // Increment samples played counter
-        dma_channel.samples_played++;
+        sound->dma_channel.samples_played++;
     }
 
     // Average the left and right channels for final output
@@ -0,0 +1,295 @@
+/*
+ * Machine checks on small ROMs assembled here:
+ *
+ *   watara-check
+ *
+ * Each case runs a 32 KB cart for a few frames from power-on, once with the block cache and once with every
+ * instruction interpreted, and checks what its code counted in RAM. Both runs must count the same. Returns 1 if any
+ * case fails.
+ *
+ * timer poll: writes 40h to the IRQ timer at 2023 and polls it until it reads 20h, over and over. The poll loop
+ * writes nothing and its registers only change when the timer ticks, but it must not be skipped as an idle loop.
+ *
+ * NMI wait: spins on a RAM byte that only the NMI handler sets, the idle loop that should be skipped.
+ *
+ * timer timing: starts the IRQ timer from a store early in a block and reads its live count early in another, with a
+ * delay loop between them that grows by one pass each time, so that the reads sweep across prescaler ticks. Every
+ * count read must be the same with the block cache as interpreted, which needs exact cycles in the middle of blocks.
+ *
+ * Then cheats:
+ * - no-op patches on every C000-FFFF page, so that all of the timer poll runs from patched copies, must leave RAM,
+ *   VRAM and the screen as they are without cheats on every frame
+ * - with the last bank switched into 8000-BFFF too, a patch at 8100 must only show there and one at C180 only there,
+ *   even without a compare value
+ * - freezes hold, and codes aimed at I/O are rejected
+ */
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include "machine.h"
+
+#define ROM_FILE "watara-check.tmp"
+
+/*
+ * A cart with code at C000, where reset starts, and the NMI and IRQ handlers at FF00, all of them in the last bank.
+ * 8000-BFFF shows the first bank, all NOPs.
+ */
+static std::vector<uint8_t> assemble(std::initializer_list<uint8_t> code, std::initializer_list<uint8_t> handler) {
+    std::vector<uint8_t> rom(2 * ROM_BANK_SIZE, 0xEA);
+    uint8_t *hi = &rom[ROM_BANK_SIZE];
+    memcpy(hi, code.begin(), code.size());
+    memcpy(hi + 0x3F00, handler.begin(), handler.size());
+
+    const uint8_t vectors[] = {0x00, 0xFF, 0x00, 0xC0, 0x00, 0xFF}; // NMI, reset, IRQ
+    memcpy(hi + 0x3FFA, vectors, sizeof(vectors));
+    return rom;
+}
+
+static bool save(const std::vector<uint8_t> &rom) {
+    FILE *file = fopen(ROM_FILE, "wb");
+    if (!file)
+        return false;
+    const bool written = fwrite(rom.data(), 1, rom.size(), file) == rom.size();
+    return fclose(file) == 0 && written;
+}
+
+// Runs the ROM saved for frames frames, returning the machine, or NULL if it cannot be loaded
+static MACHINE *run(int frames, bool cached) {
+    MACHINE *m = new MACHINE();
+    if (!machine_load(m, ROM_FILE)) {
+        delete m;
+        return nullptr;
+    }
+    machine_reset(m);
+    if (!cached)
+        Cache6502(&m->cpu, nullptr, 0);
+
+    for (int frame = 0; frame < frames; frame++)
+        machine_run_frame(m);
+    return m;
+}
+
+static void release(MACHINE *m) {
+    if (!m)
+        return;
+    machine_cheat(m, nullptr);
+    Cache6502(&m->cpu, nullptr, 0);
+    machine_eject(m);
+    delete m;
+}
+
+/*
+ * Runs rom both ways and checks the count at 0000, which must come to least or more. The cached run must have skipped
+ * idle cycles if skipped is set, and none otherwise.
+ */
+static int check(const char *name, const std::vector<uint8_t> &rom, int frames, int least, bool skipped) {
+    MACHINE *cached = save(rom) ? run(frames, true) : nullptr;
+    MACHINE *interpreted = cached ? run(frames, false) : nullptr;
+    if (!interpreted) {
+        printf("%-12s cannot run %s\n", name, ROM_FILE);
+        release(cached);
+        return 1;
+    }
+
+    const int count = cached->RAM[0], expected = interpreted->RAM[0], idle = cached->cpu.ISkipped;
+    int errors = 0;
+    if (count != expected || count < least) {
+        printf("%-12s counted %d in %d frames, %d interpreted, at least %d expected\n", name, count, frames, expected,
+               least);
+        errors++;
+    }
+    if ((idle > 0) != skipped) {
+        printf("%-12s skipped %d idle cycles\n", name, idle);
+        errors++;
+    }
+    if (!errors)
+        printf("%-12s counted %d in %d frames, skipped %d idle cycles\n", name, count, frames, idle);
+
+    release(cached);
+    release(interpreted);
+    return errors;
+}
+
+static std::vector<uint8_t> timer_poll() {
+    return assemble({
+            0xA9, 0x40,       // C000 LDA #$40
+            0x8D, 0x23, 0x20, // C002 STA $2023
+            0xAD, 0x23, 0x20, // C005 LDA $2023
+            0xC9, 0x20,       // C008 CMP #$20
+            0xD0, 0xF9,       // C00A BNE $C005
+            0xE6, 0x00,       // C00C INC $00
+            0x4C, 0x00, 0xC0, // C00E JMP $C000
+    }, {
+            0x40,             // FF00 RTI
+    });
+}
+
+static int check_timer_timing() {
+    MACHINE *cached = save(assemble({
+            0xA2, 0x00,       // C000 LDX #$00
+            0xA9, 0x10,       // C002 LDA #$10
+            0x8D, 0x23, 0x20, // C004 STA $2023
+            0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, // C007 NOP x8
+            0x8A,             // C00F TXA
+            0xA8,             // C010 TAY
+            0xF0, 0x03,       // C011 BEQ $C016
+            0x88,             // C013 DEY
+            0xD0, 0xFD,       // C014 BNE $C013
+            0xAD, 0x23, 0x20, // C016 LDA $2023
+            0x9D, 0x00, 0x02, // C019 STA $0200,X
+            0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, // C01C NOP x8
+            0xE8,             // C024 INX
+            0xD0, 0xDB,       // C025 BNE $C002
+            0xE6, 0x00,       // C027 INC $00
+            0x4C, 0x29, 0xC0, // C029 JMP $C029
+    }, {
+            0x40,             // FF00 RTI
+    })) ? run(4, true) : nullptr;
+    MACHINE *interpreted = cached ? run(4, false) : nullptr;
+    if (!interpreted) {
+        printf("%-12s cannot run %s\n", "timer timing", ROM_FILE);
+        release(cached);
+        return 1;
+    }
+
+    const uint8_t *counts = &cached->RAM[0x200], *expected = &interpreted->RAM[0x200];
+    int errors = 0, ticks = 0;
+    for (int i = 0; i < 256; i++) {
+        if (counts[i] != expected[i] && !errors++)
+            printf("%-12s read %02X after %d passes, %02X interpreted\n", "timer timing", counts[i], i, expected[i]);
+        ticks += i && expected[i] != expected[i - 1];
+    }
+    if (cached->RAM[0] != 1 || interpreted->RAM[0] != 1) {
+        printf("%-12s did not finish\n", "timer timing");
+        errors++;
+    }
+    if (!errors)
+        printf("%-12s 256 counts the same as interpreted, across %d ticks\n", "timer timing", ticks);
+
+    release(cached);
+    release(interpreted);
+    return errors;
+}
+
+static bool same(const MACHINE *a, const MACHINE *b) {
+    return !memcmp(a->RAM, b->RAM, sizeof(a->RAM)) && !memcmp(a->VRAM, b->VRAM, sizeof(a->VRAM)) &&
+           !memcmp(a->screen, b->screen, sizeof(a->screen));
+}
+
+static int check_noop_patches(int frames) {
+    MACHINE *plain = save(timer_poll()) ? run(0, false) : nullptr;
+    MACHINE *patched = plain ? run(0, true) : nullptr;
+    if (!patched) {
+        printf("%-12s cannot run %s\n", "no-op cheats", ROM_FILE);
+        release(plain);
+        return 1;
+    }
+
+    CHEATS *cheats = cheats_new(patched->rom);
+    for (int address = 0xC000; address <= 0xFFFF; address += 256)
+        cheats_patch(cheats, patched->rom, (uint16_t) address, patched->rom->hi[address - 0xC000], -1);
+    machine_cheat(patched, cheats);
+
+    int errors = 0;
+    for (int frame = 0; frame < frames && !errors; frame++) {
+        machine_run_frame(plain);
+        machine_run_frame(patched);
+        if (!same(plain, patched)) {
+            printf("%-12s frame %d differs from running without cheats\n", "no-op cheats", frame);
+            errors++;
+        }
+    }
+    if (!errors)
+        printf("%-12s %d pages patched, %d frames the same as without\n", "no-op cheats", cheats->patched_pages,
+               frames);
+
+    release(plain);
+    release(patched);
+    cheats_free(cheats);
+    return errors;
+}
+
+static int check_cheat_windows() {
+    // 8000-BFFF and C000-FFFF both show bank 1 once 2026 selects it
+    MACHINE *m = save(assemble({
+            0xA9, 0x21,       // C000 LDA #$21
+            0x8D, 0x26, 0x20, // C002 STA $2026
+            0xAD, 0x00, 0x81, // C005 LDA $8100
+            0x85, 0x00,       // C008 STA $00
+            0xAD, 0x00, 0xC1, // C00A LDA $C100
+            0x85, 0x01,       // C00D STA $01
+            0xAD, 0x80, 0x81, // C00F LDA $8180
+            0x85, 0x02,       // C012 STA $02
+            0xAD, 0x80, 0xC1, // C014 LDA $C180
+            0x85, 0x03,       // C017 STA $03
+            0x4C, 0x19, 0xC0, // C019 JMP $C019
+    }, {
+            0x40,             // FF00 RTI
+    })) ? run(0, true) : nullptr;
+    if (!m) {
+        printf("%-12s cannot run %s\n", "cheats", ROM_FILE);
+        return 1;
+    }
+
+    CHEATS *cheats = cheats_new(m->rom);
+    const char *codes[] = {"8100:22", "C180:33", "1000:5A", "4000:A5"};
+    int errors = 0;
+    for (const char *code : codes)
+        errors += !cheats_parse(cheats, m->rom, code);
+    errors += cheats_parse(cheats, m->rom, "2023:40") + cheats_parse(cheats, m->rom, "3000:00");
+    machine_cheat(m, cheats);
+
+    for (int frame = 0; frame < 2; frame++) {
+        m->RAM[0x1000] = 0;
+        m->VRAM[0] = 0;
+        machine_run_frame(m);
+        if (m->RAM[0x1000] != 0x5A || m->VRAM[0] != 0xA5) {
+            printf("%-12s freezes read %02X %02X after frame %d\n", "cheats", m->RAM[0x1000], m->VRAM[0], frame);
+            errors++;
+        }
+    }
+
+    // EA is what the image holds at all four
+    const uint8_t expected[] = {0x22, 0xEA, 0xEA, 0x33};
+    if (memcmp(m->RAM, expected, sizeof(expected))) {
+        printf("%-12s 8100 C100 8180 C180 read %02X %02X %02X %02X, expected 22 EA EA 33\n", "cheats", m->RAM[0],
+               m->RAM[1], m->RAM[2], m->RAM[3]);
+        errors++;
+    }
+    if (!errors)
+        printf("%-12s patches stay in their window, freezes hold, I/O codes rejected\n", "cheats");
+
+    release(m);
+    cheats_free(cheats);
+    return errors;
+}
+
+int main() {
+    int errors = 0;
+
+    // A tick every 256 cycles, so 65536 / 256 / 20h = 8 per frame
+    errors += check("timer poll", timer_poll(), 4, 4 * 8 - 1, false);
+
+    // One NMI per frame, then the wait for the next one has nothing to do
+    errors += check("NMI wait", assemble({
+            0xA5, 0x01,       // C000 LDA $01
+            0xF0, 0xFC,       // C002 BEQ $C000
+            0x64, 0x01,       // C004 STZ $01
+            0xE6, 0x00,       // C006 INC $00
+            0x4C, 0x00, 0xC0, // C008 JMP $C000
+    }, {
+            0xE6, 0x01,       // FF00 INC $01
+            0x40,             // FF02 RTI
+    }), 8, 8 - 1, true);
+
+    errors += check_timer_timing();
+    errors += check_noop_patches(8);
+    errors += check_cheat_windows();
+
+    remove(ROM_FILE);
+    printf("%d errors\n", errors);
+    return errors ? 1 : 0;
+}
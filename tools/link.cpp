@@ -0,0 +1,113 @@
+/*
+ * Link cable benchmark:
+ *
+ *   watara-link <rom.bin> [frames] [other.bin]
+ *
+ * Runs two consoles on two threads, the first with rom.bin and the second with other.bin or the same ROM, for the
+ * given number of frames: once unplugged, then twice linked through the shared-memory cable. It prints the frames
+ * per second of each run and what the lockstep costs per frame, then checks that both linked runs ended in the same
+ * states, which they must whatever the host did with the two threads. It returns 1 when they did not.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+
+#include "link.h"
+#include "machine.h"
+
+struct CONSOLE {
+    MACHINE *machine;
+    LINK *link;
+    double seconds;
+    uint32_t hash;
+};
+
+static uint32_t hash(const void *data, size_t size) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < size; i++) h = (h ^ ((const uint8_t *) data)[i]) * 16777619u;
+    return h;
+}
+
+static void run(CONSOLE *console, int frames) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        console->machine->buttons = (uint8_t) ~(1 << ((frame >> 3) % 8));
+        machine_run_frame(console->machine);
+    }
+    console->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    auto *state = new MACHINE_STATE;
+    machine_save_state(console->machine, state);
+    console->hash = hash(state, sizeof(MACHINE_STATE));
+    delete state;
+}
+
+// Runs both consoles from reset, plugged into a new cable when linked, returns the seconds the slower one took
+static double run_pair(CONSOLE consoles[2], int frames, bool linked) {
+    char name[32];
+    snprintf(name, sizeof(name), "bench-%llx", (unsigned long long) std::chrono::steady_clock::now().time_since_epoch().count());
+
+    for (int i = 0; i < 2; i++) {
+        machine_reset(consoles[i].machine);
+        consoles[i].link = linked ? link_open(name) : nullptr;
+        if (linked && !consoles[i].link)
+            exit(1);
+        machine_connect(consoles[i].machine, consoles[i].link);
+    }
+
+    std::thread other(run, &consoles[1], frames);
+    run(&consoles[0], frames);
+    other.join();
+
+    for (int i = 0; i < 2; i++) {
+        machine_connect(consoles[i].machine, nullptr);
+        if (consoles[i].link) {
+            printf("  Console %d: %llu syncs, %llu waited for the other\n", i,
+                   (unsigned long long) consoles[i].link->syncs, (unsigned long long) consoles[i].link->waits);
+            link_close(consoles[i].link);
+        }
+    }
+    return consoles[0].seconds > consoles[1].seconds ? consoles[0].seconds : consoles[1].seconds;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: watara-link <rom.bin> [frames] [other.bin]\n");
+        return -1;
+    }
+    const int frames = argc > 2 ? atoi(argv[2]) : 3600;
+
+    CONSOLE consoles[2] = {};
+    for (int i = 0; i < 2; i++) {
+        const char *pathname = i && argc > 3 ? argv[3] : argv[1];
+        consoles[i].machine = new MACHINE();
+        if (!machine_load(consoles[i].machine, pathname)) {
+            printf("Cannot read %s\n", pathname);
+            return 1;
+        }
+    }
+
+    const double unlinked = run_pair(consoles, frames, false);
+    printf("Unplugged: %.1f frames/s\n", frames / unlinked);
+
+    uint32_t hashes[2][2];
+    double linked = 0;
+    for (int run = 0; run < 2; run++) {
+        const double seconds = run_pair(consoles, frames, true);
+        printf("Linked: %.1f frames/s, %.2f us per frame more than unplugged\n", frames / seconds,
+               (seconds - unlinked) * 1e6 / frames);
+        hashes[run][0] = consoles[0].hash;
+        hashes[run][1] = consoles[1].hash;
+        linked = run ? (linked < seconds ? linked : seconds) : seconds;
+    }
+    printf("Lockstep: %.1f ns per sync\n", (linked - unlinked) * 1e9 / frames / (65536 / LINK_QUANTUM_CYCLES));
+
+    printf("States %08X %08X, then %08X %08X\n", hashes[0][0], hashes[0][1], hashes[1][0], hashes[1][1]);
+    if (hashes[0][0] != hashes[1][0] || hashes[0][1] != hashes[1][1]) {
+        printf("The linked runs differ\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * Lockstep benchmark: runs 16 copies of a Supervision ROM, each with its own joypad input.
+ *
+ *   watara-lockstep <rom.bin> [frames]
+ *
+ * The copies run once one after another on the threaded core, each with its own block cache, and once side by side
+ * in m6502::Lockstep. The tool prints the aggregate frames per second of both runs, and checks that both end with the
+ * same RAM, VRAM and registers in every copy.
+ *
+ * Only what the CPU needs to get through a frame is emulated: RAM, VRAM, bank switching and the NMI at the end of
+ * every frame. There are no timers, DMA, sound or LCD, so their registers just read back what was last written.
+ * The joypad at 2020 returns a pseudo-random pattern that depends on the copy and the frame, and changes every
+ * 8 frames.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "m6502/lockstep.hpp"
+
+#define COPIES 16
+#define BANK_SIZE 16384
+#define NMI_CYCLES 65536
+
+static std::vector<uint8_t> rom;
+static uint8_t open_bus[256];
+static int banks;
+
+struct console {
+    uint8_t RAM[0x2000];
+    uint8_t VRAM[0x2000];
+    uint8_t io[256];
+    bool nmi_enabled;
+    int frame;
+    M6502 cpu;
+};
+
+static console scalar[COPIES], lockstep[COPIES];
+
+static void map_bank(M6502 &cpu, int bank) {
+    for (int page = 0x80; page < 0xC0; page++) {
+        cpu.Page[page] = rom.data() + (bank % banks) * BANK_SIZE + (page - 0x80) * 256;
+    }
+}
+
+static void map_memory(console &c) {
+    for (int page = 0x00; page < 0x20; page++) c.cpu.Page[page] = c.RAM + page * 256;
+    for (int page = 0x20; page < 0x40; page++) c.cpu.Page[page] = open_bus;
+    for (int page = 0x40; page < 0x80; page++) c.cpu.Page[page] = c.VRAM + (page & 0x1F) * 256;
+    map_bank(c.cpu, 0);
+    for (int page = 0xC0; page < 0x100; page++) c.cpu.Page[page] = rom.data() + rom.size() - BANK_SIZE + (page - 0xC0) * 256;
+    c.cpu.IPeriod = NMI_CYCLES;
+}
+
+static uint8_t io_read(console &c, int n, uint16_t address) {
+    if ((address >> 8) != 0x20) return 0xFF;
+    if (address != 0x2020) return c.io[address & 0xFF];
+
+    uint32_t x = (uint32_t) (n * 0x9E3779B9u) ^ (uint32_t) (c.frame >> 3) * 0x85EBCA6Bu;
+    x ^= x >> 15;
+    x *= 0x2C1B3C6Du;
+    return (uint8_t) (x >> 24);
+}
+
+static void io_write(console &c, M6502 &cpu, uint16_t address, uint8_t value) {
+    if ((address >> 8) != 0x20) return;
+    c.io[address & 0xFF] = value;
+
+    if (address == 0x2026) {
+        map_bank(cpu, value >> 5);
+        c.nmi_enabled = value & 1;
+    }
+}
+
+/*
+ * Scalar run through Run6502()
+ */
+static int current;
+
+extern "C" byte Rd6502(word address) {
+    console &c = scalar[current];
+    if ((address >> 8) >= 0x20 && (address >> 8) < 0x40) return io_read(c, current, address);
+    return c.cpu.Page[address >> 8][address & 0xFF];
+}
+
+extern "C" void Wr6502(word address, byte value) {
+    console &c = scalar[current];
+    if (address < 0x2000) c.RAM[address] = value;
+    else if (address >= 0x4000 && address < 0x8000) c.VRAM[address & 0x1FFF] = value;
+    else io_write(c, c.cpu, address, value);
+}
+
+extern "C" byte Loop6502(M6502 *R) {
+    return INT_QUIT;
+}
+
+static void run_scalar(int frames) {
+    for (current = 0; current < COPIES; current++) {
+        console &c = scalar[current];
+        map_memory(c);
+        Cache6502(&c.cpu, rom.data(), rom.size());
+        Reset6502(&c.cpu);
+
+        for (c.frame = 0; c.frame < frames; c.frame++) {
+            Run6502(&c.cpu);
+            if (c.nmi_enabled) Int6502(&c.cpu, INT_NMI);
+        }
+    }
+}
+
+/*
+ * Lockstep run, RAM and VRAM are kept in the engine
+ */
+struct LockstepIO {
+    static byte Rd(M6502 *R, int Lane, word A) { return io_read(lockstep[Lane], Lane, A); }
+    static void Wr(M6502 *R, int Lane, word A, byte V) { io_write(lockstep[Lane], *R, A, V); }
+    static byte Loop(M6502 *R, int Lane) { return INT_QUIT; }
+};
+
+using Engine = m6502::Lockstep<LockstepIO>;
+
+static void run_lockstep(Engine &engine, int frames) {
+    engine.MapRam(0x00, 0x20, 0);
+    engine.MapIO(0x20, 0x20);
+    engine.MapRam(0x40, 0x20, 0x20);
+    engine.MapRam(0x60, 0x20, 0x20);
+
+    for (int n = 0; n < COPIES; n++) {
+        map_memory(lockstep[n]);
+        memcpy(engine.L[n].R.Page, lockstep[n].cpu.Page, sizeof(lockstep[n].cpu.Page));
+        engine.L[n].R.IPeriod = NMI_CYCLES;
+    }
+    engine.Reset();
+
+    for (int frame = 0; frame < frames; frame++) {
+        for (int n = 0; n < COPIES; n++) lockstep[n].frame = frame;
+        engine.Run();
+        for (int n = 0; n < COPIES; n++) {
+            if (lockstep[n].nmi_enabled) engine.Int(n, INT_NMI);
+        }
+    }
+}
+
+static int compare(Engine &engine) {
+    int errors = 0;
+
+    for (int n = 0; n < COPIES; n++) {
+        const M6502 &cpu = scalar[n].cpu;
+        int ram = 0;
+        for (int address = 0; address < 0x2000; address++) {
+            ram += scalar[n].RAM[address] != engine.Ram(n, address);
+            ram += scalar[n].VRAM[address] != engine.Ram(n, 0x4000 + address);
+        }
+        if (ram || cpu.PC.W != engine.PC[n] || cpu.A != engine.A[n] || cpu.X != engine.X[n] || cpu.Y != engine.Y[n] ||
+            cpu.S != engine.S[n] || cpu.P != engine.P[n]) {
+            printf("Copy %d differs: %d bytes, PC %04X/%04X\n", n, ram, cpu.PC.W, engine.PC[n]);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: watara-lockstep <rom.bin> [frames]\n");
+        return -1;
+    }
+    const int frames = argc > 2 ? atoi(argv[2]) : 600;
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        printf("Cannot open %s\n", argv[1]);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    rom.resize(ftell(file));
+    fseek(file, 0, SEEK_SET);
+    fread(rom.data(), sizeof(uint8_t), rom.size(), file);
+    fclose(file);
+
+    if (rom.size() < BANK_SIZE) {
+        printf("%s is smaller than 16 KB\n", argv[1]);
+        return 1;
+    }
+    banks = (int) (rom.size() / BANK_SIZE);
+    memset(open_bus, 0xFF, sizeof(open_bus));
+
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    run_scalar(frames);
+    const double scalar_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    auto engine = std::make_unique<Engine>(0x40);
+    start = clock::now();
+    run_lockstep(*engine, frames);
+    const double lockstep_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    printf("%d copies x %d frames\n", COPIES, frames);
+    printf("Scalar:   %8.1f frames/s\n", COPIES * frames / scalar_seconds);
+    printf("Lockstep: %8.1f frames/s, %.2f copies per vector step, %.1f%% of instructions one copy at a time\n",
+           COPIES * frames / lockstep_seconds, engine->Steps ? (double) engine->Wide / engine->Steps : 0.0,
+           100.0 * engine->Serial / (engine->Wide + engine->Serial + 1));
+
+    return compare(*engine) ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Input movies without a window:
+ *
+ *   watara-movie [-c cheats] record <rom.bin> <movie> <frames>
+ *   watara-movie [-c cheats] play <rom.bin> <movie> [hash]
+ *
+ * record runs the ROM from power-on with a pseudo-random joypad pattern that changes every 8 frames, and saves it.
+ * play replays a movie as fast as the host allows, recorded here or in the emulator with F9.
+ *
+ * Both print the frames per second and a hash of the final state and of all the audio. play returns 1 when given a
+ * hash that does not match, so that a movie and its hash make a regression test.
+ *
+ * -c runs with the patches and freezes in a cheats file, one code per line as cheats_load reads them.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "machine.h"
+#include "movie.h"
+
+static uint32_t hash(uint32_t h, const void *data, size_t size) {
+    for (size_t i = 0; i < size; i++) h = (h ^ ((const uint8_t *) data)[i]) * 16777619u;
+    return h;
+}
+
+static uint8_t random_buttons(int frame) {
+    uint32_t x = (uint32_t) (frame >> 3) * 0x9E3779B9u;
+    x ^= x >> 15;
+    x *= 0x2C1B3C6Du;
+    return (uint8_t) (x >> 24);
+}
+
+int main(int argc, char **argv) {
+    const char *cheats_pathname = nullptr;
+    if (argc > 2 && !strcmp(argv[1], "-c")) {
+        cheats_pathname = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+
+    const bool record = argc == 5 && !strcmp(argv[1], "record");
+    const bool play = (argc == 4 || argc == 5) && !strcmp(argv[1], "play");
+    if (!record && !play) {
+        printf("Usage: watara-movie [-c cheats] record <rom.bin> <movie> <frames>\n");
+        printf("       watara-movie [-c cheats] play <rom.bin> <movie> [hash]\n");
+        return -1;
+    }
+
+    MACHINE *m = new MACHINE();
+    if (!machine_load(m, argv[2])) {
+        printf("Cannot read %s\n", argv[2]);
+        return 1;
+    }
+    machine_reset(m);
+
+    if (cheats_pathname) {
+        CHEATS *cheats = cheats_new(m->rom);
+        if (!cheats_load(cheats, m->rom, cheats_pathname)) {
+            printf("Cannot apply %s\n", cheats_pathname);
+            return 1;
+        }
+        machine_cheat(m, cheats);
+    }
+
+    MOVIE movie;
+    movie_init(&movie, m->rom->hash);
+    if (record) {
+        for (int frame = 0; frame < atoi(argv[4]); frame++) movie_record(&movie, random_buttons(frame));
+    } else if (!movie_load(&movie, argv[3])) {
+        printf("Cannot load %s\n", argv[3]);
+        return 1;
+    } else if (movie.rom_hash != m->rom->hash) {
+        printf("%s was recorded with another ROM\n", argv[3]);
+        return 1;
+    }
+
+    uint32_t audio = 2166136261u;
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < movie.frames; frame++) {
+        m->buttons = movie.buttons[frame];
+        machine_run_frame(m);
+        audio = hash(audio, m->samples, m->sample_count * sizeof(m->samples[0]));
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    auto *state = new MACHINE_STATE;
+    machine_save_state(m, state);
+    const uint32_t state_hash = hash(2166136261u, state, sizeof(MACHINE_STATE));
+
+    printf("%u frames: %.1f frames/s\n", movie.frames, movie.frames / seconds);
+    printf("State %08X, audio %08X\n", state_hash, audio);
+
+    if (record && !movie_save(&movie, argv[3])) {
+        printf("Cannot write %s\n", argv[3]);
+        return 1;
+    }
+    if (play && argc == 5 && strtoul(argv[4], nullptr, 16) != state_hash) {
+        printf("State hash differs from %s\n", argv[4]);
+        return 1;
+    }
+    return 0;
+}
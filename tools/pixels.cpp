@@ -0,0 +1,144 @@
+/*
+ * LCD decoder benchmark:
+ *
+ *   watara-pixels [rounds]
+ *
+ * Decodes 8 KB of random VRAM with every kernel the CPU supports, checks that they all give the pixels the scalar
+ * one does, then times each of them on whole screen lines, 40 bytes at a time as the LCD draws them, and on all of
+ * VRAM in one call, printing pixels per nanosecond. Last it checks lcd_decode at every fine X scroll and width.
+ *
+ * The ghosting blends are checked the same way at every level, and timed on a whole 160x160 frame in microseconds.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "lcd.h"
+
+#define VRAM_SIZE 8192
+#define LINE_BYTES 40
+#define FRAME_PIXELS (160 * 160)
+
+static double pixels_per_ns(lcd_kernel decode, uint16_t *out, const uint8_t *vram, int bytes, int rounds) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        for (int offset = 0; offset + bytes <= VRAM_SIZE; offset += bytes)
+            decode(out + offset * 4, vram + offset, bytes);
+    }
+    const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return (double) rounds * (VRAM_SIZE / bytes) * bytes * 4 / ns;
+}
+
+static double us_per_frame(lcd_ghost_kernel ghost, uint16_t *out, const uint16_t *screen, int rounds) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+        ghost(out, screen, FRAME_PIXELS, round % (LCD_GHOST_LEVELS - 1) + 1);
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / rounds;
+}
+
+// Blends frame into previous at every level with ghost, which must give what the scalar blend does
+static bool ghosts_same(lcd_ghost_kernel ghost, const uint16_t *previous, const uint16_t *frame, int pixels) {
+    std::vector<uint16_t> expected(pixels + 1, 0), out(pixels + 1, 0);
+
+    for (int level = 1; level < LCD_GHOST_LEVELS; level++) {
+        memcpy(expected.data(), previous, pixels * sizeof(uint16_t));
+        memcpy(out.data(), previous, pixels * sizeof(uint16_t));
+        lcd_kernels[0].ghost(expected.data(), frame, pixels, level);
+        ghost(out.data(), frame, pixels, level);
+        if (memcmp(out.data(), expected.data(), (pixels + 1) * sizeof(uint16_t)))
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    const int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+
+    std::vector<uint8_t> vram(VRAM_SIZE);
+    srand(1);
+    for (auto &byte : vram) byte = (uint8_t) rand();
+
+    std::vector<uint16_t> expected(VRAM_SIZE * 4), out(VRAM_SIZE * 4);
+    lcd_kernels[0].decode(expected.data(), vram.data(), VRAM_SIZE);
+
+    int errors = 0;
+    for (int i = 0; i < lcd_kernel_count; i++) {
+        const LCD_KERNEL &kernel = lcd_kernels[i];
+        if (!kernel.supported) {
+            printf("%-8s not supported by this CPU\n", kernel.name);
+            continue;
+        }
+
+        // Odd lengths as well, for the scalar tail of the vector kernels
+        bool same = true;
+        for (int bytes : {VRAM_SIZE, LINE_BYTES + 1, 7, 1}) {
+            memset(out.data(), 0, out.size() * sizeof(uint16_t));
+            kernel.decode(out.data(), vram.data(), bytes);
+            same = same && !memcmp(out.data(), expected.data(), bytes * 4 * sizeof(uint16_t)) && !out[bytes * 4];
+        }
+        if (!same) {
+            printf("%-8s decodes differently from scalar\n", kernel.name);
+            errors++;
+            continue;
+        }
+
+        const double line = pixels_per_ns(kernel.decode, out.data(), vram.data(), LINE_BYTES, rounds);
+        const double whole = pixels_per_ns(kernel.decode, out.data(), vram.data(), VRAM_SIZE, rounds);
+        printf("%-8s %6.2f pixels/ns by line, %6.2f pixels/ns for all of VRAM%s\n", kernel.name, line, whole,
+               i == lcd_kernel_index ? ", used" : "");
+    }
+
+    // A still frame blended into random pixels for long enough shows exactly, whatever the level
+    std::vector<uint16_t> previous(FRAME_PIXELS), frame(FRAME_PIXELS);
+    for (auto &pixel : previous) pixel = (uint16_t) rand();
+    for (auto &pixel : frame) pixel = (uint16_t) rand();
+    for (int level = 1; level < LCD_GHOST_LEVELS; level++) {
+        memcpy(out.data(), previous.data(), FRAME_PIXELS * sizeof(uint16_t));
+        for (int round = 0; round < 200; round++)
+            lcd_ghost(out.data(), frame.data(), FRAME_PIXELS, level);
+        if (memcmp(out.data(), frame.data(), FRAME_PIXELS * sizeof(uint16_t))) {
+            printf("Ghosting at level %d never settles\n", level);
+            errors++;
+        }
+    }
+
+    for (int i = 0; i < lcd_kernel_count; i++) {
+        const LCD_KERNEL &kernel = lcd_kernels[i];
+        if (!kernel.supported)
+            continue;
+
+        bool same = true;
+        for (int pixels : {FRAME_PIXELS, 23, 1})
+            same = same && ghosts_same(kernel.ghost, previous.data(), frame.data(), pixels);
+        if (!same) {
+            printf("%-8s ghosts differently from scalar\n", kernel.name);
+            errors++;
+            continue;
+        }
+
+        memcpy(out.data(), previous.data(), FRAME_PIXELS * sizeof(uint16_t));
+        printf("%-8s %6.2f us per frame of ghosting%s\n", kernel.name,
+               us_per_frame(kernel.ghost, out.data(), frame.data(), rounds / 10 + 1), i == lcd_kernel_index ? ", used" : "");
+    }
+
+    // Every scroll and width against pixels picked out of the scalar decode one by one
+    for (int skip = 0; skip < 4; skip++) {
+        for (int count = 0; count <= 160; count++) {
+            std::vector<uint16_t> line(162, 0xDEAD);
+            lcd_decode(line.data(), vram.data(), skip, count);
+            for (int x = 0; x < 162; x++) {
+                if (line[x] != (x < count ? expected[skip + x] : 0xDEAD)) {
+                    printf("lcd_decode differs at scroll %d, width %d, x %d\n", skip, count, x);
+                    errors++;
+                    break;
+                }
+            }
+        }
+    }
+
+    printf("%d errors\n", errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,299 @@
+/*
+ * Static recompiler: turns a Supervision ROM image into C++.
+ *
+ *   watara-recompile <rom.bin> <out.cpp>
+ *
+ * Code is discovered from the NMI, reset and IRQ vectors at FFFA-FFFF by following jumps, calls and branches.
+ * Every basic block found is decoded with the same Core<Bus>::Decode the block cache uses, and written out as a
+ * C++ function that runs it with the operands and cycle counts as constants. Building with WATARA_AOT set to the
+ * output links those functions in, and Static6502() hands them to the block cache, which runs them in place of the
+ * blocks it decodes at the same ROM offsets. Anything not found here, such as the targets of indirect jumps, still
+ * runs in the interpreter.
+ *
+ * 8000-BFFF is followed in the bank the code selected last with an immediate store to 2026, or in every bank when
+ * that is not known. C000-FFFF is always the last 16 KB of the image, as in main.cpp.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "m6502/core.hpp"
+
+using Cpu = m6502::Core<m6502::DefaultBus>;
+
+// The recompiler only decodes, it never runs anything
+extern "C" byte Rd6502(word address) { return 0xFF; }
+extern "C" void Wr6502(word address, byte value) {}
+extern "C" byte Loop6502(M6502 *R) { return INT_QUIT; }
+
+#define BANK_SIZE 16384
+#define UNKNOWN_BANK (-1)
+
+static std::vector<uint8_t> rom;
+static uint8_t unmapped[256];
+static int banks;
+
+static M6502 cpu;
+
+static void map_bank(int bank) {
+    for (int page = 0; page < 256; page++) {
+        cpu.Page[page] = unmapped;
+    }
+    for (int page = 0x80; page < 0xC0; page++) {
+        cpu.Page[page] = rom.data() + bank * BANK_SIZE + (page - 0x80) * 256;
+    }
+    for (int page = 0xC0; page < 0x100; page++) {
+        cpu.Page[page] = rom.data() + rom.size() - BANK_SIZE + (page - 0xC0) * 256;
+    }
+}
+
+/*
+ * Discovery
+ */
+struct target {
+    uint16_t pc;
+    int bank;
+};
+
+static std::vector<target> work;
+static std::set<std::pair<size_t, int>> visited;
+
+static void follow(uint16_t pc, int bank) {
+    if (pc < 0x8000) return; // RAM and I/O
+
+    if (pc >= 0xC000 || bank != UNKNOWN_BANK) {
+        work.push_back({pc, bank});
+        return;
+    }
+
+    for (int b = 0; b < banks; b++) {
+        work.push_back({pc, b});
+    }
+}
+
+static bool is_store(uint8_t opcode) {
+    static const uint8_t stores[] = {0x64, 0x74, 0x81, 0x84, 0x85, 0x86, 0x8C, 0x8D, 0x8E, 0x91, 0x92, 0x94, 0x95, 0x96, 0x99, 0x9C, 0x9D, 0x9E};
+
+    return memchr(stores, opcode, sizeof(stores)) != nullptr;
+}
+
+/*
+ * Tracks the bank selected by LDA/LDX/LDY #n followed by STA/STX/STY 2026. Any other write that may reach 2026
+ * makes it unknown. Getting it wrong only costs coverage, blocks are matched by offset at runtime.
+ */
+static int bank_after(const m6502::Instr &instr, int bank, int loaded[3]) {
+    const uint8_t opcodes[2] = {instr.Opcode, instr.Opcode2};
+    const uint16_t operands[2] = {instr.Operand, instr.Operand2};
+
+    for (int i = 0; i < (instr.Fused ? 2 : 1); i++) {
+        const uint8_t opcode = opcodes[i];
+        const uint16_t operand = operands[i];
+
+        switch (opcode) {
+            case 0xA9: loaded[0] = operand; continue;
+            case 0xA2: loaded[1] = operand; continue;
+            case 0xA0: loaded[2] = operand; continue;
+            case 0x8D: if (operand == 0x2026) bank = loaded[0] < 0 ? UNKNOWN_BANK : loaded[0] >> 5; continue;
+            case 0x8E: if (operand == 0x2026) bank = loaded[1] < 0 ? UNKNOWN_BANK : loaded[1] >> 5; continue;
+            case 0x8C: if (operand == 0x2026) bank = loaded[2] < 0 ? UNKNOWN_BANK : loaded[2] >> 5; continue;
+            case 0x9C: if (operand == 0x2026) bank = 0; continue;
+        }
+
+        // Indexed or read-modify-write accesses to the I/O page
+        if ((m6502::Kinds[opcode] & m6502::BUS_WRITE) && (operand >> 8) == 0x20) bank = UNKNOWN_BANK;
+        if (!is_store(opcode)) loaded[0] = loaded[1] = loaded[2] = -1;
+    }
+
+    // Carts with fewer than 8 banks mirror them
+    return bank == UNKNOWN_BANK ? bank : bank % banks;
+}
+
+/*
+ * Output
+ */
+static std::string functions;
+static std::vector<std::string> table;
+
+// One opcode of a block, pending being the block cost still to come after it
+static void fixed(uint8_t opcode, uint16_t operand, uint16_t next, int pending) {
+    char line[128];
+
+    if (m6502::ReachesBus(opcode)) {
+        snprintf(line, sizeof(line), "        R->IPending = %d;\n", pending);
+        functions += line;
+    }
+    snprintf(line, sizeof(line), "        Cpu::Fixed<0x%02X>(R, 0x%04X, 0x%04X);\n", opcode, operand, next);
+    functions += line;
+}
+
+static void emit(const m6502::Block &block, size_t at, int bank) {
+    char line[256];
+    const size_t page = at - (block.PC & 0xFF);
+
+    snprintf(line, sizeof(line), "B_%06zX", at);
+    const std::string name = line;
+
+    snprintf(line, sizeof(line), "\n/* %04X", block.PC);
+    functions += line;
+    if (block.PC < 0xC000) {
+        snprintf(line, sizeof(line), ", bank %d", bank);
+        functions += line;
+    }
+    functions += " */\nM6502_FLATTEN static void " + name + "(M6502 *R) {\n    do {\n";
+    snprintf(line, sizeof(line), "        R->ICount -= %d;\n", block.Cycles);
+    functions += line;
+
+    for (int n = 0; n < block.Count; n++) {
+        const m6502::Instr &instr = block.Code[n];
+
+        // Opcodes that may reach I/O with the part of the block cost not yet due in IPending, just like RunOnce()
+        const int rest = block.Cycles - instr.Cycles;
+        if (instr.Fused) {
+            const uint16_t next = instr.Next - 1 - m6502::Operands[instr.Opcode2];
+            fixed(instr.Opcode, instr.Operand, next, rest + Cycles[instr.Opcode2]);
+            fixed(instr.Opcode2, instr.Operand2, instr.Next, rest);
+        } else {
+            fixed(instr.Opcode, instr.Operand, instr.Next, rest);
+        }
+
+        // Leave early just like RunOnce()
+        if (instr.Check && instr.Branch) {
+            snprintf(line, sizeof(line), "        if (R->PC.W != 0x%04X) { R->ICount += %d; R->IPending = 0; return; }\n",
+                     instr.Next, rest);
+            functions += line;
+        } else if (instr.Check) {
+            snprintf(line, sizeof(line),
+                     "        if (R->Page[0x%02X] != Code(R) + 0x%zX || R->ICount + %d <= 0) { R->ICount += %d; R->IPending = 0; "
+                     "R->PC.W = 0x%04X; return; }\n", block.PC >> 8, page, rest, rest, instr.Next);
+            functions += line;
+        }
+    }
+
+    if (!block.Jumps) {
+        snprintf(line, sizeof(line), "        R->PC.W = 0x%04X;\n", block.End);
+        functions += line;
+    }
+    snprintf(line, sizeof(line), "    } while (R->PC.W == 0x%04X && R->ICount >= %d);\n    R->IPending = 0;\n}\n", block.PC,
+             block.Cycles);
+    functions += line;
+
+    snprintf(line, sizeof(line), "    { 0x%06zX, 0x%04X, 0x%04X, %d, %s },\n", at, block.PC, block.End, block.Cycles, name.c_str());
+    table.push_back(line);
+}
+
+static void recompile() {
+    m6502::BlockCache cache(rom.data(), rom.size());
+    std::set<size_t> emitted;
+
+    map_bank(0);
+    for (uint16_t vector = 0xFFFA; vector != 0; vector += 2) {
+        follow(cpu.Page[0xFF][vector & 0xFF] | cpu.Page[0xFF][(vector + 1) & 0xFF] << 8, 0);
+    }
+
+    while (!work.empty()) {
+        const target t = work.back();
+        work.pop_back();
+
+        // Code in C000-FFFF is followed once per bank it may select for 8000-BFFF
+        map_bank(t.bank == UNKNOWN_BANK ? 0 : t.bank);
+        const size_t at = cache.Offset(&cpu, t.pc);
+        if (at == cache.Size || !visited.insert({at, t.pc >= 0xC000 ? t.bank : 0}).second) continue;
+
+        cpu.PC.W = t.pc;
+        const m6502::Block *block = Cpu::Decode(&cpu, cache, at);
+        if (!block) continue;
+
+        if (emitted.insert(at).second) emit(*block, at, t.bank);
+
+        int bank = t.bank, loaded[3] = {-1, -1, -1};
+        for (int n = 0; n < block->Count; n++) {
+            const m6502::Instr &instr = block->Code[n];
+            const uint8_t opcode = instr.Fused ? instr.Opcode2 : instr.Opcode;
+            const uint16_t operand = instr.Fused ? instr.Operand2 : instr.Operand;
+
+            bank = bank_after(instr, bank, loaded);
+
+            if (instr.Check && instr.Branch) follow(instr.Next + (offset) operand, bank);
+            else if (instr.Check) follow(instr.Next, bank); // A bank switch or the end of a slice leaves here
+
+            if (n < block->Count - 1 || !block->Jumps) continue;
+
+            switch (opcode) {
+                case 0x4C: follow(operand, bank); break;                      // JMP
+                case 0x20: follow(operand, bank); follow(instr.Next, bank); break; // JSR
+                case 0x80: follow(instr.Next + (offset) operand, bank); break; // BRA
+                case 0x00: case 0x40: case 0x60: case 0x6C: case 0x7C: break;  // BRK, RTI, RTS, indirect jumps
+                default:
+                    if ((opcode & 0x1F) == 0x10) follow(instr.Next + (offset) operand, bank);
+                    follow(instr.Next, bank);
+                    break;
+            }
+        }
+        if (!block->Jumps) follow(block->End, bank);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("Usage: watara-recompile <rom.bin> <out.cpp>\n");
+        return -1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        printf("Cannot open %s\n", argv[1]);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    rom.resize(ftell(file));
+    fseek(file, 0, SEEK_SET);
+    fread(rom.data(), sizeof(uint8_t), rom.size(), file);
+    fclose(file);
+
+    if (rom.size() < BANK_SIZE) {
+        printf("%s is smaller than 16 KB\n", argv[1]);
+        return 1;
+    }
+    banks = (int) (rom.size() / BANK_SIZE);
+    memset(unmapped, 0xFF, sizeof(unmapped));
+
+    recompile();
+
+    // Blocks are looked up by binary search
+    std::sort(table.begin(), table.end());
+
+    file = fopen(argv[2], "w");
+    if (!file) {
+        printf("Cannot write %s\n", argv[2]);
+        return 1;
+    }
+    fprintf(file, "/* Generated by watara-recompile from %s, do not edit */\n", argv[1]);
+    fprintf(file, "#include \"m6502/core.hpp\"\n\n");
+    fprintf(file, "using Cpu = m6502::Core<m6502::DefaultBus>;\n\n");
+    fprintf(file, "// ROM the blocks were compiled from, as loaded by the machine R belongs to\n");
+    fprintf(file, "static inline const byte *Code(M6502 *R) { return static_cast<m6502::BlockCache *>(R->Cache)->Code; }\n");
+    fputs(functions.c_str(), file);
+    fprintf(file, "\nstatic const m6502::Precompiled Blocks[] = {\n");
+    for (const std::string &line : table) {
+        fputs(line.c_str(), file);
+    }
+    fprintf(file, "};\n\n");
+    fprintf(file, "extern \"C\" int Static6502(M6502 *R) {\n");
+    fprintf(file, "    auto *C = static_cast<m6502::BlockCache *>(R->Cache);\n");
+    fprintf(file, "    if (!C || C->Size != %zu || m6502::BlockCache::Hash(C->Code, C->Size) != 0x%08Xu) return -1;\n",
+            rom.size(), m6502::BlockCache::Hash(rom.data(), rom.size()));
+    fprintf(file, "    C->Static = Blocks;\n");
+    fprintf(file, "    C->StaticCount = sizeof(Blocks) / sizeof(Blocks[0]);\n");
+    fprintf(file, "    C->Flush();\n");
+    fprintf(file, "    return (int) C->StaticCount;\n");
+    fprintf(file, "}\n");
+    fclose(file);
+
+    printf("%s: %zu blocks\n", argv[2], table.size());
+    return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * Save state benchmark:
+ *
+ *   watara-savestate <rom.bin> [frames]
+ *
+ * Runs the ROM for the given number of frames, taking a save state after every one of them, then measures how long
+ * machine_save_state and machine_load_state take on the last state. It then checks that a state round-trips: the
+ * frames after a restored state, and after a state reloaded from a file, must end with the same RAM, VRAM, screen
+ * and registers as the first run of them.
+ *
+ * Then it runs the frames again while pushing them into a rewind history, and steps back through all of them,
+ * checking every state on the way and printing how much memory a second of history takes.
+ *
+ * Last it runs them with 1 to 3 frames of run-ahead, printing the host time each extra frame costs and checking that
+ * the frames shown ahead are the ones the machine gets to later.
+ *
+ * The joypad changes every 8 frames, so that the rerun has to replay input as well.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "machine.h"
+#include "rewind.h"
+
+#define STATE_FILE "watara-savestate.tmp"
+#define FRAMES_PER_SECOND (4000000.0 / 65536)
+
+static void run(MACHINE *m, int from, int to) {
+    for (int frame = from; frame < to; frame++) {
+        m->buttons = (uint8_t) ~(1 << ((frame >> 3) % 8));
+        machine_run_frame(m);
+    }
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs frames while keeping a rewind history, then rewinds all of it
+static int rewind_all(const char *pathname, int frames) {
+    MACHINE *m = new MACHINE();
+    machine_load(m, pathname);
+    machine_reset(m);
+
+    auto *history = new REWIND;
+    if (!rewind_init(history, frames + 1, (size_t) frames * sizeof(MACHINE_STATE))) {
+        printf("Cannot allocate the rewind history\n");
+        return 1;
+    }
+    std::vector<MACHINE_STATE> states(frames + 1);
+
+    double run_seconds = 0, push_seconds = 0, step_seconds = 0;
+    rewind_push(history, m);
+    machine_save_state(m, &states[0]);
+    for (int frame = 0; frame < frames; frame++) {
+        auto start = std::chrono::steady_clock::now();
+        run(m, frame, frame + 1);
+        run_seconds += seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        rewind_push(history, m);
+        push_seconds += seconds_since(start);
+        machine_save_state(m, &states[frame + 1]);
+    }
+    const size_t used = rewind_used(history);
+
+    int errors = 0;
+    MACHINE_STATE *state = new MACHINE_STATE;
+    for (int frame = frames - 1; frame >= 0; frame--) {
+        auto start = std::chrono::steady_clock::now();
+        const bool stepped = rewind_step(history, m);
+        step_seconds += seconds_since(start);
+
+        machine_save_state(m, state);
+        if (!stepped || memcmp(state, &states[frame], sizeof(MACHINE_STATE))) {
+            printf("Rewind: frame %d differs\n", frame);
+            errors++;
+            break;
+        }
+    }
+    if (rewind_step(history, m)) {
+        printf("Rewind: history goes back further than it should\n");
+        errors++;
+    }
+
+    printf("Rewind: %.0f bytes per frame, %.1f KB per second of history\n", (double) used / frames,
+           (double) used / frames * FRAMES_PER_SECOND / 1024);
+    printf("Rewind: frame %.2f us, push %.2f us, step back %.2f us\n", 1e6 * run_seconds / frames,
+           1e6 * push_seconds / frames, 1e6 * step_seconds / frames);
+
+    delete state;
+    rewind_free(history);
+    delete history;
+    machine_eject(m);
+    delete m;
+    return errors;
+}
+
+static bool same(const MACHINE *a, const MACHINE *b) {
+    return !memcmp(a->RAM, b->RAM, sizeof(a->RAM)) && !memcmp(a->VRAM, b->VRAM, sizeof(a->VRAM)) &&
+           !memcmp(a->screen, b->screen, sizeof(a->screen)) && a->cpu.PC.W == b->cpu.PC.W && a->cpu.A == b->cpu.A &&
+           a->cpu.X == b->cpu.X && a->cpu.Y == b->cpu.Y && a->cpu.S == b->cpu.S && a->cpu.P == b->cpu.P &&
+           a->scheduler.cycles == b->scheduler.cycles;
+}
+
+// Runs frames with ahead frames of run-ahead after each, the screens shown must be those of ahead frames later
+static int run_ahead(const char *pathname, int frames, int ahead) {
+    MACHINE *m = new MACHINE(), *shadow = new MACHINE();
+    machine_load(m, pathname);
+    machine_reset(m);
+    machine_insert(shadow, m->rom);
+    machine_reset(shadow);
+
+    // Frames shown, by the frame they were shown after
+    std::vector<std::unique_ptr<uint16_t[]>> shown(frames);
+    auto *state = new MACHINE_STATE;
+    double run_seconds = 0, ahead_seconds = 0;
+    int errors = 0;
+
+    for (int frame = 0; frame < frames && !errors; frame++) {
+        auto start = std::chrono::steady_clock::now();
+        run(m, frame, frame + 1);
+        run_seconds += seconds_since(start);
+
+        // Input is held for the frames run ahead, which is what run() does within each group of 8 frames
+        start = std::chrono::steady_clock::now();
+        machine_run_ahead(m, shadow, ahead, state);
+        ahead_seconds += seconds_since(start);
+
+        shown[frame].reset(new uint16_t[WATARA_SCREEN_WIDTH * WATARA_SCREEN_HEIGHT]);
+        memcpy(shown[frame].get(), shadow->screen, sizeof(shadow->screen));
+
+        if (frame >= ahead && ((frame - ahead) >> 3) == (frame >> 3) &&
+            memcmp(shown[frame - ahead].get(), m->screen, sizeof(m->screen))) {
+            printf("Run-ahead %d: frame %d was not the one shown %d frames before\n", ahead, frame, ahead);
+            errors++;
+        }
+    }
+
+    printf("Run-ahead %d: frame %.2f us, run-ahead %.2f us, %.2f us per extra frame\n", ahead,
+           1e6 * run_seconds / frames, 1e6 * ahead_seconds / frames, 1e6 * ahead_seconds / frames / ahead);
+
+    delete state;
+    machine_eject(shadow);
+    delete shadow;
+    machine_eject(m);
+    delete m;
+    return errors;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: watara-savestate <rom.bin> [frames]\n");
+        return -1;
+    }
+    const int frames = argc > 2 ? atoi(argv[2]) : 600;
+    const int rerun = 60;
+
+    MACHINE *m = new MACHINE();
+    if (!machine_load(m, argv[1])) {
+        printf("Cannot read %s\n", argv[1]);
+        return 1;
+    }
+    machine_reset(m);
+    auto state = std::make_unique<MACHINE_STATE>();
+
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        run(m, frame, frame + 1);
+        machine_save_state(m, state.get());
+    }
+    const double run_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    // Latency of one state, the copies stay in cache just as they would for a tool taking them back to back
+    const int repeats = 100000;
+
+    start = clock::now();
+    for (int i = 0; i < repeats; i++) machine_save_state(m, state.get());
+    const double save_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    start = clock::now();
+    for (int i = 0; i < repeats; i++) machine_load_state(m, state.get());
+    const double load_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    printf("%d frames with a state each: %.1f frames/s\n", frames, frames / run_seconds);
+    printf("State: %zu bytes, save %.3f us, load %.3f us\n", sizeof(MACHINE_STATE), 1e6 * save_seconds / repeats,
+           1e6 * load_seconds / repeats);
+
+    // Fresh machines restored from memory and from a file must go on exactly like the one the state was taken from
+    if (!machine_save_state_file(m, STATE_FILE)) {
+        printf("Cannot write %s\n", STATE_FILE);
+        return 1;
+    }
+    run(m, frames, frames + rerun);
+
+    int errors = 0;
+    auto replay = [&](const char *how, bool (*restore)(MACHINE *, const MACHINE_STATE *)) {
+        MACHINE *copy = new MACHINE();
+        machine_insert(copy, m->rom);
+        machine_reset(copy);
+
+        if (!restore(copy, state.get())) {
+            printf("%s: state rejected\n", how);
+            errors++;
+        } else {
+            run(copy, frames, frames + rerun);
+            if (!same(m, copy)) {
+                printf("%s: the frames after the state differ\n", how);
+                errors++;
+            }
+        }
+        machine_eject(copy);
+        delete copy;
+    };
+
+    replay("Memory", machine_load_state);
+    replay("File", [](MACHINE *copy, const MACHINE_STATE *) { return machine_load_state_file(copy, STATE_FILE); });
+    remove(STATE_FILE);
+
+    if (!errors)
+        printf("States restore the same %d frames from memory and from a file\n", rerun);
+
+    errors += rewind_all(argv[1], frames);
+    for (int ahead = 1; ahead <= 3; ahead++)
+        errors += run_ahead(argv[1], frames, ahead);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Software scaler benchmark:
+ *
+ *   watara-scale [frames] [threads]
+ *
+ * Scales a frame of LCD pixels, decoded from VRAM made of random runs of bytes so that it has flat areas and edges
+ * like a game screen, with every filter at the factors the frontend runs them at. The SSE2 kernels must give what the
+ * plain C ones do, and a pool of threads what one thread does. Each is then timed on one thread, in plain C and with
+ * SSE2, and on the pool, printing microseconds per frame and output pixels per nanosecond per thread.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "lcd.h"
+#include "scaler.h"
+
+#define WIDTH 160
+#define HEIGHT 160
+
+static double us_per_frame(SCALER *scaler, const uint16_t *frame, int frames) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++)
+        scaler_run(scaler, frame);
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / frames;
+}
+
+int main(int argc, char **argv) {
+    const int frames = argc > 1 ? atoi(argv[1]) : 2000;
+    const int threads = argc > 2 ? atoi(argv[2]) : 4;
+
+    std::vector<uint8_t> vram(WIDTH / 4 * HEIGHT);
+    srand(1);
+    for (size_t i = 0; i < vram.size();) {
+        const uint8_t byte = (uint8_t) rand();
+        for (int run = rand() % 8 + 1; run && i < vram.size(); run--)
+            vram[i++] = byte;
+    }
+
+    std::vector<uint16_t> frame(WIDTH * HEIGHT);
+    for (int y = 0; y < HEIGHT; y++)
+        lcd_decode(&frame[y * WIDTH], &vram[y * WIDTH / 4], 0, WIDTH);
+
+    const struct {
+        SCALER_FILTER filter;
+        int factor;
+    } runs[] = {
+            {SCALER_NEAREST, 2}, {SCALER_NEAREST, 3}, {SCALER_NEAREST, 4}, {SCALER_NEAREST, 6},
+            {SCALER_SCALE2X, 2}, {SCALER_SCALE3X, 3}, {SCALER_SCALE4X, 4}, {SCALER_LCD_GRID, 4},
+            {SCALER_LCD_GRID, 6},
+    };
+    const char *names[] = {"nearest", "scale2x", "scale3x", "scale4x", "lcd"};
+
+    int errors = 0;
+    for (const auto &run : runs) {
+        SCALER *plain = scaler_new(WIDTH, HEIGHT, run.filter, run.factor, 1);
+        SCALER *vector = scaler_new(WIDTH, HEIGHT, run.filter, run.factor, 1);
+        SCALER *pool = scaler_new(WIDTH, HEIGHT, run.filter, run.factor, threads);
+        plain->vector = false;
+
+        const size_t bytes = plain->out_size * sizeof(uint16_t);
+        const uint16_t *reference = scaler_run(plain, frame.data());
+        const std::vector<uint16_t> expected(reference, reference + plain->out_size);
+        if (memcmp(scaler_run(vector, frame.data()), expected.data(), bytes) ||
+            memcmp(scaler_run(pool, frame.data()), expected.data(), bytes)) {
+            printf("%-8s %dx scales differently from plain C\n", names[run.filter], run.factor);
+            errors++;
+        } else {
+            const double pixels = (double) plain->out_size;
+            const double c = us_per_frame(plain, frame.data(), frames);
+            const double sse2 = us_per_frame(vector, frame.data(), frames);
+            const double threaded = us_per_frame(pool, frame.data(), frames);
+            printf("%-8s %dx  C %7.1f us %5.2f pixels/ns, SSE2 %7.1f us %5.2f pixels/ns, %d threads %7.1f us %5.2f "
+                   "pixels/ns per thread\n", names[run.filter], run.factor, c, pixels / c / 1000, sse2,
+                   pixels / sse2 / 1000, pool->bands, threaded, pixels / threaded / 1000 / pool->bands);
+        }
+
+        scaler_free(plain);
+        scaler_free(vector);
+        scaler_free(pool);
+    }
+
+    printf("%d errors\n", errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * Watch overhead benchmark:
+ *
+ *   watara-watches [slices] [rounds]
+ *
+ * Times Run6502 on a mixed loop in ROM: an indexed copy into RAM with a sum in zero page, then a JSR to a subroutine
+ * that pushes, reads through a zero page pointer and returns. It runs interpreted, from the block cache and with the
+ * JIT where there is one, each first without watches and then with breakpoints on the loop and read and write
+ * watches on everything it touches. Only Debug6502 checks watches, so Run6502 must run as fast with them as without,
+ * and end in the same state. Debug6502 is timed too, with watches on addresses the loop never touches.
+ *
+ * Each figure is the best of rounds runs of slices slices of 256 cycles, in millions of cycles per second.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "m6502/m6502.h"
+
+#define SLICE_CYCLES 256
+
+static uint8_t RAM[0x2000], ROM[0x4000], open_bus[256];
+static uint8_t *write_pages[256];
+static M6502 *current;
+static long slices, slice_limit;
+
+static const uint8_t loop[] = {
+        0xA2, 0x00,       // C000 LDX #$00
+        0xBD, 0x00, 0xC1, // C002 LDA $C100,X
+        0x9D, 0x00, 0x02, // C005 STA $0200,X
+        0x65, 0x10,       // C008 ADC $10
+        0x85, 0x10,       // C00A STA $10
+        0xE8,             // C00C INX
+        0xD0, 0xF3,       // C00D BNE $C002
+        0xE6, 0x11,       // C00F INC $11
+        0x20, 0x20, 0xC0, // C011 JSR $C020
+        0x4C, 0x00, 0xC0, // C014 JMP $C000
+};
+
+static const uint8_t subroutine[] = {
+        0x48,             // C020 PHA
+        0xB1, 0x12,       // C021 LDA ($12),Y
+        0x68,             // C023 PLA
+        0x60,             // C024 RTS
+};
+
+extern "C" byte Rd6502(word address) {
+    return current->Page[address >> 8][address & 0xFF];
+}
+
+extern "C" void Wr6502(word address, byte value) {
+    if (write_pages[address >> 8]) write_pages[address >> 8][address & 0xFF] = value;
+}
+
+extern "C" byte Loop6502(M6502 *R) {
+    return ++slices >= slice_limit ? INT_QUIT : INT_NONE;
+}
+
+static void map_memory(M6502 &cpu) {
+    memset(write_pages, 0, sizeof(write_pages));
+    for (int page = 0x00; page < 0x20; page++) cpu.Page[page] = write_pages[page] = RAM + page * 256;
+    for (int page = 0x20; page < 0x80; page++) cpu.Page[page] = open_bus;
+    for (int page = 0x80; page < 0x100; page++) cpu.Page[page] = ROM + (page & 0x3F) * 256;
+}
+
+static void watch(M6502 &cpu, int from, int to, int kinds) {
+    for (int address = from; address <= to; address++) Watch6502(&cpu, (word) address, kinds);
+}
+
+enum { INTERPRETED, CACHED, JIT, MODES };
+static const char *mode_names[MODES] = {"interpreter", "cache", "JIT"};
+
+/*
+ * One run from reset, returning the Mcycles/s and leaving the end state in cpu. Returns 0 if the mode is not there.
+ * The watches Watch6502 allocated stay with cpu from one run to the next, cleared.
+ */
+static double run(M6502 &cpu, int mode, bool watched, bool debug) {
+    void *watches = cpu.Debug;
+    memset(&cpu, 0, sizeof(cpu));
+    cpu.Debug = watches;
+    if (watches) watch(cpu, 0x0000, 0xFFFF, 0);
+
+    memset(RAM, 0, sizeof(RAM));
+    map_memory(cpu);
+    current = &cpu;
+
+    if (mode != INTERPRETED) Cache6502(&cpu, ROM, sizeof(ROM));
+    if (mode == JIT && Jit6502(&cpu, JIT_ON) < 0) {
+        Cache6502(&cpu, nullptr, 0);
+        return 0;
+    }
+
+    if (watched && !debug) {
+        watch(cpu, 0xC000, 0xC024, WATCH_EXEC);
+        watch(cpu, 0xC100, 0xC1FF, WATCH_READ);
+        watch(cpu, 0x0000, 0x02FF, WATCH_READ | WATCH_WRITE);
+    } else if (watched) {
+        watch(cpu, 0x1000, 0x10FF, WATCH_EXEC | WATCH_READ | WATCH_WRITE);
+    }
+
+    cpu.IPeriod = SLICE_CYCLES;
+    Reset6502(&cpu);
+    slices = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    if (debug) {
+        while (Debug6502(&cpu, DEBUG_RUN, nullptr) != STOP_QUIT);
+    } else {
+        Run6502(&cpu);
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Cache6502(&cpu, nullptr, 0);
+    return slices * SLICE_CYCLES / seconds / 1e6;
+}
+
+static bool same(const M6502 &a, const M6502 &b) {
+    return a.A == b.A && a.X == b.X && a.Y == b.Y && a.S == b.S && a.P == b.P && a.PC.W == b.PC.W;
+}
+
+int main(int argc, char **argv) {
+    slice_limit = argc > 1 ? atol(argv[1]) : 400000;
+    const int rounds = argc > 2 ? atoi(argv[2]) : 5;
+
+    memset(open_bus, 0xFF, sizeof(open_bus));
+    for (size_t i = 0; i < sizeof(ROM); i++) ROM[i] = (uint8_t) (i * 37 + (i >> 8));
+    memcpy(ROM, loop, sizeof(loop));
+    memcpy(ROM + 0x20, subroutine, sizeof(subroutine));
+    ROM[0x3FFC] = 0x00; // Reset at C000
+    ROM[0x3FFD] = 0xC0;
+
+    static M6502 plain, watched;
+    int errors = 0;
+
+    for (int mode = 0; mode < MODES + 1; mode++) {
+        const bool debug = mode == MODES;
+        double best[2] = {0, 0};
+
+        for (int round = 0; round < rounds; round++) {
+            for (int with = 0; with < 2; with++) {
+                M6502 &cpu = with ? watched : plain;
+                const double speed = run(cpu, debug ? INTERPRETED : mode, with, debug);
+                if (speed > best[with]) best[with] = speed;
+            }
+            if (!same(plain, watched)) {
+                printf("%-11s ends at PC %04X with watches, %04X without\n", debug ? "Debug6502" : mode_names[mode],
+                       watched.PC.W, plain.PC.W);
+                errors++;
+            }
+        }
+
+        if (!best[0]) continue;
+        printf("%-11s %7.1f Mcycles/s without watches, %7.1f with them (%+.1f%%)\n",
+               debug ? "Debug6502" : mode_names[mode], best[0], best[1], (best[1] / best[0] - 1) * 100);
+    }
+
+    printf("%d errors\n", errors);
+    return errors ? 1 : 0;
+}